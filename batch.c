@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <magic.h>
+
+#include "batch.h"
+#include "plugins.h"
+#include "client.h"
+
+typedef enum
+{
+  COMMAND_GET,
+  COMMAND_SET,
+  COMMAND_ADD,
+  COMMAND_REMOVE
+} command_t;
+
+typedef struct tagBatch
+{
+  command_t command;
+  const gchar* key;    /* NULL for `get' of every key */
+  const gchar* value;
+  GMutex output_lock;
+  gint failed;
+} batch_t;
+
+G_LOCK_DEFINE_STATIC(unsafe_plugins);
+
+static void close_magic(gpointer data)
+{
+  magic_close((magic_t)data);
+}
+
+/* libmagic handles are not thread-safe: one per worker */
+static GPrivate s_magic = G_PRIVATE_INIT(close_magic);
+
+static magic_t get_magic(void)
+{
+  magic_t magic = g_private_get(&s_magic);
+  if (magic == NULL)
+    {
+      magic = magic_open(MAGIC_MIME_TYPE);
+      g_assert(magic != NULL);
+
+      int magic_load_result = magic_load(magic, NULL);
+      g_assert(magic_load_result == 0);
+
+      g_private_set(&s_magic, magic);
+    }
+  return magic;
+}
+
+/* bytes that are not UTF-8 (file names often are not) become \u00XX */
+static void append_json_string(GString* out, const gchar* s)
+{
+  g_string_append_c(out, '"');
+  while (*s != '\0')
+    {
+      const gchar* valid_end;
+      gboolean valid = g_utf8_validate(s, -1, &valid_end);
+      for (; s < valid_end; ++s)
+	{
+	  guchar c = *s;
+	  switch (c)
+	    {
+	    case '"':  g_string_append(out, "\\\""); break;
+	    case '\\': g_string_append(out, "\\\\"); break;
+	    case '\n': g_string_append(out, "\\n"); break;
+	    case '\r': g_string_append(out, "\\r"); break;
+	    case '\t': g_string_append(out, "\\t"); break;
+	    default:
+	      if (c < 0x20)
+		g_string_append_printf(out, "\\u%04x", c);
+	      else
+		g_string_append_c(out, c);
+	    }
+	}
+      if (!valid)
+	g_string_append_printf(out, "\\u%04x", (guchar)*s++);
+    }
+  g_string_append_c(out, '"');
+}
+
+static void append_json_pair(const gchar* key, const gchar* value, gpointer user_data)
+{
+  GString* out = (GString*)user_data;
+  if (out->str[out->len - 1] != '{')
+    g_string_append_c(out, ',');
+  append_json_string(out, key);
+  g_string_append_c(out, ':');
+  append_json_string(out, value);
+}
+
+static void emit(batch_t* batch, GString* line)
+{
+  g_string_append(line, "}\n");
+  g_mutex_lock(&batch->output_lock);
+  fputs(line->str, stdout);
+  g_mutex_unlock(&batch->output_lock);
+  g_string_free(line, TRUE);
+}
+
+static void emit_error(batch_t* batch, GString* line, const gchar* message)
+{
+  g_atomic_int_set(&batch->failed, 1);
+  g_string_append(line, ",\"error\":");
+  append_json_string(line, message);
+  emit(batch, line);
+}
+
+/* returns TRUE if metainfo was modified */
+static gboolean apply(const batch_t* batch, Metainfo* metainfo)
+{
+  const gchar* old = metainfo_get(metainfo, batch->key);
+  switch (batch->command)
+    {
+    case COMMAND_SET:
+      if (old != NULL && strcmp(old, batch->value) == 0)
+	return FALSE;
+      metainfo_set(metainfo, batch->key, batch->value);
+      return TRUE;
+
+    case COMMAND_ADD:
+      if (old != NULL)
+	return FALSE;
+      metainfo_set(metainfo, batch->key, batch->value);
+      return TRUE;
+
+    case COMMAND_REMOVE:
+      return metainfo_remove(metainfo, batch->key);
+
+    default:
+      return FALSE;
+    }
+}
+
+static void process_file(gpointer data, gpointer user_data)
+{
+  gchar* filename = (gchar*)data;
+  batch_t* batch = (batch_t*)user_data;
+
+  GString* line = g_string_new("{\"file\":");
+  append_json_string(line, filename);
+
+  struct stat st;
+  if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      emit_error(batch, line, "not a file");
+      g_free(filename);
+      return;
+    }
+
+  const gchar* mime = magic_file(get_magic(), filename);
+  const PluginInterface* plugin = plugins_find(filename, mime);
+  if (plugin == NULL)
+    {
+      emit_error(batch, line, "unsupported file type");
+      g_free(filename);
+      return;
+    }
+
+  gboolean thread_safe = (plugin->capabilities & PLUGIN_CAP_THREAD_SAFE) != 0;
+  GError* error = NULL;
+  Metainfo* metainfo = NULL;
+
+  /* reads may come from a running mount.tagfs, edits start from the file */
+  if (batch->command == COMMAND_GET)
+    metainfo = client_get_metainfo(filename, NULL);
+
+  if (!thread_safe)
+    G_LOCK(unsafe_plugins);
+
+  if (metainfo == NULL)
+    metainfo = plugins_get_metainfo(plugin, filename, &error);
+  gboolean changed = FALSE;
+  if (metainfo != NULL && batch->command != COMMAND_GET && apply(batch, metainfo))
+    {
+      changed = plugins_set_metainfo(plugin, filename, metainfo, &error);
+      if (!changed)
+	{
+	  metainfo_free(metainfo);
+	  metainfo = NULL;
+	}
+    }
+
+  if (!thread_safe)
+    G_UNLOCK(unsafe_plugins);
+
+  /* only what is on disk is reported to the mount */
+  if (changed)
+    client_set_metainfo(filename, metainfo, NULL);
+
+  if (metainfo == NULL)
+    {
+      emit_error(batch, line, error != NULL ? error->message : "can't read metainfo");
+      g_clear_error(&error);
+      g_free(filename);
+      return;
+    }
+
+  if (batch->command == COMMAND_GET)
+    {
+      if (batch->key != NULL)
+	{
+	  const gchar* value = metainfo_get(metainfo, batch->key);
+	  g_string_append(line, ",\"value\":");
+	  if (value != NULL)
+	    append_json_string(line, value);
+	  else
+	    g_string_append(line, "null");
+	}
+      else
+	{
+	  g_string_append(line, ",\"metainfo\":{");
+	  metainfo_foreach(metainfo, append_json_pair, line);
+	  g_string_append_c(line, '}');
+	}
+    }
+  else
+    g_string_append_printf(line, ",\"changed\":%s", changed ? "true" : "false");
+
+  emit(batch, line);
+  metainfo_free(metainfo);
+  g_free(filename);
+}
+
+static void push_list(GThreadPool* pool, FILE* input, gboolean null_separated)
+{
+  gchar* buffer = NULL;
+  size_t size = 0;
+  ssize_t len;
+  while ((len = getdelim(&buffer, &size, null_separated ? '\0' : '\n', input)) > 0)
+    {
+      if (buffer[len - 1] == '\0' || buffer[len - 1] == '\n')
+	buffer[--len] = '\0';
+      if (len > 0)
+	g_thread_pool_push(pool, g_strndup(buffer, len), NULL);
+    }
+  free(buffer);
+}
+
+static gboolean parse_command(batch_t* batch, gchar*** args)
+{
+  static const struct
+  {
+    const gchar* name;
+    command_t command;
+    guint args;
+  } commands[] = {
+    { "get",    COMMAND_GET,    0 },
+    { "set",    COMMAND_SET,    2 },
+    { "add",    COMMAND_ADD,    2 },
+    { "remove", COMMAND_REMOVE, 1 },
+  };
+
+  gchar** arg = *args;
+  if (*arg == NULL)
+    return FALSE;
+
+  guint i;
+  for (i = 0; i < G_N_ELEMENTS(commands); ++i)
+    if (strcmp(*arg, commands[i].name) == 0)
+      break;
+  if (i == G_N_ELEMENTS(commands))
+    return FALSE;
+  ++arg;
+
+  guint n;
+  for (n = 0; n < commands[i].args; ++n)
+    if (arg[n] == NULL)
+      return FALSE;
+
+  batch->command = commands[i].command;
+  if (n > 0)
+    batch->key = arg[0];
+  if (n > 1)
+    batch->value = arg[1];
+
+  *args = arg + n;
+  return TRUE;
+}
+
+/* argv[0] is the program name, --batch is already stripped */
+int batch_main(int argc, char** argv)
+{
+  gint jobs = g_get_num_processors();
+  gchar* key = NULL;
+  gchar* list = NULL;
+  gboolean null_separated = FALSE;
+  gchar** rest = NULL;
+
+  GOptionEntry entries[] = {
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Number of files processed in parallel", "N" },
+    { "key", 'k', 0, G_OPTION_ARG_STRING, &key, "Print only KEY (get)", "KEY" },
+    { "files-from", 'f', 0, G_OPTION_ARG_FILENAME, &list, "Read file names from FILE (- for stdin)", "FILE" },
+    { "null", '0', 0, G_OPTION_ARG_NONE, &null_separated, "File names in lists are separated by NUL", NULL },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &rest, NULL, NULL },
+    { NULL }
+  };
+
+  GOptionContext* context = g_option_context_new("get | set KEY VALUE | add KEY VALUE | remove KEY [FILE...]");
+  g_option_context_set_summary(context,
+			       "Reads or edits metainfo of many files without a display.\n"
+			       "`add' leaves existing values alone. File names come from the\n"
+			       "arguments, from --files-from or, if neither is given, from stdin.\n"
+			       "One JSON object per file is printed to stdout.");
+  g_option_context_add_main_entries(context, entries, NULL);
+
+  GError* error = NULL;
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      g_option_context_free(context);
+      return 1;
+    }
+
+  batch_t batch;
+  memset(&batch, 0, sizeof(batch));
+  g_mutex_init(&batch.output_lock);
+
+  gchar** args = rest;
+  if (rest == NULL || !parse_command(&batch, &args) || jobs < 1)
+    {
+      gchar* help = g_option_context_get_help(context, TRUE, NULL);
+      fputs(help, stderr);
+      g_free(help);
+      g_option_context_free(context);
+      g_strfreev(rest);
+      g_free(key);
+      g_free(list);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if (batch.command == COMMAND_GET)
+    batch.key = key;
+
+  if (plugins_load() == 0)
+    fprintf(stderr, "Warning: no plugins found\n");
+  plugins_start_helpers();
+
+  GThreadPool* pool = g_thread_pool_new(process_file, &batch, jobs, TRUE, NULL);
+
+  gboolean have_files = *args != NULL;
+  for (; *args != NULL; ++args)
+    g_thread_pool_push(pool, g_strdup(*args), NULL);
+
+  if (list != NULL)
+    {
+      FILE* input = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+      if (input == NULL)
+	{
+	  fprintf(stderr, "Error: can't open %s\n", list);
+	  g_atomic_int_set(&batch.failed, 1);
+	}
+      else
+	{
+	  push_list(pool, input, null_separated);
+	  if (input != stdin)
+	    fclose(input);
+	}
+    }
+  else if (!have_files)
+    push_list(pool, stdin, null_separated);
+
+  g_thread_pool_free(pool, FALSE, TRUE);
+  fflush(stdout);
+
+  plugins_unload();
+  g_mutex_clear(&batch.output_lock);
+  g_strfreev(rest);
+  g_free(key);
+  g_free(list);
+
+  return batch.failed ? 2 : 0;
+}
@@ -0,0 +1,7 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/* tageditor --batch; needs no display */
+int batch_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <glib.h>
+
+#include "client.h"
+
+#define CLIENT_TIMEOUT 2 /* seconds */
+
+GQuark client_error_quark(void)
+{
+  return g_quark_from_static_string("client-error-quark");
+}
+
+gchar* client_socket_dir(void)
+{
+  return g_build_filename(g_get_user_runtime_dir(), "tagfs", NULL);
+}
+
+static int connect_socket(const gchar* filename)
+{
+  struct sockaddr_un addr;
+  if (strlen(filename) >= sizeof(addr.sun_path))
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, filename);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  /* a stuck service must not hang the editor */
+  struct timeval tv = { CLIENT_TIMEOUT, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+static gboolean write_all(int fd, const gchar* data, gsize len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write(fd, data, len);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return FALSE;
+	}
+      data += n;
+      len -= n;
+    }
+  return TRUE;
+}
+
+static void append_pair(const gchar* key, const gchar* value, gpointer user_data)
+{
+  GString* request = (GString*)user_data;
+  gchar* k = g_strescape(key, NULL);
+  gchar* v = g_strescape(value, NULL);
+  g_string_append_printf(request, "%s\t%s\n", k, v);
+  g_free(k);
+  g_free(v);
+}
+
+/* reads one line without the newline, NULL on EOF or timeout */
+static gchar* read_line(FILE* in)
+{
+  gchar* line = NULL;
+  size_t size = 0;
+  ssize_t len = getline(&line, &size, in);
+  if (len <= 0)
+    {
+      free(line);
+      return NULL;
+    }
+  if (line[len - 1] == '\n')
+    line[len - 1] = '\0';
+
+  gchar* result = g_strdup(line);
+  free(line);
+  return result;
+}
+
+/* the connection positioned after an OK line, or NULL */
+static FILE* send_request(const gchar* filename, const gchar* request)
+{
+  int fd = connect_socket(filename);
+  if (fd < 0)
+    return NULL; /* stale socket of a dead instance */
+
+  if (!write_all(fd, request, strlen(request)))
+    {
+      close(fd);
+      return NULL;
+    }
+
+  FILE* in = fdopen(fd, "r");
+  gchar* line = read_line(in);
+  gboolean ok = line != NULL && strcmp(line, "OK") == 0;
+  g_free(line);
+  if (ok)
+    return in;
+  fclose(in);
+  return NULL;
+}
+
+/*
+ * Sends request to every service, until one answers OK unless all is
+ * set. Returns the connection of the last one positioned after the OK
+ * line, or NULL.
+ */
+static FILE* request_services(const gchar* request, gboolean all, GError** error)
+{
+  gchar* dirname = client_socket_dir();
+  GDir* dir = g_dir_open(dirname, 0, NULL);
+  if (dir == NULL)
+    {
+      g_free(dirname);
+      g_set_error(error, CLIENT_ERROR, CLIENT_ERROR_UNAVAILABLE, "No metainfo service is running");
+      return NULL;
+    }
+
+  FILE* result = NULL;
+  const gchar* name;
+  while ((result == NULL || all) && (name = g_dir_read_name(dir)) != NULL)
+    {
+      if (!g_str_has_suffix(name, ".sock"))
+	continue;
+
+      gchar* filename = g_build_filename(dirname, name, NULL);
+      FILE* in = send_request(filename, request);
+      g_free(filename);
+      if (in != NULL)
+	{
+	  if (result != NULL)
+	    fclose(result);
+	  result = in;
+	}
+    }
+
+  g_dir_close(dir);
+  g_free(dirname);
+
+  if (result == NULL)
+    g_set_error(error, CLIENT_ERROR, CLIENT_ERROR_UNAVAILABLE, "File is not indexed by a metainfo service");
+  return result;
+}
+
+static FILE* request(const gchar* request, GError** error)
+{
+  return request_services(request, FALSE, error);
+}
+
+static gchar* request_line(const gchar* command, const gchar* filename)
+{
+  gchar* canonical = realpath(filename, NULL);
+  if (canonical == NULL)
+    return NULL;
+
+  gchar* escaped = g_strescape(canonical, NULL);
+  gchar* line = g_strdup_printf("%s %s\n", command, escaped);
+  g_free(escaped);
+  free(canonical);
+  return line;
+}
+
+Metainfo* client_get_metainfo(const gchar* filename, GError** error)
+{
+  gchar* line = request_line("GET", filename);
+  if (line == NULL)
+    {
+      g_set_error(error, CLIENT_ERROR, CLIENT_ERROR_UNAVAILABLE, "%s", g_strerror(errno));
+      return NULL;
+    }
+
+  FILE* in = request(line, error);
+  g_free(line);
+  if (in == NULL)
+    return NULL;
+
+  Metainfo* result = metainfo_new();
+  gboolean complete = FALSE;
+  while ((line = read_line(in)) != NULL)
+    {
+      if (strcmp(line, ".") == 0)
+	{
+	  complete = TRUE;
+	  g_free(line);
+	  break;
+	}
+
+      gchar* tab = strchr(line, '\t');
+      if (tab != NULL)
+	{
+	  *tab = '\0';
+	  gchar* key = g_strcompress(line);
+	  gchar* value = g_strcompress(tab + 1);
+	  metainfo_set(result, key, value);
+	  g_free(key);
+	  g_free(value);
+	}
+      g_free(line);
+    }
+  fclose(in);
+
+  if (!complete)
+    {
+      metainfo_free(result);
+      g_set_error(error, CLIENT_ERROR, CLIENT_ERROR_PROTOCOL, "Truncated reply from metainfo service");
+      return NULL;
+    }
+  return result;
+}
+
+gboolean client_set_metainfo(const gchar* filename, const Metainfo* metainfo, GError** error)
+{
+  gchar* line = request_line("SET", filename);
+  if (line == NULL)
+    {
+      g_set_error(error, CLIENT_ERROR, CLIENT_ERROR_UNAVAILABLE, "%s", g_strerror(errno));
+      return FALSE;
+    }
+
+  GString* text = g_string_new(line);
+  g_free(line);
+  metainfo_foreach(metainfo, append_pair, text);
+  g_string_append(text, ".\n");
+
+  /* every mount indexing the file lists it */
+  FILE* in = request_services(text->str, TRUE, error);
+  g_string_free(text, TRUE);
+  if (in == NULL)
+    return FALSE;
+
+  fclose(in);
+  return TRUE;
+}
+
+gboolean client_set_metainfo_many(const gchar* const* filenames,
+				  const Metainfo* const* metainfo,
+				  guint count,
+				  GError** error)
+{
+  GString* files = g_string_new(NULL);
+  guint sent = 0;
+  guint i;
+  for (i = 0; i < count; ++i)
+    {
+      gchar* canonical = realpath(filenames[i], NULL);
+      if (canonical == NULL)
+	continue;
+
+      gchar* escaped = g_strescape(canonical, NULL);
+      g_string_append_printf(files, "%s\n", escaped);
+      g_free(escaped);
+      free(canonical);
+      metainfo_foreach(metainfo[i], append_pair, files);
+      g_string_append(files, ".\n");
+      ++sent;
+    }
+
+  if (sent == 0)
+    {
+      g_string_free(files, TRUE);
+      g_set_error(error, CLIENT_ERROR, CLIENT_ERROR_UNAVAILABLE, "No such files");
+      return FALSE;
+    }
+
+  /* several mounts may each index some of the files */
+  gchar* text = g_strdup_printf("MSET %u\n%s", sent, files->str);
+  g_string_free(files, TRUE);
+  FILE* in = request_services(text, TRUE, error);
+  g_free(text);
+  if (in == NULL)
+    return FALSE;
+
+  fclose(in);
+  return TRUE;
+}
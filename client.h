@@ -0,0 +1,44 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <glib.h>
+
+#include "metainfo.h"
+
+/*
+ * Talks to the metainfo service of running mount.tagfs instances. Every
+ * instance listens on <runtime dir>/tagfs/<pid>.sock. The protocol is
+ * line based, paths, keys and values are escaped with g_strescape():
+ *
+ *   GET <path>            ->  OK, then <key>\t<value> lines, then "."
+ *   SET <path>, then <key>\t<value> lines, then "."  ->  OK
+ *   MSET <count>, then per file <path> and lines as for SET  ->  OK
+ *
+ * MSET updates the files the instance indexes, in one transaction, and
+ * is answered OK if there was at least one.
+ *
+ * Any request may be answered with "ERR <message>" instead.
+ */
+
+#define CLIENT_ERROR client_error_quark()
+
+typedef enum
+{
+  CLIENT_ERROR_UNAVAILABLE,  /* no service indexes the file */
+  CLIENT_ERROR_PROTOCOL
+} ClientError;
+
+GQuark client_error_quark(void);
+
+gchar* client_socket_dir(void);
+
+Metainfo* client_get_metainfo(const gchar* filename, GError** error);
+/* sent to every service, TRUE if any indexes the file */
+gboolean client_set_metainfo(const gchar* filename, const Metainfo* metainfo, GError** error);
+/* one request per service for many files, TRUE if any service took some */
+gboolean client_set_metainfo_many(const gchar* const* filenames,
+				  const Metainfo* const* metainfo,
+				  guint count,
+				  GError** error);
+
+#endif
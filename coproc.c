@@ -0,0 +1,306 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "coproc.h"
+#include "spawn.h"
+#include "trace.h"
+
+#define READ_CHUNK 65536
+
+typedef struct tagWorker
+{
+  pid_t pid;       /* 0 when not running */
+  int fd;          /* socket connected to the helper's stdin and stdout */
+  gboolean busy;
+  GString* input;  /* helper output not yet split into lines */
+} worker_t;
+
+struct tagCoprocPool
+{
+  gchar** argv;
+  guint timeout_ms;
+  SpawnLimits limits;
+  guint size;
+  worker_t* workers;
+  GMutex lock;
+  GCond idle;
+};
+
+GQuark coproc_error_quark(void)
+{
+  return g_quark_from_static_string("coproc");
+}
+
+static gboolean worker_start(CoprocPool* pool, worker_t* w, GError** error)
+{
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+      g_set_error(error, COPROC_ERROR, COPROC_ERROR_SPAWN,
+		  "socketpair: %s", g_strerror(errno));
+      return FALSE;
+    }
+
+  pid_t pid;
+  gboolean started = spawn_start((const gchar* const*)pool->argv, &pool->limits, sv[1], sv[1], &pid, error);
+  close(sv[1]);
+  if (!started)
+    {
+      close(sv[0]);
+      return FALSE;
+    }
+
+  fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+  w->pid = pid;
+  w->fd = sv[0];
+  g_string_truncate(w->input, 0);
+  return TRUE;
+}
+
+/* a healthy helper exits on end of input, the others are killed */
+static void worker_stop(worker_t* w, gboolean force)
+{
+  if (w->pid == 0)
+    return;
+
+  close(w->fd);
+  w->fd = -1;
+
+  gint64 deadline = g_get_monotonic_time() + (force ? 0 : COPROC_STOP_MS * G_TIME_SPAN_MILLISECOND);
+  pid_t r;
+  while ((r = waitpid(w->pid, NULL, WNOHANG)) == 0 && g_get_monotonic_time() < deadline)
+    g_usleep(1000);
+  if (r == 0)
+    {
+      kill(w->pid, SIGKILL);
+      while (waitpid(w->pid, NULL, 0) < 0 && errno == EINTR)
+	;
+    }
+
+  w->pid = 0;
+  g_string_truncate(w->input, 0);
+}
+
+CoprocPool* coproc_pool_new(const gchar* const* argv, guint size, guint timeout_ms)
+{
+  g_return_val_if_fail(argv != NULL && argv[0] != NULL, NULL);
+
+  CoprocPool* pool = g_new0(CoprocPool, 1);
+  pool->argv = g_strdupv((gchar**)argv);
+  pool->size = MAX(size, 1);
+  pool->timeout_ms = timeout_ms;
+  pool->workers = g_new0(worker_t, pool->size);
+
+  /* helpers live long: only their memory is limited */
+  pool->limits = *spawn_default_limits();
+  pool->limits.timeout_ms = 0;
+  pool->limits.cpu_seconds = 0;
+  pool->limits.output_bytes = 0;
+  g_mutex_init(&pool->lock);
+  g_cond_init(&pool->idle);
+
+  guint i;
+  for (i = 0; i < pool->size; ++i)
+    {
+      pool->workers[i].fd = -1;
+      pool->workers[i].input = g_string_new(NULL);
+    }
+  return pool;
+}
+
+void coproc_pool_free(CoprocPool* pool)
+{
+  if (pool == NULL)
+    return;
+
+  guint i;
+  for (i = 0; i < pool->size; ++i)
+    {
+      worker_stop(&pool->workers[i], FALSE);
+      g_string_free(pool->workers[i].input, TRUE);
+    }
+  g_free(pool->workers);
+  g_strfreev(pool->argv);
+  g_mutex_clear(&pool->lock);
+  g_cond_clear(&pool->idle);
+  g_free(pool);
+}
+
+static worker_t* acquire_worker(CoprocPool* pool)
+{
+  g_mutex_lock(&pool->lock);
+  for (;;)
+    {
+      guint i;
+      worker_t* w = NULL;
+
+      /* prefer a running helper over starting a new one */
+      for (i = 0; i < pool->size; ++i)
+	if (!pool->workers[i].busy && (w == NULL || pool->workers[i].pid != 0))
+	  w = &pool->workers[i];
+
+      if (w != NULL)
+	{
+	  w->busy = TRUE;
+	  g_mutex_unlock(&pool->lock);
+	  return w;
+	}
+      g_cond_wait(&pool->idle, &pool->lock);
+    }
+}
+
+static void release_worker(CoprocPool* pool, worker_t* w)
+{
+  g_mutex_lock(&pool->lock);
+  w->busy = FALSE;
+  g_cond_signal(&pool->idle);
+  g_mutex_unlock(&pool->lock);
+}
+
+static int poll_timeout(gint64 deadline)
+{
+  gint64 left = (deadline - g_get_monotonic_time() + 999) / 1000;
+  return left > 0 ? (int)MIN(left, G_MAXINT) : 0;
+}
+
+/* waits for events on the helper's socket, 0 once the deadline passed */
+static short wait_for(worker_t* w, short events, gint64 deadline)
+{
+  for (;;)
+    {
+      struct pollfd pfd;
+      pfd.fd = w->fd;
+      pfd.events = events;
+      pfd.revents = 0;
+      int r = poll(&pfd, 1, poll_timeout(deadline));
+      if (r > 0)
+	return pfd.revents;
+      if (r == 0 || errno != EINTR)
+	return 0;
+    }
+}
+
+/*
+ * Sends the request and delivers the answer. *lost is set when the
+ * helper went away before answering anything, which a helper that
+ * exited after the previous request does too.
+ */
+static gboolean exchange(CoprocPool* pool, worker_t* w, const gchar* request,
+			 read_callback_t callback, void* user_data,
+			 gboolean* lost, GError** error)
+{
+  gint64 deadline = g_get_monotonic_time() + (gint64)pool->timeout_ms * G_TIME_SPAN_MILLISECOND;
+  gchar* line = g_strconcat(request, "\n", NULL);
+  gsize len = strlen(line);
+  gsize written = 0;
+  gboolean gone = FALSE;
+  gboolean timed_out = FALSE;
+  gboolean answered = FALSE;
+  gboolean result = FALSE;
+
+  while (written < len && !gone && !timed_out)
+    {
+      ssize_t n = send(w->fd, line + written, len - written, MSG_NOSIGNAL);
+      if (n >= 0)
+	written += n;
+      else if (errno != EAGAIN && errno != EINTR)
+	gone = TRUE;
+      else
+	timed_out = wait_for(w, POLLOUT, deadline) == 0;
+    }
+
+  gchar* buf = g_malloc(READ_CHUNK);
+  while (!gone && !timed_out)
+    {
+      gchar* nl = memchr(w->input->str, '\n', w->input->len);
+      if (nl == NULL)
+	{
+	  timed_out = wait_for(w, POLLIN, deadline) == 0;
+	  ssize_t n = timed_out ? 0 : read(w->fd, buf, READ_CHUNK);
+	  if (n > 0)
+	    g_string_append_len(w->input, buf, n);
+	  else if (!timed_out)
+	    gone = n == 0 || (errno != EAGAIN && errno != EINTR);
+	  continue;
+	}
+
+      *nl = '\0';
+      gsize consumed = nl - w->input->str + 1;
+      if (g_str_has_prefix(w->input->str, COPROC_END_MARKER))
+	{
+	  const gchar* message = w->input->str + strlen(COPROC_END_MARKER);
+	  result = *message == '\0';
+	  if (!result)
+	    g_set_error(error, COPROC_ERROR, COPROC_ERROR_HELPER, "%s", message);
+	  g_string_erase(w->input, 0, consumed);
+	  break;
+	}
+      g_strchomp(w->input->str);
+      callback(user_data, w->input->str);
+      g_string_erase(w->input, 0, consumed);
+      answered = TRUE;
+    }
+  g_free(buf);
+  g_free(line);
+
+  *lost = gone && !answered;
+  if (gone)
+    g_set_error(error, COPROC_ERROR, COPROC_ERROR_CRASHED,
+		"Helper %s exited unexpectedly.", pool->argv[0]);
+  else if (timed_out)
+    g_set_error(error, COPROC_ERROR, COPROC_ERROR_TIMEOUT,
+		"Helper %s timed out after %u ms.", pool->argv[0], pool->timeout_ms);
+  if (gone || timed_out)
+    worker_stop(w, TRUE);
+  return result;
+}
+
+gboolean coproc_pool_request(CoprocPool* pool,
+			     const gchar* request,
+			     read_callback_t callback,
+			     void* user_data,
+			     GError** error)
+{
+  /* the protocol is line based */
+  if (strchr(request, '\n') != NULL)
+    {
+      g_set_error(error, COPROC_ERROR, COPROC_ERROR_REQUEST,
+		  "Request contains a line break.");
+      return FALSE;
+    }
+
+  guint64 span = trace_begin();
+  worker_t* w = acquire_worker(pool);
+
+  gboolean result = FALSE;
+  GError* local_error = NULL;
+  gint attempt;
+  for (attempt = 0; attempt < 2 && !result; ++attempt)
+    {
+      gboolean reused = w->pid != 0;
+      if (!reused && !worker_start(pool, w, &local_error))
+	break;
+
+      gboolean lost;
+      g_clear_error(&local_error);
+      result = exchange(pool, w, request, callback, user_data, &lost, &local_error);
+      /* a fresh helper failing the same way would not do better */
+      if (!result && !(lost && reused))
+	break;
+    }
+
+  release_worker(pool, w);
+  trace_end("helper", "extract", span);
+
+  if (local_error != NULL)
+    g_propagate_error(error, local_error);
+  return result;
+}
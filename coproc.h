@@ -0,0 +1,48 @@
+#ifndef COPROC_H
+#define COPROC_H
+
+#include <glib.h>
+
+#include "helpers.h"
+
+/*
+ * Pool of long-lived helper processes, started on first use.
+ *
+ * A helper reads one request per line on stdin and answers with any
+ * number of output lines followed by a line starting with
+ * COPROC_END_MARKER. Text after the marker, if any, is an error message
+ * for that request. A helper that misses the deadline of a request or
+ * exits is killed and started again for the next one.
+ */
+#define COPROC_END_MARKER "\x1e"
+
+#define COPROC_ERROR coproc_error_quark()
+
+typedef enum
+{
+  COPROC_ERROR_SPAWN,
+  COPROC_ERROR_TIMEOUT,
+  COPROC_ERROR_CRASHED,
+  COPROC_ERROR_HELPER,
+  COPROC_ERROR_REQUEST
+} CoprocError;
+
+typedef struct tagCoprocPool CoprocPool;
+
+GQuark coproc_error_quark(void);
+
+/* at most size helpers, each request answered within timeout_ms */
+CoprocPool* coproc_pool_new(const gchar* const* argv, guint size, guint timeout_ms);
+/* helpers get COPROC_STOP_MS to exit on end of input, then SIGKILL */
+void coproc_pool_free(CoprocPool* pool);
+
+#define COPROC_STOP_MS 1000
+
+/* request is a line without its '\n'; blocks while every helper is busy */
+gboolean coproc_pool_request(CoprocPool* pool,
+			     const gchar* request,
+			     read_callback_t callback,
+			     void* user_data,
+			     GError** error);
+
+#endif
@@ -8,16 +8,8 @@
 #include "core.h"
 
 #include "helpers.h"
-#include "plugin_interface.h"
-
-extern PluginInterface djvu_interface;
-extern PluginInterface pdf_interface;
-
-static PluginInterface* s_plugins[] = {
-  &djvu_interface,
-  &pdf_interface
-};
-#define PLUGINS_COUNT (sizeof(s_plugins)/sizeof(*s_plugins))
+#include "plugins.h"
+#include "client.h"
 
 static gboolean question(const gchar* text)
 {
@@ -33,18 +25,58 @@ static gboolean question(const gchar* text)
   return result;
 }
 
+static void show_error(const gchar* text)
+{
+  GtkWidget* d = gtk_message_dialog_new(NULL,
+					GTK_DIALOG_MODAL,
+					GTK_MESSAGE_ERROR,
+					GTK_BUTTONS_CLOSE,
+					"%s",
+					text);
+  gtk_dialog_run(GTK_DIALOG(d));
+  gtk_object_destroy(GTK_OBJECT(d));
+}
+
 typedef struct tagState
 {
-  PluginInterface* plugin;
+  gint ref_count;         /* the page and a pending load */
+  const PluginInterface* plugin;
   gchar* filename;
-  GData* metainfo;
+  Metainfo* metainfo;     /* NULL until loaded */
   GtkListStore* store;
+  GCancellable* cancellable;
+  GtkWidget* status;      /* placeholder label */
+  GtkWidget* content;     /* insensitive until loaded */
 } state_t;
 
-static void add_clicked(GtkWidget* button, gpointer user_data)
+static state_t* state_ref(state_t* state)
+{
+  g_atomic_int_inc(&state->ref_count);
+  return state;
+}
+
+static void state_unref(gpointer data)
+{
+  state_t* state = (state_t*)data;
+  if (!g_atomic_int_dec_and_test(&state->ref_count))
+    return;
+
+  g_free(state->filename);
+  metainfo_free(state->metainfo);
+  g_object_unref(state->store);
+  g_object_unref(state->cancellable);
+  g_free(state);
+}
+
+/* plugins not declaring PLUGIN_CAP_THREAD_SAFE run one at a time */
+G_LOCK_DEFINE_STATIC(unsafe_plugins);
+
+/* asks for a new entry, returns FALSE when cancelled */
+static gboolean ask_entry(GtkWidget* parent, gchar** key, gchar** value)
 {
+  gboolean result = FALSE;
   GtkWidget* dlg = gtk_dialog_new_with_buttons("Add entry",
-					       GTK_WINDOW(gtk_widget_get_toplevel(button)),
+					       GTK_WINDOW(gtk_widget_get_toplevel(parent)),
 					       GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
 					       GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
 					       GTK_STOCK_ADD, GTK_RESPONSE_ACCEPT,
@@ -82,19 +114,37 @@ static void add_clicked(GtkWidget* button, gpointer user_data)
       gchar* v = g_strstrip(g_strdup(gtk_entry_get_text(GTK_ENTRY(ev))));
       if (k && k[0] != '\0')
 	{
-	  GtkListStore* store = GTK_LIST_STORE(user_data);
-
-	  GtkTreeIter iter;
-	  gtk_list_store_append(store, &iter);
-	  gtk_list_store_set(store, &iter,
-			     0, k,
-			     1, v,
-			     -1);
+	  *key = k;
+	  *value = v;
+	  result = TRUE;
+	}
+      else
+	{
+	  g_free(k);
+	  g_free(v);
 	}
+    }
+  gtk_object_destroy(GTK_OBJECT(dlg));
+  return result;
+}
+
+static void add_clicked(GtkWidget* button, gpointer user_data)
+{
+  gchar* k;
+  gchar* v;
+  if (ask_entry(button, &k, &v))
+    {
+      GtkListStore* store = GTK_LIST_STORE(user_data);
+
+      GtkTreeIter iter;
+      gtk_list_store_append(store, &iter);
+      gtk_list_store_set(store, &iter,
+			 0, k,
+			 1, v,
+			 -1);
       g_free(k);
       g_free(v);
     }
-  gtk_object_destroy(GTK_OBJECT(dlg));
 }
 
 static void remove_clicked(GtkWidget* button, gpointer user_data)
@@ -135,8 +185,14 @@ static void page_destroy(GtkWidget* widget, gpointer user_data)
 {
   state_t* state = (state_t*)user_data;
 
-  GData* result;
-  g_datalist_init(&result);
+  g_cancellable_cancel(state->cancellable);
+  if (state->metainfo == NULL) /* closed before metainfo arrived */
+    {
+      state_unref(state);
+      return;
+    }
+
+  Metainfo* result = metainfo_new();
 
   GtkTreeIter iter;
   if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(state->store), &iter))
@@ -150,42 +206,109 @@ static void page_destroy(GtkWidget* widget, gpointer user_data)
 			   1, &value,
 			   -1);
 
-	g_datalist_set_data_full(&result, key, value, g_free);
+	metainfo_set(result, key, value);
 
 	g_free(key);
+	g_free(value);
       }
     while (gtk_tree_model_iter_next(GTK_TREE_MODEL(state->store), &iter));
 
-  if (!are_datalists_equal(state->metainfo, result))
+  if (!metainfo_equal(state->metainfo, result))
     if (question("Do you want to save changes in metainfo?"))
-      state->plugin->set_metainfo(state->filename, result);
+      {
+	GError* error = NULL;
+	if (plugins_set_metainfo(state->plugin, state->filename, result, &error))
+	  client_set_metainfo(state->filename, result, NULL);
+	else
+	  {
+	    gchar* text = g_strdup_printf("Can't save metainfo: %s", error->message);
+	    show_error(text);
+	    g_free(text);
+	    g_error_free(error);
+	  }
+      }
 
-  /* TODO: free state */
+  metainfo_free(result);
+  state_unref(state);
 }
 
-static void append_to_list_store(GQuark key_id, gpointer data, gpointer user_data)
+static void append_to_list_store(const gchar* key, const gchar* value, gpointer user_data)
 {
   GtkListStore* store = GTK_LIST_STORE(user_data);
   GtkTreeIter iter;
   gtk_list_store_append(store, &iter);
   gtk_list_store_set(store, &iter,
-		     0, g_quark_to_string(key_id),
-		     1, (gchar*)data,
+		     0, key,
+		     1, value,
 		     -1);
 }
 
-GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error)
+static void load_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
 {
-  PluginInterface* plugin = NULL;
+  state_t* state = (state_t*)task_data;
+  gboolean thread_safe = (state->plugin->capabilities & PLUGIN_CAP_THREAD_SAFE) != 0;
 
-  int i;
-  for (i = 0; i < PLUGINS_COUNT; ++i)
-    if (s_plugins[i]->check_file(filename, mime))
-      {
-	plugin = s_plugins[i];
-	break;
-      }
+  GError* error = NULL;
+  if (g_cancellable_set_error_if_cancelled(cancellable, &error))
+    {
+      g_task_return_error(task, error);
+      return;
+    }
+
+  /* a running mount.tagfs already has it */
+  Metainfo* metainfo = client_get_metainfo(state->filename, NULL);
+  if (metainfo != NULL)
+    {
+      g_task_return_pointer(task, metainfo, (GDestroyNotify)metainfo_free);
+      return;
+    }
+
+  if (!thread_safe)
+    G_LOCK(unsafe_plugins);
+
+  metainfo = plugins_get_metainfo(state->plugin, state->filename, &error);
 
+  if (!thread_safe)
+    G_UNLOCK(unsafe_plugins);
+
+  if (error != NULL)
+    {
+      metainfo_free(metainfo);
+      g_task_return_error(task, error);
+    }
+  else
+    g_task_return_pointer(task, metainfo != NULL ? metainfo : metainfo_new(), (GDestroyNotify)metainfo_free);
+}
+
+static void load_ready(GObject* source_object, GAsyncResult* result, gpointer user_data)
+{
+  state_t* state = (state_t*)user_data;
+
+  /* reports cancellation when the page is gone */
+  GError* error = NULL;
+  Metainfo* metainfo = g_task_propagate_pointer(G_TASK(result), &error);
+  if (metainfo != NULL)
+    {
+      state->metainfo = metainfo;
+      metainfo_foreach(metainfo, append_to_list_store, state->store);
+      gtk_widget_hide(state->status);
+      gtk_widget_set_sensitive(state->content, TRUE);
+    }
+  else if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      gchar* text = g_strdup_printf("Can't read metainfo: %s", error->message);
+      gtk_label_set_text(GTK_LABEL(state->status), text);
+      g_free(text);
+    }
+
+  if (error != NULL)
+    g_error_free(error);
+  state_unref(state);
+}
+
+GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error)
+{
+  const PluginInterface* plugin = plugins_find(filename, mime);
   if (plugin == NULL)
     {
       g_set_error(error,
@@ -195,22 +318,15 @@ GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error)
       return NULL;
     }
 
-  GError* metainfo_error = NULL;
-  GData* metainfo = plugin->get_metainfo(filename, &metainfo_error);
-  if (metainfo_error != NULL)
-    {
-      g_propagate_error(error, metainfo_error);
-      return NULL;
-    }
-
   GtkListStore* store = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_STRING);
-  g_datalist_foreach(&metainfo, append_to_list_store, store);
 
-  state_t* state = malloc(sizeof(state_t));
+  state_t* state = g_new0(state_t, 1);
+  state->ref_count = 1;
   state->plugin = plugin;
   state->filename = g_strdup(filename);
-  state->metainfo = metainfo;
+  state->metainfo = NULL;
   state->store = store;
+  state->cancellable = g_cancellable_new();
 
   /* UI */
 
@@ -220,10 +336,19 @@ GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error)
 		 NULL);
   g_signal_connect(vbox, "destroy", G_CALLBACK(page_destroy), state);
 
+  state->status = gtk_label_new("Loading metainfo...");
+  gtk_misc_set_alignment(GTK_MISC(state->status), 0, 0.5);
+  gtk_box_pack_start(GTK_BOX(vbox), state->status, FALSE, TRUE, 0);
+
+  GtkWidget* content = gtk_vbox_new(FALSE, 4);
+  gtk_widget_set_sensitive(content, FALSE);
+  gtk_box_pack_start(GTK_BOX(vbox), content, TRUE, TRUE, 0);
+  state->content = content;
+
   GtkScrolledWindow* scrollarea = GTK_SCROLLED_WINDOW(gtk_scrolled_window_new(NULL, NULL));
   gtk_scrolled_window_set_shadow_type(scrollarea, GTK_SHADOW_IN);
   gtk_scrolled_window_set_policy(scrollarea, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
-  gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(scrollarea), TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(content), GTK_WIDGET(scrollarea), TRUE, TRUE, 0);
 
   GtkTreeView* treeview = GTK_TREE_VIEW(gtk_tree_view_new());
   gtk_container_add(GTK_CONTAINER(scrollarea), GTK_WIDGET(treeview));
@@ -253,7 +378,7 @@ GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error)
   GtkButtonBox* hbuttonbox = GTK_BUTTON_BOX(gtk_hbutton_box_new());
   gtk_button_box_set_layout(hbuttonbox, GTK_BUTTONBOX_END);
   gtk_button_box_set_spacing(hbuttonbox, 4);
-  gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(hbuttonbox), FALSE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(content), GTK_WIDGET(hbuttonbox), FALSE, TRUE, 0);
 
   GtkWidget* button_add = gtk_button_new_from_stock(GTK_STOCK_ADD);
   g_signal_connect(button_add, "clicked", G_CALLBACK(add_clicked), store);
@@ -264,5 +389,561 @@ GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error)
   gtk_box_pack_start(GTK_BOX(hbuttonbox), button_remove, FALSE, FALSE, 0);
 
   gtk_widget_show_all(GTK_WIDGET(vbox));
+
+  /* metainfo is read on a worker thread, the page fills in when it arrives */
+  GTask* task = g_task_new(NULL, state->cancellable, load_ready, state_ref(state));
+  g_task_set_task_data(task, state_ref(state), state_unref);
+  g_task_run_in_thread(task, load_thread);
+  g_object_unref(task);
+
+  return GTK_WIDGET(vbox);
+}
+
+/* multi-file page */
+
+enum
+{
+  MULTI_KEY,
+  MULTI_VALUE,
+  MULTI_NOTE,
+  MULTI_CHANGED,
+  MULTI_COLUMNS
+};
+
+typedef struct tagMultiState
+{
+  gint ref_count;          /* the page and every queued job */
+  guint count;
+  gchar** filenames;
+  const PluginInterface** plugins;
+  Metainfo** metainfo;     /* per file, owned by the jobs while a batch runs */
+  gint done;               /* jobs finished in the current batch */
+  gint pending;            /* jobs of the current batch still running */
+  gint failed;             /* writes of the current batch that failed */
+  gboolean* written;       /* per file, rewritten by the current batch */
+  gboolean writing;        /* current batch writes edits back */
+  Metainfo* edits;         /* values to write, set for the batch */
+  GPtrArray* removed;      /* keys to remove, set for the batch */
+  GHashTable* removed_keys;
+  GCancellable* cancellable;
+  GtkListStore* store;
+  GtkWidget* progress;
+  GtkWidget* content;
+  guint timeout_id;
+} multi_state_t;
+
+typedef struct tagMultiJob
+{
+  multi_state_t* state;
+  guint index;
+} multi_job_t;
+
+static multi_state_t* multi_state_ref(multi_state_t* state)
+{
+  g_atomic_int_inc(&state->ref_count);
+  return state;
+}
+
+/* on the main thread, the store is a GTK object */
+static gboolean multi_state_free(gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+  guint i;
+  for (i = 0; i < state->count; ++i)
+    metainfo_free(state->metainfo[i]);
+  g_free(state->metainfo);
+  g_free(state->written);
+  g_free(state->plugins);
+  g_strfreev(state->filenames);
+  metainfo_free(state->edits);
+  if (state->removed != NULL)
+    g_ptr_array_free(state->removed, TRUE);
+  g_hash_table_destroy(state->removed_keys);
+  g_object_unref(state->store);
+  g_object_unref(state->cancellable);
+  g_free(state);
+  return FALSE;
+}
+
+/* the last reference may be dropped by a job on the pool */
+static void multi_state_unref(multi_state_t* state)
+{
+  if (g_atomic_int_dec_and_test(&state->ref_count))
+    g_main_context_invoke(NULL, multi_state_free, state);
+}
+
+static void multi_read(multi_state_t* state, guint index)
+{
+  state->metainfo[index] = client_get_metainfo(state->filenames[index], NULL);
+  if (state->metainfo[index] != NULL)
+    return;
+
+  const PluginInterface* plugin = state->plugins[index];
+  gboolean thread_safe = (plugin->capabilities & PLUGIN_CAP_THREAD_SAFE) != 0;
+
+  if (!thread_safe)
+    G_LOCK(unsafe_plugins);
+  Metainfo* metainfo = plugins_get_metainfo(plugin, state->filenames[index], NULL);
+  if (!thread_safe)
+    G_UNLOCK(unsafe_plugins);
+
+  state->metainfo[index] = metainfo != NULL ? metainfo : metainfo_new();
+}
+
+static void set_edit(const gchar* key, const gchar* value, gpointer user_data)
+{
+  metainfo_set((Metainfo*)user_data, key, value);
+}
+
+static void multi_write(multi_state_t* state, guint index)
+{
+  Metainfo* updated = metainfo_copy(state->metainfo[index]);
+  metainfo_foreach(state->edits, set_edit, updated);
+
+  guint i;
+  for (i = 0; i < state->removed->len; ++i)
+    metainfo_remove(updated, g_ptr_array_index(state->removed, i));
+
+  if (metainfo_equal(updated, state->metainfo[index]))
+    {
+      metainfo_free(updated);
+      return;
+    }
+
+  const PluginInterface* plugin = state->plugins[index];
+  gboolean thread_safe = (plugin->capabilities & PLUGIN_CAP_THREAD_SAFE) != 0;
+
+  GError* error = NULL;
+  if (!thread_safe)
+    G_LOCK(unsafe_plugins);
+  gboolean written = plugins_set_metainfo(plugin, state->filenames[index], updated, &error);
+  if (!thread_safe)
+    G_UNLOCK(unsafe_plugins);
+
+  if (!written)
+    {
+      g_warning("%s: %s", state->filenames[index], error->message);
+      g_error_free(error);
+      g_atomic_int_inc(&state->failed);
+      metainfo_free(updated);
+      return;
+    }
+
+  metainfo_free(state->metainfo[index]);
+  state->metainfo[index] = updated;
+  state->written[index] = TRUE;
+}
+
+/* one request for every file the batch rewrote */
+static void multi_report_writes(multi_state_t* state)
+{
+  GPtrArray* filenames = g_ptr_array_new();
+  GPtrArray* metainfo = g_ptr_array_new();
+  guint i;
+  for (i = 0; i < state->count; ++i)
+    if (state->written[i])
+      {
+	g_ptr_array_add(filenames, state->filenames[i]);
+	g_ptr_array_add(metainfo, state->metainfo[i]);
+      }
+
+  if (filenames->len != 0)
+    client_set_metainfo_many((const gchar* const*)filenames->pdata,
+			     (const Metainfo* const*)metainfo->pdata,
+			     filenames->len, NULL);
+  g_ptr_array_free(metainfo, TRUE);
+  g_ptr_array_free(filenames, TRUE);
+}
+
+static void multi_job_run(gpointer data, gpointer user_data)
+{
+  multi_job_t* job = (multi_job_t*)data;
+  multi_state_t* state = job->state;
+
+  /* started writes are finished even if the page is gone */
+  if (state->writing)
+    multi_write(state, job->index);
+  else if (!g_cancellable_is_cancelled(state->cancellable))
+    multi_read(state, job->index);
+
+  /* the batch is done only once reported, the next one reuses metainfo */
+  if (g_atomic_int_dec_and_test(&state->pending) && state->writing)
+    multi_report_writes(state);
+  g_atomic_int_inc(&state->done);
+  multi_state_unref(state);
+  g_free(job);
+}
+
+static GThreadPool* get_pool(void)
+{
+  static GThreadPool* pool = NULL;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized))
+    {
+      pool = g_thread_pool_new(multi_job_run, NULL, g_get_num_processors(), FALSE, NULL);
+      g_once_init_leave(&initialized, 1);
+    }
+  return pool;
+}
+
+struct key_summary
+{
+  guint count;
+  const gchar* value;
+  gboolean differs;
+};
+
+static void multi_fill_store(multi_state_t* state)
+{
+  GHashTable* keys = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+  guint i, j;
+  for (i = 0; i < state->count; ++i)
+    for (j = 0; j < metainfo_size(state->metainfo[i]); ++j)
+      {
+	const gchar* key = metainfo_key(state->metainfo[i], j);
+	const gchar* value = metainfo_value(state->metainfo[i], j);
+
+	struct key_summary* summary = g_hash_table_lookup(keys, key);
+	if (summary == NULL)
+	  {
+	    summary = g_new0(struct key_summary, 1);
+	    summary->value = value;
+	    g_hash_table_insert(keys, (gpointer)key, summary);
+	  }
+	else if (strcmp(summary->value, value) != 0)
+	  summary->differs = TRUE;
+	++summary->count;
+      }
+
+  gtk_list_store_clear(state->store);
+
+  GList* sorted = g_list_sort(g_hash_table_get_keys(keys), (GCompareFunc)strcmp);
+  GList* item;
+  for (item = sorted; item != NULL; item = item->next)
+    {
+      struct key_summary* summary = g_hash_table_lookup(keys, item->data);
+
+      gchar* note;
+      if (summary->count != state->count)
+	note = g_strdup_printf("%u of %u files%s", summary->count, state->count,
+			       summary->differs ? ", differs" : "");
+      else
+	note = g_strdup(summary->differs ? "differs" : "");
+
+      GtkTreeIter iter;
+      gtk_list_store_append(state->store, &iter);
+      gtk_list_store_set(state->store, &iter,
+			 MULTI_KEY, item->data,
+			 MULTI_VALUE, summary->differs ? "" : summary->value,
+			 MULTI_NOTE, note,
+			 MULTI_CHANGED, FALSE,
+			 -1);
+      g_free(note);
+    }
+
+  g_list_free(sorted);
+  g_hash_table_destroy(keys);
+}
+
+static gboolean multi_progress(gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+  guint done = g_atomic_int_get(&state->done);
+
+  gchar* text = g_strdup_printf("%s %u of %u files...",
+				state->writing ? "Writing" : "Reading",
+				done, state->count);
+  gtk_progress_bar_set_text(GTK_PROGRESS_BAR(state->progress), text);
+  gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(state->progress), (gdouble)done / state->count);
+  g_free(text);
+
+  if (done < state->count)
+    return TRUE;
+
+  state->timeout_id = 0;
+  state->writing = FALSE;
+  multi_fill_store(state);
+  gtk_widget_hide(state->progress);
+  gtk_widget_set_sensitive(state->content, TRUE);
+
+  guint failed = g_atomic_int_get(&state->failed);
+  if (failed != 0)
+    {
+      text = g_strdup_printf("Can't save metainfo of %u of %u files.", failed, state->count);
+      show_error(text);
+      g_free(text);
+    }
+  return FALSE;
+}
+
+/* runs one job per file on the shared pool */
+static void multi_start_batch(multi_state_t* state, gboolean writing, gboolean with_ui)
+{
+  state->done = 0;
+  state->pending = state->count;
+  state->failed = 0;
+  memset(state->written, 0, state->count * sizeof(gboolean));
+  state->writing = writing;
+
+  if (with_ui)
+    {
+      gtk_widget_set_sensitive(state->content, FALSE);
+      gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(state->progress), 0);
+      gtk_widget_show(state->progress);
+      state->timeout_id = g_timeout_add(100, multi_progress, state);
+    }
+
+  guint i;
+  for (i = 0; i < state->count; ++i)
+    {
+      multi_job_t* job = g_new(multi_job_t, 1);
+      job->state = multi_state_ref(state);
+      job->index = i;
+      g_thread_pool_push(get_pool(), job, NULL);
+    }
+}
+
+/* collects edits from the store, returns FALSE if there are none */
+static gboolean multi_collect_edits(multi_state_t* state)
+{
+  metainfo_free(state->edits);
+  state->edits = metainfo_new();
+
+  GtkTreeIter iter;
+  if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(state->store), &iter))
+    do
+      {
+	gchar* key;
+	gchar* value;
+	gboolean changed;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(state->store), &iter,
+			   MULTI_KEY, &key,
+			   MULTI_VALUE, &value,
+			   MULTI_CHANGED, &changed,
+			   -1);
+	if (changed)
+	  metainfo_set(state->edits, key, value);
+	g_free(key);
+	g_free(value);
+      }
+    while (gtk_tree_model_iter_next(GTK_TREE_MODEL(state->store), &iter));
+
+  if (state->removed != NULL)
+    g_ptr_array_free(state->removed, TRUE);
+  state->removed = g_ptr_array_new_with_free_func(g_free);
+
+  GHashTableIter hi;
+  gpointer key;
+  g_hash_table_iter_init(&hi, state->removed_keys);
+  while (g_hash_table_iter_next(&hi, &key, NULL))
+    g_ptr_array_add(state->removed, g_strdup(key));
+  g_hash_table_remove_all(state->removed_keys);
+
+  return metainfo_size(state->edits) != 0 || state->removed->len != 0;
+}
+
+static void multi_apply_clicked(GtkWidget* button, gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+  if (multi_collect_edits(state))
+    multi_start_batch(state, TRUE, TRUE);
+}
+
+static void multi_add_clicked(GtkWidget* button, gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+
+  gchar* k;
+  gchar* v;
+  if (ask_entry(button, &k, &v))
+    {
+      g_hash_table_remove(state->removed_keys, k);
+
+      GtkTreeIter iter;
+      gtk_list_store_append(state->store, &iter);
+      gtk_list_store_set(state->store, &iter,
+			 MULTI_KEY, k,
+			 MULTI_VALUE, v,
+			 MULTI_NOTE, "edited",
+			 MULTI_CHANGED, TRUE,
+			 -1);
+      g_free(k);
+      g_free(v);
+    }
+}
+
+static void multi_remove_clicked(GtkWidget* button, gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+  GtkTreeView* treeview = GTK_TREE_VIEW(g_object_get_data(G_OBJECT(button), "treeview"));
+
+  GtkTreeModel* model;
+  GtkTreeIter iter;
+  if (gtk_tree_selection_get_selected(gtk_tree_view_get_selection(treeview), &model, &iter))
+    {
+      if (question("Do you really want to delete selected item from all files?"))
+	{
+	  gchar* key;
+	  gtk_tree_model_get(model, &iter, MULTI_KEY, &key, -1);
+	  g_hash_table_add(state->removed_keys, key);
+	  gtk_list_store_remove(state->store, &iter);
+	}
+    }
+}
+
+static void multi_cell_edited(GtkCellRendererText* renderer,
+			      gchar* path,
+			      gchar* new_text,
+			      gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+
+  GtkTreeIter iter;
+  {
+    GtkTreePath* tree_path = gtk_tree_path_new_from_string(path);
+    gtk_tree_model_get_iter(GTK_TREE_MODEL(state->store), &iter, tree_path);
+    gtk_tree_path_free(tree_path);
+  }
+
+  gtk_list_store_set(state->store, &iter,
+		     MULTI_VALUE, new_text,
+		     MULTI_NOTE, "edited",
+		     MULTI_CHANGED, TRUE,
+		     -1);
+}
+
+static void multi_page_destroy(GtkWidget* widget, gpointer user_data)
+{
+  multi_state_t* state = (multi_state_t*)user_data;
+
+  g_cancellable_cancel(state->cancellable);
+  if (state->timeout_id != 0)
+    {
+      g_source_remove(state->timeout_id);
+      state->timeout_id = 0;
+    }
+  else if (multi_collect_edits(state))
+    {
+      /* the write-back outlives the page */
+      if (question("Do you want to save changes in metainfo of all selected files?"))
+	multi_start_batch(state, TRUE, FALSE);
+    }
+
+  multi_state_unref(state);
+}
+
+GtkWidget* get_multi_page(const gchar* const* filenames, const gchar* const* mimes, guint count, GError** error)
+{
+  GPtrArray* supported = g_ptr_array_new();
+  GPtrArray* plugins = g_ptr_array_new();
+
+  guint i;
+  for (i = 0; i < count; ++i)
+    {
+      const PluginInterface* plugin = plugins_find(filenames[i], mimes[i]);
+      if (plugin != NULL)
+	{
+	  g_ptr_array_add(supported, g_strdup(filenames[i]));
+	  g_ptr_array_add(plugins, (gpointer)plugin);
+	}
+    }
+
+  if (supported->len == 0)
+    {
+      g_ptr_array_free(supported, TRUE);
+      g_ptr_array_free(plugins, TRUE);
+      g_set_error(error,
+		  g_quark_from_static_string("core"),
+		  1,
+		  "None of the selected files is supported.");
+      return NULL;
+    }
+
+  multi_state_t* state = g_new0(multi_state_t, 1);
+  state->ref_count = 1;
+  state->count = supported->len;
+  g_ptr_array_add(supported, NULL);
+  state->filenames = (gchar**)g_ptr_array_free(supported, FALSE);
+  state->plugins = (const PluginInterface**)g_ptr_array_free(plugins, FALSE);
+  state->metainfo = g_new0(Metainfo*, state->count);
+  state->written = g_new0(gboolean, state->count);
+  state->removed_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  state->cancellable = g_cancellable_new();
+  state->store = gtk_list_store_new(MULTI_COLUMNS, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN);
+
+  /* UI */
+
+  GtkVBox* vbox = GTK_VBOX(gtk_vbox_new(FALSE, 4));
+  gtk_object_set(GTK_OBJECT(vbox),
+		 "border-width", 8,
+		 NULL);
+  g_signal_connect(vbox, "destroy", G_CALLBACK(multi_page_destroy), state);
+
+  state->progress = gtk_progress_bar_new();
+  gtk_box_pack_start(GTK_BOX(vbox), state->progress, FALSE, TRUE, 0);
+
+  state->content = gtk_vbox_new(FALSE, 4);
+  gtk_box_pack_start(GTK_BOX(vbox), state->content, TRUE, TRUE, 0);
+
+  GtkScrolledWindow* scrollarea = GTK_SCROLLED_WINDOW(gtk_scrolled_window_new(NULL, NULL));
+  gtk_scrolled_window_set_shadow_type(scrollarea, GTK_SHADOW_IN);
+  gtk_scrolled_window_set_policy(scrollarea, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+  gtk_box_pack_start(GTK_BOX(state->content), GTK_WIDGET(scrollarea), TRUE, TRUE, 0);
+
+  GtkTreeView* treeview = GTK_TREE_VIEW(gtk_tree_view_new());
+  gtk_container_add(GTK_CONTAINER(scrollarea), GTK_WIDGET(treeview));
+
+  gtk_tree_view_set_model(treeview, GTK_TREE_MODEL(state->store));
+
+  /* columns */
+
+  GtkTreeViewColumn* column = gtk_tree_view_column_new_with_attributes("Key", gtk_cell_renderer_text_new(), "text", MULTI_KEY, NULL);
+  gtk_tree_view_column_set_resizable(column, TRUE);
+  gtk_tree_view_column_set_min_width(column, 100);
+  gtk_tree_view_append_column(treeview, column);
+
+  GtkCellRenderer* renderer = gtk_cell_renderer_text_new();
+  gtk_object_set(GTK_OBJECT(renderer),
+		 "editable", TRUE,
+		 "editable-set", TRUE,
+		 NULL);
+  g_signal_connect(renderer, "edited", G_CALLBACK(multi_cell_edited), state);
+
+  GtkTreeViewColumn* column2 = gtk_tree_view_column_new_with_attributes("Value", renderer, "text", MULTI_VALUE, NULL);
+  gtk_tree_view_column_set_resizable(column2, TRUE);
+  gtk_tree_view_append_column(treeview, column2);
+
+  GtkTreeViewColumn* column3 = gtk_tree_view_column_new_with_attributes("Files", gtk_cell_renderer_text_new(), "text", MULTI_NOTE, NULL);
+  gtk_tree_view_column_set_resizable(column3, TRUE);
+  gtk_tree_view_append_column(treeview, column3);
+
+  /* buttons */
+
+  GtkButtonBox* hbuttonbox = GTK_BUTTON_BOX(gtk_hbutton_box_new());
+  gtk_button_box_set_layout(hbuttonbox, GTK_BUTTONBOX_END);
+  gtk_button_box_set_spacing(hbuttonbox, 4);
+  gtk_box_pack_start(GTK_BOX(state->content), GTK_WIDGET(hbuttonbox), FALSE, TRUE, 0);
+
+  GtkWidget* button_add = gtk_button_new_from_stock(GTK_STOCK_ADD);
+  g_signal_connect(button_add, "clicked", G_CALLBACK(multi_add_clicked), state);
+  gtk_box_pack_start(GTK_BOX(hbuttonbox), button_add, FALSE, FALSE, 0);
+
+  GtkWidget* button_remove = gtk_button_new_from_stock(GTK_STOCK_REMOVE);
+  g_object_set_data(G_OBJECT(button_remove), "treeview", treeview);
+  g_signal_connect(button_remove, "clicked", G_CALLBACK(multi_remove_clicked), state);
+  gtk_box_pack_start(GTK_BOX(hbuttonbox), button_remove, FALSE, FALSE, 0);
+
+  GtkWidget* button_apply = gtk_button_new_from_stock(GTK_STOCK_APPLY);
+  g_signal_connect(button_apply, "clicked", G_CALLBACK(multi_apply_clicked), state);
+  gtk_box_pack_start(GTK_BOX(hbuttonbox), button_apply, FALSE, FALSE, 0);
+
+  gtk_widget_show_all(GTK_WIDGET(vbox));
+
+  /* files are read concurrently, the progress bar tracks them */
+  multi_start_batch(state, FALSE, TRUE);
+
   return GTK_WIDGET(vbox);
 }
@@ -3,6 +3,10 @@
 
 #include <gtk/gtk.h>
 
+/* returns at once; metainfo is read on a worker thread and filled in later */
 GtkWidget* get_page(const gchar* filename, const gchar* mime, GError** error);
 
+/* page editing common metainfo of several files, read and written in parallel */
+GtkWidget* get_multi_page(const gchar* const* filenames, const gchar* const* mimes, guint count, GError** error);
+
 #endif
@@ -0,0 +1,294 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "excache.h"
+#include "trace.h"
+
+#define SCHEMA_VERSION 1
+
+/* first and last blocks and evenly spaced ones between */
+#define SAMPLE_SIZE 4096
+#define SAMPLES 10
+
+#define DAY (24 * 60 * 60)
+#define MAX_AGE (180 * DAY) /* since last use */
+
+static sqlite3* s_db = NULL;
+static gint s_hits = 0;
+static gint s_misses = 0;
+
+static sqlite3* open_db(void)
+{
+  const gchar* env = g_getenv("TAGFS_EXTRACT_CACHE");
+  gchar* filename;
+  if (env != NULL)
+    {
+      if (*env == '\0')
+	return NULL;
+      filename = g_strdup(env);
+    }
+  else
+    {
+      gchar* dir = g_build_filename(g_get_user_cache_dir(), "tagfs", NULL);
+      g_mkdir_with_parents(dir, 0700);
+      filename = g_build_filename(dir, "extract.db", NULL);
+      g_free(dir);
+    }
+
+  sqlite3* db = NULL;
+  if (sqlite3_open_v2(filename, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK)
+    {
+      g_warning("%s: %s", filename, sqlite3_errmsg(db));
+      sqlite3_close(db);
+      g_free(filename);
+      return NULL;
+    }
+
+  /* other mounts and editors write concurrently */
+  sqlite3_busy_timeout(db, 1000);
+  sqlite3_exec(db, "pragma journal_mode = wal; pragma synchronous = normal", NULL, NULL, NULL);
+
+  gint version = -1;
+  sqlite3_stmt* statement;
+  if (sqlite3_prepare_v2(db, "pragma user_version", -1, &statement, NULL) == SQLITE_OK
+      && sqlite3_step(statement) == SQLITE_ROW)
+    version = sqlite3_column_int(statement, 0);
+  sqlite3_finalize(statement);
+
+  if (version == 0)
+    {
+      sqlite3_exec(db,
+		   "begin;"
+		   "create table if not exists extract ("
+		   "  fingerprint blob not null,"
+		   "  plugin text not null,"
+		   "  version integer not null,"
+		   "  metainfo blob not null,"
+		   "  used integer not null,"
+		   "  primary key (fingerprint, plugin, version)"
+		   ") without rowid;"
+		   "pragma user_version = 1;"
+		   "commit",
+		   NULL, NULL, NULL);
+    }
+  else if (version != SCHEMA_VERSION)
+    {
+      /* written by another version: leave it alone */
+      g_warning("%s: unknown extraction cache version %d", filename, version);
+      sqlite3_close(db);
+      g_free(filename);
+      return NULL;
+    }
+
+  gchar* prune = g_strdup_printf("delete from extract where used < %" G_GINT64_FORMAT,
+				 g_get_real_time() / G_USEC_PER_SEC - MAX_AGE);
+  sqlite3_exec(db, prune, NULL, NULL, NULL);
+  g_free(prune);
+
+  g_free(filename);
+  return db;
+}
+
+static sqlite3* get_db(void)
+{
+  static gsize initialized = 0;
+  if (g_once_init_enter(&initialized))
+    {
+      s_db = open_db();
+      g_once_init_leave(&initialized, 1);
+    }
+  return s_db;
+}
+
+void excache_counts(guint* hits, guint* misses)
+{
+  *hits = g_atomic_int_get(&s_hits);
+  *misses = g_atomic_int_get(&s_misses);
+}
+
+void excache_close(void)
+{
+  if (s_db != NULL)
+    sqlite3_close(s_db);
+  s_db = NULL;
+}
+
+static guint64 fnv1a(guint64 hash, const guint8* data, gsize size)
+{
+  gsize i;
+  for (i = 0; i < size; ++i)
+    {
+      hash ^= data[i];
+      hash *= G_GUINT64_CONSTANT(0x100000001b3);
+    }
+  return hash;
+}
+
+static gboolean read_at(int fd, guint8* buffer, gsize size, guint64 offset)
+{
+  while (size > 0)
+    {
+      ssize_t n = pread(fd, buffer, size, offset);
+      if (n <= 0)
+	{
+	  if (n == -1 && errno == EINTR)
+	    continue;
+	  return FALSE;
+	}
+      buffer += n;
+      size -= n;
+      offset += n;
+    }
+  return TRUE;
+}
+
+gboolean excache_fingerprint(const gchar* filename, excache_key_t* key)
+{
+  if (get_db() == NULL)
+    return FALSE;
+
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
+
+  struct stat st;
+  gboolean ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  guint64 size = ok ? st.st_size : 0;
+  guint64 hash = G_GUINT64_CONSTANT(0xcbf29ce484222325);
+  guint8 buffer[SAMPLE_SIZE];
+
+  if (size <= SAMPLES * SAMPLE_SIZE)
+    {
+      /* small files are hashed whole */
+      guint64 offset;
+      for (offset = 0; ok && offset < size; offset += SAMPLE_SIZE)
+	{
+	  gsize n = MIN(SAMPLE_SIZE, size - offset);
+	  ok = read_at(fd, buffer, n, offset);
+	  hash = fnv1a(hash, buffer, n);
+	}
+    }
+  else
+    {
+      guint i;
+      for (i = 0; ok && i < SAMPLES; ++i)
+	{
+	  ok = read_at(fd, buffer, SAMPLE_SIZE, (size - SAMPLE_SIZE) * i / (SAMPLES - 1));
+	  hash = fnv1a(hash, buffer, SAMPLE_SIZE);
+	}
+    }
+  close(fd);
+
+  guint i;
+  for (i = 0; i < 8; ++i)
+    {
+      key->bytes[i] = size >> (8 * i);
+      key->bytes[8 + i] = hash >> (8 * i);
+    }
+  return ok;
+}
+
+static void bind_key(sqlite3_stmt* statement, const excache_key_t* key, const PluginInterface* plugin)
+{
+  sqlite3_bind_blob(statement, 1, key->bytes, sizeof(key->bytes), SQLITE_STATIC);
+  sqlite3_bind_text(statement, 2, plugin->name, -1, SQLITE_STATIC);
+  sqlite3_bind_int(statement, 3, plugin->version);
+}
+
+Metainfo* excache_lookup(const excache_key_t* key, const PluginInterface* plugin)
+{
+  sqlite3* db = get_db();
+  if (db == NULL)
+    return NULL;
+
+  guint64 span = trace_begin();
+  sqlite3_stmt* statement;
+  sqlite3_prepare_v2(db, "select metainfo, used from extract where fingerprint = ? and plugin = ? and version = ?",
+		     -1, &statement, NULL);
+  bind_key(statement, key, plugin);
+
+  Metainfo* result = NULL;
+  gint64 used = 0;
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      /* key, NUL, value, NUL, ... */
+      const gchar* p = sqlite3_column_blob(statement, 0);
+      const gchar* end = p + sqlite3_column_bytes(statement, 0);
+      used = sqlite3_column_int64(statement, 1);
+      result = metainfo_new();
+      while (p < end)
+	{
+	  const gchar* value = memchr(p, '\0', end - p);
+	  const gchar* next = value != NULL ? memchr(value + 1, '\0', end - value - 1) : NULL;
+	  if (next == NULL)
+	    break;
+	  metainfo_set_len(result, p, value - p, value + 1, next - value - 1);
+	  p = next + 1;
+	}
+    }
+  sqlite3_finalize(statement);
+  g_atomic_int_inc(result != NULL ? &s_hits : &s_misses);
+
+  /* only touched once a day, so that hits stay read-only */
+  gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+  if (result != NULL && used < now - DAY)
+    {
+      sqlite3_prepare_v2(db, "update extract set used = ? where fingerprint = ? and plugin = ? and version = ?",
+			 -1, &statement, NULL);
+      sqlite3_bind_int64(statement, 1, now);
+      sqlite3_bind_blob(statement, 2, key->bytes, sizeof(key->bytes), SQLITE_STATIC);
+      sqlite3_bind_text(statement, 3, plugin->name, -1, SQLITE_STATIC);
+      sqlite3_bind_int(statement, 4, plugin->version);
+      sqlite3_step(statement);
+      sqlite3_finalize(statement);
+    }
+
+  trace_end("cache", "extract", span);
+  return result;
+}
+
+static void append_pair(const gchar* key, const gchar* value, gpointer user_data)
+{
+  GString* blob = user_data;
+  g_string_append_len(blob, key, strlen(key) + 1);
+  g_string_append_len(blob, value, strlen(value) + 1);
+}
+
+void excache_store(const excache_key_t* key, const PluginInterface* plugin, const Metainfo* metainfo)
+{
+  sqlite3* db = get_db();
+  if (db == NULL || metainfo == NULL)
+    return;
+
+  GString* blob = g_string_new(NULL);
+  metainfo_foreach(metainfo, append_pair, blob);
+
+  sqlite3_stmt* statement;
+  sqlite3_prepare_v2(db, "insert or replace into extract values (?, ?, ?, ?, ?)", -1, &statement, NULL);
+  bind_key(statement, key, plugin);
+  sqlite3_bind_blob(statement, 4, blob->str, blob->len, SQLITE_STATIC);
+  sqlite3_bind_int64(statement, 5, g_get_real_time() / G_USEC_PER_SEC);
+  sqlite3_step(statement);
+  sqlite3_finalize(statement);
+
+  g_string_free(blob, TRUE);
+}
+
+void excache_forget(const excache_key_t* key, const PluginInterface* plugin)
+{
+  sqlite3* db = get_db();
+  if (db == NULL)
+    return;
+
+  sqlite3_stmt* statement;
+  sqlite3_prepare_v2(db, "delete from extract where fingerprint = ? and plugin = ? and version = ?", -1, &statement, NULL);
+  bind_key(statement, key, plugin);
+  sqlite3_step(statement);
+  sqlite3_finalize(statement);
+}
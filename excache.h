@@ -0,0 +1,33 @@
+#ifndef EXCACHE_H
+#define EXCACHE_H
+
+#include <glib.h>
+
+#include "plugin_interface.h"
+
+/*
+ * Extraction results shared by every mount and editor of a user, keyed
+ * by a content fingerprint (size and a hash of sampled blocks) and the
+ * plugin's name and version. Stored in $TAGFS_EXTRACT_CACHE, by default
+ * $XDG_CACHE_HOME/tagfs/extract.db; an empty TAGFS_EXTRACT_CACHE turns
+ * it off. Safe to use from several threads and processes.
+ */
+
+typedef struct tagExcacheKey
+{
+  guint8 bytes[16];
+} excache_key_t;
+
+/* FALSE when the file cannot be read or the cache is off */
+gboolean excache_fingerprint(const gchar* filename, excache_key_t* key);
+
+Metainfo* excache_lookup(const excache_key_t* key, const PluginInterface* plugin);
+void excache_store(const excache_key_t* key, const PluginInterface* plugin, const Metainfo* metainfo);
+void excache_forget(const excache_key_t* key, const PluginInterface* plugin);
+
+/* lookups since startup */
+void excache_counts(guint* hits, guint* misses);
+
+void excache_close(void);
+
+#endif
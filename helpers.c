@@ -1,8 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <glib.h>
 
 #include "helpers.h"
+#include "spawn.h"
 
 gchar* quote(const gchar* string, gchar quote)
 {
@@ -51,66 +55,29 @@ gchar* get_suffix(const gchar* filename)
   return result;
 }
 
-struct datalists_compare
+gboolean exec_and_read_output(const gchar* const* argv, read_callback_t callback, void* user_data, GError** error)
 {
-  GData* super;
-  gboolean result;
-};
-
-static void datalist_contains_item(GQuark key_id, gpointer data1, gpointer user_data)
-{
-  struct datalists_compare* c = (struct datalists_compare*)user_data;
-  if (c->result)
-    {
-      gpointer data2 = g_datalist_id_get_data(&c->super, key_id);
-      if (data2 == NULL)
-	c->result = FALSE;
-      else
-	c->result = !strcmp(data1, data2);
-    }
-}
-
-gboolean are_datalists_equal(GData* data1, GData* data2)
-{
-  struct datalists_compare c;
-
-  c.super = data2;
-  c.result = TRUE;
-  g_datalist_foreach(&data1, datalist_contains_item, &c);
-  if (!c.result)
-    return FALSE;
-
-  c.super = data1;
-  c.result = TRUE;
-  g_datalist_foreach(&data2, datalist_contains_item, &c);
-  return c.result;
+  return spawn_and_read_output(argv, spawn_default_limits(), callback, user_data, error);
 }
 
-gboolean exec_and_read_output(const gchar* cmdline, read_callback_t callback, void* user_data)
+gboolean write_metainfo_file(gchar* tmpl, const Metainfo* metainfo, metainfo_func_t print, GError** error)
 {
-  FILE* pipe;
-  GIOChannel* channel;
-  
-  pipe = popen(cmdline, "r");
-  if (!pipe)
-      return FALSE;
-
-  channel = g_io_channel_unix_new(fileno(pipe));
-    
-  while (TRUE)
+  int fd = mkstemp(tmpl);
+  FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (f != NULL)
     {
-      gchar* line;
-        
-      if (G_IO_STATUS_NORMAL != g_io_channel_read_line(channel, &line, NULL, NULL, NULL))
-	break;
-
-      g_strchomp(line);
-      callback(user_data, line);
-      g_free(line);
+      metainfo_foreach(metainfo, print, f);
+      gboolean failed = ferror(f);
+      if (fclose(f) == 0 && !failed)
+	return TRUE;
     }
-  
-  g_io_channel_unref(channel);
-  pclose(pipe);
-  
-  return TRUE;
+  else if (fd >= 0)
+    close(fd);
+
+  int saved_errno = errno;
+  if (fd >= 0)
+    unlink(tmpl);
+  g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+	      "%s: %s", tmpl, g_strerror(saved_errno));
+  return FALSE;
 }
@@ -3,14 +3,17 @@
 
 #include <glib.h>
 
+#include "metainfo.h"
+
 gchar* quote(const gchar* string, gchar quote);
 gchar* dequote(const gchar* string, gchar quote);
 
 gchar* get_suffix(const gchar* filename);
 
-gboolean are_datalists_equal(GData* data1, GData* data2);
-
 typedef void (*read_callback_t)(void* user_data, gchar* line);
-gboolean exec_and_read_output(const gchar* cmdline, read_callback_t callback, void* user_data);
+gboolean exec_and_read_output(const gchar* const* argv, read_callback_t callback, void* user_data, GError** error);
+
+/* a temporary file from a mkstemp template, print gets the FILE* */
+gboolean write_metainfo_file(gchar* tmpl, const Metainfo* metainfo, metainfo_func_t print, GError** error);
 
 #endif
@@ -0,0 +1,861 @@
+#include <string.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "index.h"
+#include "stats.h"
+
+static sqlite3* db = NULL;
+static gboolean s_read_only = FALSE;
+/* recursive, so that index_* calls nest inside index_begin/index_commit */
+static GRecMutex s_lock;
+/* the last directory looked up, files come in runs of the same one */
+static gint s_dir_id = -1;
+static gchar* s_dir_path = NULL;
+/* id -> dir_path_t of directories read back, the least recently used
+   beyond MAX_DIR_PATHS dropped */
+#define MAX_DIR_PATHS 4096
+static GHashTable* s_dir_paths = NULL;
+static GQueue s_dir_lru = G_QUEUE_INIT;
+/* bumped by every change to files or metainfo */
+static guint s_generation = 0;
+/* sql -> prepared statement, see index_cached_statement */
+static GHashTable* s_statements = NULL;
+
+sqlite3* index_db(void)
+{
+  return db;
+}
+
+guint index_generation(void)
+{
+  return g_atomic_int_get(&s_generation);
+}
+
+void index_lock(void)
+{
+  g_rec_mutex_lock(&s_lock);
+}
+
+void index_unlock(void)
+{
+  g_rec_mutex_unlock(&s_lock);
+}
+
+void index_begin(void)
+{
+  index_lock();
+  index_exec("begin");
+}
+
+void index_commit(void)
+{
+  index_exec("commit");
+  index_unlock();
+}
+
+gint index_exec(const gchar* sql)
+{
+  sqlite3_stmt *statement;
+  if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK)
+    sqlite3_step(statement);
+  sqlite3_finalize(statement);
+  return sqlite3_last_insert_rowid(db);
+}
+
+sqlite3_stmt* index_cached_statement(const gchar* sql)
+{
+  if (s_statements == NULL)
+    s_statements = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)sqlite3_finalize);
+  sqlite3_stmt* statement = g_hash_table_lookup(s_statements, sql);
+  if (statement == NULL)
+    {
+      sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+      g_hash_table_insert(s_statements, (gpointer)sql, statement);
+    }
+  return statement;
+}
+
+static gint find_id(const gchar* sql, const gchar* text)
+{
+  index_lock();
+  guint64 start = stats_now();
+  sqlite3_stmt *statement = index_cached_statement(sql);
+  sqlite3_bind_text(statement, 1, text, -1, SQLITE_STATIC);
+
+  gint result = 0;
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    result = sqlite3_column_int(statement, 0);
+  sqlite3_reset(statement);
+  stats_record(STAT_SQL_LOOKUP, start);
+  index_unlock();
+  return result;
+}
+
+gint index_find_attr_id(const gchar* attr)
+{
+  return find_id("select id from attr where name = ?", attr);
+}
+
+gint index_find_attr_value_id(const gchar* value)
+{
+  return find_id("select id from attr_value where value = ?", value);
+}
+
+static gint insert_attr(const gchar* attr_)
+{
+  gchar* attr = g_utf8_strdown(attr_, -1);
+
+  sqlite3_stmt *statement;
+
+  sqlite3_prepare_v2(db, "select id from attr where name = ?", -1, &statement, NULL);
+  sqlite3_bind_text(statement, 1, attr, -1, SQLITE_STATIC);
+
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      gint id = sqlite3_column_int(statement, 0);
+      sqlite3_finalize(statement);
+
+      g_free(attr);
+      return id;
+    }
+  else
+    {
+      sqlite3_finalize(statement);
+
+      sqlite3_prepare_v2(db, "insert into attr values (null, ?)", -1, &statement, NULL);
+      sqlite3_bind_text(statement, 1, attr, -1, SQLITE_STATIC);
+      sqlite3_step(statement);
+      gint id = sqlite3_last_insert_rowid(db);
+      sqlite3_finalize(statement);
+
+      g_free(attr);
+      return id;
+    }
+}
+
+static gint insert_attr_value(const gchar* value)
+{
+  sqlite3_stmt *statement;
+
+  sqlite3_prepare_v2(db, "select id from attr_value where value = ?", -1, &statement, NULL);
+  sqlite3_bind_text(statement, 1, value, -1, SQLITE_STATIC);
+
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      gint id = sqlite3_column_int(statement, 0);
+      sqlite3_finalize(statement);
+      return id;
+    }
+  else
+    {
+      sqlite3_finalize(statement);
+
+      sqlite3_prepare_v2(db, "insert into attr_value values (null, ?)", -1, &statement, NULL);
+      sqlite3_bind_text(statement, 1, value, -1, SQLITE_STATIC);
+      sqlite3_step(statement);
+      gint id = sqlite3_last_insert_rowid(db);
+      sqlite3_finalize(statement);
+      return id;
+    }
+}
+
+static void put_metainfo_to_db(const gchar* attr, const gchar* data, gpointer user_data)
+{
+  const gint file_id = GPOINTER_TO_INT(user_data);
+
+  /* as extracted, for index_get_metainfo */
+  {
+    sqlite3_stmt *statement;
+    sqlite3_prepare_v2(db, "insert into metainfo values (?, ?, ?)", -1, &statement, NULL);
+    sqlite3_bind_int(statement, 1, file_id);
+    sqlite3_bind_text(statement, 2, attr, -1, SQLITE_STATIC);
+    sqlite3_bind_text(statement, 3, data, -1, SQLITE_STATIC);
+    sqlite3_step(statement);
+    sqlite3_finalize(statement);
+  }
+
+  const gint attr_id = insert_attr(attr);
+
+  if (!g_ascii_strcasecmp(attr, "keywords") || !g_ascii_strcasecmp(attr, "author"))
+    {
+      gchar** vals = g_strsplit(data, ",", 0);
+      gchar** val;
+      for (val = vals; *val; ++val)
+	{
+	  g_strstrip(*val);
+
+	  const gint value_id = insert_attr_value(*val);
+
+	  gchar* sql = g_strdup_printf("insert or ignore into link (file_id, attr_id, value_id) values (%d, %d, %d)", file_id, attr_id, value_id);
+	  index_exec(sql);
+	  g_free(sql);
+	}
+      g_strfreev(vals);
+    }
+  else
+    {
+      gint value_id = insert_attr_value(data);
+
+      gchar* sql = g_strdup_printf("insert or ignore into link (file_id, attr_id, value_id) values (%d, %d, %d)", file_id, attr_id, value_id);
+      index_exec(sql);
+      g_free(sql);
+    }
+}
+
+/* directories */
+
+typedef struct tagDirPath
+{
+  GList link;          /* in s_dir_lru, most recently used first */
+  gint id;
+  gchar* path;
+} dir_path_t;
+
+static void remove_dir_path(dir_path_t* entry)
+{
+  g_hash_table_remove(s_dir_paths, GINT_TO_POINTER(entry->id));
+  g_queue_unlink(&s_dir_lru, &entry->link);
+  g_free(entry->path);
+  g_slice_free(dir_path_t, entry);
+}
+
+static void cache_dir(gint dir_id, const gchar* path)
+{
+  g_free(s_dir_path);
+  s_dir_path = g_strdup(path);
+  s_dir_id = dir_id;
+}
+
+static void forget_dirs(void)
+{
+  cache_dir(-1, NULL);
+  while (s_dir_lru.length != 0)
+    remove_dir_path(g_queue_peek_tail(&s_dir_lru));
+}
+
+/*
+ * A directory is a chain of components up to parent 0, so that
+ * joining their names with '/' gives its path back. -1 if unknown.
+ */
+static gint find_dir_id(const gchar* path, gboolean create)
+{
+  if (s_dir_path != NULL && strcmp(s_dir_path, path) == 0)
+    return s_dir_id;
+
+  gchar** components = g_strsplit(path, "/", 0);
+  gint id = 0;
+  gchar** c;
+  for (c = components; *c != NULL && id != -1; ++c)
+    {
+      sqlite3_stmt *statement;
+      sqlite3_prepare_v2(db, "select id from dir where parent = ? and name = ?", -1, &statement, NULL);
+      sqlite3_bind_int(statement, 1, id);
+      sqlite3_bind_text(statement, 2, *c, -1, SQLITE_STATIC);
+      gint parent = id;
+      id = sqlite3_step(statement) == SQLITE_ROW ? sqlite3_column_int(statement, 0) : -1;
+      sqlite3_finalize(statement);
+
+      if (id == -1 && create)
+	{
+	  sqlite3_prepare_v2(db, "insert into dir values (null, ?, ?)", -1, &statement, NULL);
+	  sqlite3_bind_int(statement, 1, parent);
+	  sqlite3_bind_text(statement, 2, *c, -1, SQLITE_STATIC);
+	  sqlite3_step(statement);
+	  id = sqlite3_last_insert_rowid(db);
+	  sqlite3_finalize(statement);
+	}
+    }
+  g_strfreev(components);
+
+  if (id != -1)
+    cache_dir(id, path);
+  return id;
+}
+
+/* valid until the next call, under the lock */
+static const gchar* dir_path(gint dir_id)
+{
+  if (s_dir_paths == NULL)
+    s_dir_paths = g_hash_table_new(NULL, NULL);
+  dir_path_t* cached = g_hash_table_lookup(s_dir_paths, GINT_TO_POINTER(dir_id));
+  if (cached != NULL)
+    {
+      g_queue_unlink(&s_dir_lru, &cached->link);
+      g_queue_push_head_link(&s_dir_lru, &cached->link);
+      return cached->path;
+    }
+
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db,
+		     "with recursive up(parent, name, depth) as ("
+		     " select parent, name, 0 from dir where id = ?"
+		     " union all"
+		     " select dir.parent, dir.name, up.depth + 1 from dir, up where dir.id = up.parent)"
+		     " select name from up order by depth desc",
+		     -1, &statement, NULL);
+  sqlite3_bind_int(statement, 1, dir_id);
+  GString* path = g_string_new(NULL);
+  gboolean first = TRUE;
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      if (!first)
+	g_string_append_c(path, '/');
+      g_string_append(path, (const gchar*)sqlite3_column_text(statement, 0));
+      first = FALSE;
+    }
+  sqlite3_finalize(statement);
+
+  while (s_dir_lru.length >= MAX_DIR_PATHS)
+    remove_dir_path(g_queue_peek_tail(&s_dir_lru));
+
+  dir_path_t* entry = g_slice_new(dir_path_t);
+  entry->link.data = entry;
+  entry->link.prev = entry->link.next = NULL;
+  entry->id = dir_id;
+  entry->path = g_string_free(path, FALSE);
+  g_hash_table_insert(s_dir_paths, GINT_TO_POINTER(dir_id), entry);
+  g_queue_push_head_link(&s_dir_lru, &entry->link);
+  return entry->path;
+}
+
+/* the directory part of path, *name points to the rest */
+static gchar* split_file_path(const gchar* path, const gchar** name)
+{
+  const gchar* slash = strrchr(path, '/');
+  if (slash == NULL)
+    {
+      *name = path;
+      return g_strdup("");
+    }
+  *name = slash + 1;
+  return slash == path ? g_strdup("/") : g_strndup(path, slash - path);
+}
+
+gchar* index_file_path(gint dir_id, const gchar* name)
+{
+  index_lock();
+  const gchar* dir = dir_path(dir_id);
+  gchar* result = *dir == '\0' ? g_strdup(name)
+    : g_str_has_suffix(dir, "/") ? g_strconcat(dir, name, NULL)
+    : g_strconcat(dir, "/", name, NULL);
+  index_unlock();
+  return result;
+}
+
+gsize index_copy_file_path(gint dir_id, const gchar* name, gchar* buf, gsize size)
+{
+  index_lock();
+  const gchar* dir = dir_path(dir_id);
+  gsize length = strlen(dir);
+  gboolean slash = length != 0 && dir[length - 1] != '/';
+  gsize total = length + slash + strlen(name);
+  if (size != 0)
+    {
+      gsize n = MIN(length, size - 1);
+      memcpy(buf, dir, n);
+      if (slash && n < size - 1)
+	buf[n++] = '/';
+      g_strlcpy(buf + n, name, size - n);
+    }
+  index_unlock();
+  return total;
+}
+
+static gint find_file_id(const gchar* path)
+{
+  const gchar* name;
+  gchar* dir = split_file_path(path, &name);
+  gint dir_id = find_dir_id(dir, FALSE);
+  g_free(dir);
+  if (dir_id == -1)
+    return 0;
+
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "select id from file where dir_id = ? and name = ?", -1, &statement, NULL);
+  sqlite3_bind_int(statement, 1, dir_id);
+  sqlite3_bind_text(statement, 2, name, -1, SQLITE_STATIC);
+
+  gint result = 0;
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    result = sqlite3_column_int(statement, 0);
+  sqlite3_finalize(statement);
+  return result;
+}
+
+void index_add_file(const gchar* name, const gchar* path, const Metainfo* metainfo, gint64 mtime, gint64 size)
+{
+  index_lock();
+  guint64 start = stats_now();
+
+  const gchar* base;
+  gchar* dir = split_file_path(path, &base);
+  gint dir_id = find_dir_id(dir, TRUE);
+  g_free(dir);
+
+  gint file_id;
+  {
+    sqlite3_stmt *statement;
+    sqlite3_prepare_v2(db, "insert into file values (null, ?, ?, ?, ?)", -1, &statement, NULL);
+    sqlite3_bind_text(statement, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_int(statement, 2, dir_id);
+    sqlite3_bind_int64(statement, 3, mtime);
+    sqlite3_bind_int64(statement, 4, size);
+    sqlite3_step(statement);
+    file_id = sqlite3_last_insert_rowid(db);
+    sqlite3_finalize(statement);
+  }
+
+  metainfo_foreach(metainfo, put_metainfo_to_db, GINT_TO_POINTER(file_id));
+  g_atomic_int_inc(&s_generation);
+
+  stats_record(STAT_SQL_INSERT, start);
+  index_unlock();
+}
+
+gint64 index_mtime(const struct timespec* mtime)
+{
+  return (gint64)mtime->tv_sec * G_GINT64_CONSTANT(1000000000) + mtime->tv_nsec;
+}
+
+/* whether the file was indexed at this modification time and size */
+static gboolean file_current(gint file_id, gint64 mtime, gint64 size)
+{
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "select 1 from file where id = ? and mtime = ? and size = ?", -1, &statement, NULL);
+  sqlite3_bind_int(statement, 1, file_id);
+  sqlite3_bind_int64(statement, 2, mtime);
+  sqlite3_bind_int64(statement, 3, size);
+  gboolean result = sqlite3_step(statement) == SQLITE_ROW;
+  sqlite3_finalize(statement);
+  return result;
+}
+
+Metainfo* index_get_metainfo(const gchar* path, gint64 mtime, gint64 size)
+{
+  index_lock();
+  guint64 start = stats_now();
+
+  gint file_id = find_file_id(path);
+  if (file_id == 0 || !file_current(file_id, mtime, size))
+    {
+      index_unlock();
+      return NULL;
+    }
+
+  Metainfo* result = metainfo_new();
+
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "select key, value from metainfo where file_id = ?", -1, &statement, NULL);
+  sqlite3_bind_int(statement, 1, file_id);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    metainfo_set(result,
+		 (const gchar*)sqlite3_column_text(statement, 0),
+		 (const gchar*)sqlite3_column_text(statement, 1));
+  sqlite3_finalize(statement);
+
+  stats_record(STAT_SQL_GET, start);
+  index_unlock();
+  return result;
+}
+
+/* under the lock, in a transaction; adds the ids it unlinks to the sets */
+static gboolean update_file(const gchar* path, const Metainfo* metainfo, GHashTable* attr_ids, GHashTable* value_ids)
+{
+  gint file_id = find_file_id(path);
+  if (file_id == 0)
+    return FALSE;
+
+  /* as written by the caller, unreadable files never match */
+  struct stat st;
+  gboolean exists = stat(path, &st) == 0;
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "update file set mtime = ?, size = ? where id = ?", -1, &statement, NULL);
+  sqlite3_bind_int64(statement, 1, exists ? index_mtime(&st.st_mtim) : 0);
+  sqlite3_bind_int64(statement, 2, exists ? st.st_size : -1);
+  sqlite3_bind_int(statement, 3, file_id);
+  sqlite3_step(statement);
+  sqlite3_finalize(statement);
+
+  sqlite3_prepare_v2(db, "select attr_id, value_id from link where file_id = ?", -1, &statement, NULL);
+  sqlite3_bind_int(statement, 1, file_id);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      g_hash_table_add(attr_ids, GINT_TO_POINTER(sqlite3_column_int(statement, 0)));
+      g_hash_table_add(value_ids, GINT_TO_POINTER(sqlite3_column_int(statement, 1)));
+    }
+  sqlite3_finalize(statement);
+
+  gchar* sql = g_strdup_printf("delete from link where file_id = %d", file_id);
+  index_exec(sql);
+  g_free(sql);
+
+  sql = g_strdup_printf("delete from metainfo where file_id = %d", file_id);
+  index_exec(sql);
+  g_free(sql);
+
+  metainfo_foreach(metainfo, put_metainfo_to_db, GINT_TO_POINTER(file_id));
+  return TRUE;
+}
+
+/* runs sql on every id of the set, binding it to ?1 */
+static void delete_ids(const gchar* sql, GHashTable* ids)
+{
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+
+  GHashTableIter iter;
+  gpointer id;
+  g_hash_table_iter_init(&iter, ids);
+  while (g_hash_table_iter_next(&iter, &id, NULL))
+    {
+      sqlite3_bind_int(statement, 1, GPOINTER_TO_INT(id));
+      sqlite3_step(statement);
+      sqlite3_reset(statement);
+    }
+  sqlite3_finalize(statement);
+}
+
+guint index_update_files(const gchar* const* paths, const Metainfo* const* metainfo, guint count)
+{
+  if (index_is_read_only())
+    return 0;
+
+  index_lock();
+  guint64 start = stats_now();
+  index_exec("begin");
+
+  GHashTable* attr_ids = g_hash_table_new(NULL, NULL);
+  GHashTable* value_ids = g_hash_table_new(NULL, NULL);
+  guint updated = 0;
+  guint i;
+  for (i = 0; i < count; ++i)
+    if (update_file(paths[i], metainfo[i], attr_ids, value_ids))
+      ++updated;
+
+  /*
+   * Keys and values nobody has any more would show up as empty
+   * directories. Only those the files had are candidates; a value is
+   * looked up under every attribute, link has no index by value.
+   */
+  delete_ids("delete from attr where id = ?1"
+	     " and not exists (select 1 from link where attr_id = ?1)", attr_ids);
+  delete_ids("delete from attr_value where id = ?1"
+	     " and not exists (select 1 from attr a where exists"
+	     " (select 1 from link where attr_id = a.id and value_id = ?1))", value_ids);
+  g_hash_table_destroy(value_ids);
+  g_hash_table_destroy(attr_ids);
+
+  index_exec("commit");
+  if (updated != 0)
+    g_atomic_int_inc(&s_generation);
+
+  stats_record(STAT_SQL_UPDATE, start);
+  index_unlock();
+  return updated;
+}
+
+gboolean index_update_file(const gchar* path, const Metainfo* metainfo)
+{
+  return index_update_files(&path, &metainfo, 1) == 1;
+}
+
+/*
+ * Entry i upgrades the schema from user_version i to i + 1. Never edit
+ * a released entry, append a new one.
+ */
+static const gchar* const s_migrations[] = {
+  /* 1: original schema */
+  "create table file ("
+  " id integer primary key,"
+  " name varchar(255),"
+  " path varchar(255));"
+  "create table attr ("
+  " id integer primary key,"
+  " name varchar(255));"
+  "create table attr_value ("
+  " id integer primary key,"
+  " value varchar(255));"
+  "create table link ("
+  " id integer primary key,"
+  " file_id integer,"
+  " attr_id integer,"
+  " value_id integer);"
+  "create table metainfo ("
+  " file_id integer,"
+  " key varchar(255),"
+  " value varchar(255));",
+
+  /*
+   * 2: indexes for the lookups of split_path, find_realpath and readdir.
+   * link is clustered by (attr, value) for directory listings, link_file
+   * serves lookups by file. Both cover their queries.
+   */
+  "create table link2 ("
+  " attr_id integer not null,"
+  " value_id integer not null,"
+  " file_id integer not null,"
+  " primary key (attr_id, value_id, file_id)) without rowid;"
+  "insert or ignore into link2 select attr_id, value_id, file_id from link;"
+  "drop table link;"
+  "alter table link2 rename to link;"
+  "create index link_file on link (file_id, attr_id, value_id);"
+  "create table metainfo2 ("
+  " file_id integer not null,"
+  " key varchar(255) not null,"
+  " value varchar(255),"
+  " primary key (file_id, key)) without rowid;"
+  "insert or replace into metainfo2 select file_id, key, value from metainfo;"
+  "drop table metainfo;"
+  "alter table metainfo2 rename to metainfo;"
+  "create unique index attr_name on attr (name);"
+  "create unique index attr_value_value on attr_value (value);"
+  "create index file_name on file (name, path);"
+  "create index file_path on file (path);",
+
+  /* 3: checkpoints of the initial scan, see index_scan_start */
+  "create table scan ("
+  " root text not null,"
+  " complete integer not null);"
+  "create table scan_dir ("
+  " path text primary key) without rowid;",
+
+  /*
+   * 4: paths as chains of directory components instead of repeated
+   * prefixes. Old rows are dropped, the next mount scans again.
+   */
+  "delete from link;"
+  "delete from metainfo;"
+  "delete from attr;"
+  "delete from attr_value;"
+  "delete from scan_dir;"
+  "delete from scan;"
+  "drop index file_name;"
+  "drop index file_path;"
+  "drop table file;"
+  "create table dir ("
+  " id integer primary key,"
+  " parent integer not null,"
+  " name text not null);"
+  "create unique index dir_parent_name on dir (parent, name);"
+  "create table file ("
+  " id integer primary key,"
+  " name varchar(255),"
+  " dir_id integer not null);"
+  "create index file_name on file (name, dir_id);"
+  "create index file_dir on file (dir_id, name);",
+
+  /*
+   * 5: modification time (ns) and size of files when their metainfo was
+   * read, so that lookups can tell when it is out of date. Rows of
+   * older versions never match.
+   */
+  "alter table file add column mtime integer not null default 0;"
+  "alter table file add column size integer not null default -1;",
+};
+
+static gint schema_version(void)
+{
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "pragma user_version", -1, &statement, NULL);
+
+  gint result = 0;
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    result = sqlite3_column_int(statement, 0);
+  sqlite3_finalize(statement);
+  return result;
+}
+
+static gboolean migrate(const gchar* name, GError** error)
+{
+  gint version;
+  for (version = schema_version(); version < (gint)G_N_ELEMENTS(s_migrations); ++version)
+    {
+      gchar* sql = g_strdup_printf("begin;%s pragma user_version = %d; commit;",
+				   s_migrations[version], version + 1);
+      char* message = NULL;
+      gboolean ok = sqlite3_exec(db, sql, NULL, NULL, &message) == SQLITE_OK;
+      g_free(sql);
+      if (!ok)
+	{
+	  g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s: can't upgrade index to version %d: %s",
+		      name, version + 1, message);
+	  sqlite3_free(message);
+	  sqlite3_exec(db, "rollback", NULL, NULL, NULL);
+	  return FALSE;
+	}
+    }
+  return TRUE;
+}
+
+gboolean index_open(const gchar* filename, gboolean read_only, GError** error)
+{
+  g_return_val_if_fail(filename != NULL || !read_only, FALSE);
+
+  const gchar* name = filename != NULL ? filename : ":memory:";
+  int flags = read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+  if (sqlite3_open_v2(name, &db, flags, NULL) != SQLITE_OK)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s: %s", name, sqlite3_errmsg(db));
+      sqlite3_close(db);
+      db = NULL;
+      return FALSE;
+    }
+  s_read_only = read_only;
+
+  if (read_only)
+    {
+      /* nothing to migrate, and a half-built index is of no use */
+      gint version = schema_version();
+      gchar* root = index_scan_root();
+      gboolean current = version == (gint)G_N_ELEMENTS(s_migrations);
+      if (!current || root == NULL)
+	{
+	  g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		      !current
+		      ? "%s: index version %d, rebuild it with tagfs-index"
+		      : "%s: index is incomplete, finish it with tagfs-index",
+		      filename, version);
+	  index_close();
+	  return FALSE;
+	}
+      g_free(root);
+      return TRUE;
+    }
+
+  /* a crash loses at most the batch being committed */
+  if (filename != NULL)
+    sqlite3_exec(db, "pragma journal_mode = wal; pragma synchronous = normal", NULL, NULL, NULL);
+  if (!migrate(name, error))
+    {
+      index_close();
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* also when serving a snapshot file with the index closed */
+gboolean index_is_read_only(void)
+{
+  return s_read_only || db == NULL;
+}
+
+/* one self-contained file, for shipping */
+void index_finalize(void)
+{
+  index_lock();
+  index_exec("analyze");
+  index_exec("pragma journal_mode = delete");
+  index_unlock();
+}
+
+/* scan checkpoints */
+
+static gboolean exists(const gchar* sql, const gchar* text)
+{
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+  sqlite3_bind_text(statement, 1, text, -1, SQLITE_STATIC);
+  gboolean result = sqlite3_step(statement) == SQLITE_ROW;
+  sqlite3_finalize(statement);
+  return result;
+}
+
+gboolean index_scan_start(const gchar* root)
+{
+  index_lock();
+  gboolean resume = exists("select 1 from scan where root = ? and not complete", root);
+  if (!resume)
+    {
+      index_exec("begin");
+      index_exec("delete from link");
+      index_exec("delete from metainfo");
+      index_exec("delete from attr");
+      index_exec("delete from attr_value");
+      index_exec("delete from file");
+      index_exec("delete from dir");
+      index_exec("delete from scan_dir");
+      index_exec("delete from scan");
+
+      sqlite3_stmt *statement;
+      sqlite3_prepare_v2(db, "insert into scan values (?, 0)", -1, &statement, NULL);
+      sqlite3_bind_text(statement, 1, root, -1, SQLITE_STATIC);
+      sqlite3_step(statement);
+      sqlite3_finalize(statement);
+      index_exec("commit");
+      forget_dirs();
+      g_atomic_int_inc(&s_generation);
+    }
+  index_unlock();
+  return resume;
+}
+
+gchar* index_scan_root(void)
+{
+  index_lock();
+  gchar* result = NULL;
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "select root from scan where complete", -1, &statement, NULL);
+  if (sqlite3_step(statement) == SQLITE_ROW)
+    result = g_strdup((const gchar*)sqlite3_column_text(statement, 0));
+  sqlite3_finalize(statement);
+  index_unlock();
+  return result;
+}
+
+gboolean index_scan_dir_done(const gchar* path)
+{
+  index_lock();
+  gboolean result = exists("select 1 from scan_dir where path = ?", path);
+  index_unlock();
+  return result;
+}
+
+void index_scan_mark_dir(const gchar* path)
+{
+  index_lock();
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(db, "insert or ignore into scan_dir values (?)", -1, &statement, NULL);
+  sqlite3_bind_text(statement, 1, path, -1, SQLITE_STATIC);
+  sqlite3_step(statement);
+  sqlite3_finalize(statement);
+  index_unlock();
+}
+
+gboolean index_has_file(const gchar* path)
+{
+  index_lock();
+  gboolean result = find_file_id(path) != 0;
+  index_unlock();
+  return result;
+}
+
+void index_scan_finish(void)
+{
+  index_lock();
+  index_exec("begin");
+  index_exec("update scan set complete = 1");
+  index_exec("delete from scan_dir");
+  index_exec("commit");
+  index_unlock();
+}
+
+void index_analyze(void)
+{
+  index_lock();
+  index_exec("analyze");
+  index_unlock();
+}
+
+void index_close(void)
+{
+  if (s_statements != NULL)
+    g_hash_table_destroy(s_statements);
+  s_statements = NULL;
+  sqlite3_close(db);
+  db = NULL;
+  forget_dirs();
+  s_read_only = FALSE;
+  g_atomic_int_inc(&s_generation);
+}
@@ -0,0 +1,83 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <time.h>
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "metainfo.h"
+
+/*
+ * The index maps files to their metainfo. index_* functions take the
+ * index lock themselves; code running its own queries on index_db()
+ * must hold it with index_lock()/index_unlock().
+ */
+
+/*
+ * filename NULL keeps the index in memory. A read-only index must be a
+ * finished scan of the current schema version, as built by tagfs-index.
+ */
+gboolean index_open(const gchar* filename, gboolean read_only, GError** error);
+void index_close(void);
+gboolean index_is_read_only(void);
+/* refreshes planner statistics, run after bulk changes */
+void index_analyze(void);
+/* analyzes and leaves a single file without a write-ahead log */
+void index_finalize(void);
+
+sqlite3* index_db(void);
+void index_lock(void);
+void index_unlock(void);
+/* changes with files or their metainfo, read it holding the lock */
+guint index_generation(void);
+
+/* a transaction holding the lock, for batches of changes */
+void index_begin(void);
+void index_commit(void);
+
+gint index_exec(const gchar* sql);
+/*
+ * Prepared once per open index, for statements run on every lookup: sql
+ * must be a literal, it is looked up by address. Reset the statement
+ * before releasing the lock.
+ */
+sqlite3_stmt* index_cached_statement(const gchar* sql);
+/* attributes are stored in lower case */
+gint index_find_attr_id(const gchar* attr);
+gint index_find_attr_value_id(const gchar* value);
+
+/* files are stored with the modification time (this, of st_mtim) and size they had when read */
+gint64 index_mtime(const struct timespec* mtime);
+
+/* path is the file's directory followed by name */
+void index_add_file(const gchar* name, const gchar* path, const Metainfo* metainfo, gint64 mtime, gint64 size);
+/* the path of a file from the dir_id and name columns of the file table */
+gchar* index_file_path(gint dir_id, const gchar* name);
+/* the same into buf as g_strlcpy does, returns its length */
+gsize index_copy_file_path(gint dir_id, const gchar* name, gchar* buf, gsize size);
+
+/* NULL if path is not indexed, or was at another modification time or size */
+Metainfo* index_get_metainfo(const gchar* path, gint64 mtime, gint64 size);
+/*
+ * replaces metainfo of an indexed file, as it is now on disk; FALSE if
+ * path is not indexed
+ */
+gboolean index_update_file(const gchar* path, const Metainfo* metainfo);
+/* the same for many files in one transaction, returns how many are indexed */
+guint index_update_files(const gchar* const* paths, const Metainfo* const* metainfo, guint count);
+
+/*
+ * Scan checkpoints. index_scan_start returns TRUE when an unfinished
+ * scan of root is resumed: indexed files are kept and directories
+ * marked done need no second look. Otherwise the index is emptied.
+ */
+gboolean index_scan_start(const gchar* root);
+/* root of the finished scan, or NULL */
+gchar* index_scan_root(void);
+gboolean index_scan_dir_done(const gchar* path);
+/* every file of path is indexed */
+void index_scan_mark_dir(const gchar* path);
+gboolean index_has_file(const gchar* path);
+void index_scan_finish(void);
+
+#endif
@@ -11,4 +11,5 @@ DESTDIR=$1
 cp mount.tagfs $DESTDIR/usr/bin/
 cp tageditor $DESTDIR/usr/bin/
 cp libnautilus-tageditor.so $DESTDIR/usr/lib/nautilus/extensions-1.0/
+cp plugins/*.so $DESTDIR/usr/lib/tagfs/plugins/
 
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "listcache.h"
+
+#define MAX_LISTINGS 1024
+#define MAX_NAMES (256 * 1024) /* of all listings together */
+
+typedef struct tagListing
+{
+  GList link;          /* in s_lru, most recently used first */
+  gint attr_id;
+  guint count;
+  gint* value_ids;     /* sorted, a directory is a set of values */
+  guint64 generation;
+  GPtrArray* names;
+} listing_t;
+
+static GMutex s_lock;
+static GHashTable* s_listings = NULL; /* of listing_t, keys and values */
+static GQueue s_lru = G_QUEUE_INIT;
+static guint s_names = 0;
+
+static guint64 s_hits = 0;
+static guint64 s_misses = 0;
+static guint64 s_stale = 0;     /* misses on a listing of another generation */
+static guint64 s_evictions = 0;
+
+static guint hash_listing(gconstpointer key)
+{
+  const listing_t* listing = key;
+  guint hash = listing->attr_id;
+  guint i;
+  for (i = 0; i < listing->count; ++i)
+    hash = hash * 31 + listing->value_ids[i];
+  return hash;
+}
+
+static gboolean equal_listings(gconstpointer a, gconstpointer b)
+{
+  const listing_t* x = a;
+  const listing_t* y = b;
+  return x->attr_id == y->attr_id
+    && x->count == y->count
+    && memcmp(x->value_ids, y->value_ids, x->count * sizeof(gint)) == 0;
+}
+
+static gint compare_ids(const void* a, const void* b)
+{
+  gint x = *(const gint*)a;
+  gint y = *(const gint*)b;
+  return (x > y) - (x < y);
+}
+
+/* a key only, value_ids are sorted into a new array */
+static void make_key(listing_t* key, gint attr_id, const gint* value_ids, guint value_count)
+{
+  key->attr_id = attr_id;
+  key->count = value_count;
+  key->value_ids = g_new(gint, value_count);
+  if (value_count != 0)
+    {
+      memcpy(key->value_ids, value_ids, value_count * sizeof(gint));
+      qsort(key->value_ids, value_count, sizeof(gint), compare_ids);
+    }
+}
+
+/* under s_lock */
+static void remove_listing(listing_t* listing)
+{
+  g_hash_table_remove(s_listings, listing);
+  g_queue_unlink(&s_lru, &listing->link);
+  s_names -= listing->names->len;
+  g_ptr_array_unref(listing->names);
+  g_free(listing->value_ids);
+  g_slice_free(listing_t, listing);
+}
+
+GPtrArray* listcache_lookup(gint attr_id, const gint* value_ids, guint value_count, guint64 generation)
+{
+  listing_t key;
+  make_key(&key, attr_id, value_ids, value_count);
+
+  g_mutex_lock(&s_lock);
+  listing_t* listing = s_listings != NULL ? g_hash_table_lookup(s_listings, &key) : NULL;
+  GPtrArray* result = NULL;
+  if (listing != NULL && listing->generation != generation)
+    {
+      remove_listing(listing);
+      ++s_stale;
+    }
+  else if (listing != NULL)
+    {
+      g_queue_unlink(&s_lru, &listing->link);
+      g_queue_push_head_link(&s_lru, &listing->link);
+      result = g_ptr_array_ref(listing->names);
+    }
+
+  if (result != NULL)
+    ++s_hits;
+  else
+    ++s_misses;
+  g_mutex_unlock(&s_lock);
+
+  g_free(key.value_ids);
+  return result;
+}
+
+void listcache_store(gint attr_id, const gint* value_ids, guint value_count, guint64 generation, GPtrArray* names)
+{
+  if (names->len > MAX_NAMES)
+    return;
+
+  listing_t* listing = g_slice_new(listing_t);
+  make_key(listing, attr_id, value_ids, value_count);
+  listing->link.data = listing;
+  listing->link.prev = listing->link.next = NULL;
+  listing->generation = generation;
+  listing->names = g_ptr_array_ref(names);
+
+  g_mutex_lock(&s_lock);
+  if (s_listings == NULL)
+    s_listings = g_hash_table_new(hash_listing, equal_listings);
+
+  /* another thread read the same directory meanwhile */
+  listing_t* old = g_hash_table_lookup(s_listings, listing);
+  if (old != NULL)
+    remove_listing(old);
+
+  while (s_lru.length >= MAX_LISTINGS || (s_lru.length != 0 && s_names + names->len > MAX_NAMES))
+    {
+      remove_listing(g_queue_peek_tail(&s_lru));
+      ++s_evictions;
+    }
+
+  g_hash_table_add(s_listings, listing);
+  g_queue_push_head_link(&s_lru, &listing->link);
+  s_names += names->len;
+  g_mutex_unlock(&s_lock);
+}
+
+gchar* listcache_format(void)
+{
+  g_mutex_lock(&s_lock);
+  gchar* result = g_strdup_printf("hits %" G_GUINT64_FORMAT "\n"
+				  "misses %" G_GUINT64_FORMAT "\n"
+				  "stale %" G_GUINT64_FORMAT "\n"
+				  "evictions %" G_GUINT64_FORMAT "\n"
+				  "listings %u\n"
+				  "names %u\n",
+				  s_hits, s_misses, s_stale, s_evictions, s_lru.length, s_names);
+  g_mutex_unlock(&s_lock);
+  return result;
+}
+
+void listcache_reset(void)
+{
+  g_mutex_lock(&s_lock);
+  while (s_lru.length != 0)
+    remove_listing(g_queue_peek_tail(&s_lru));
+  s_hits = s_misses = s_stale = s_evictions = 0;
+  g_mutex_unlock(&s_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef LISTCACHE_H
+#define LISTCACHE_H
+
+#include <glib.h>
+
+/*
+ * Directory listings of a mount, keyed by attribute and the set of
+ * values of the directory, for the generation of the index or snapshot
+ * they were read from (query_generation). A listing of another
+ * generation is a miss. The least recently used listings are dropped
+ * beyond a bound on listings and names. Safe to use from several
+ * threads.
+ */
+
+/* names of the listing, NULL on a miss; unref it when done */
+GPtrArray* listcache_lookup(gint attr_id, const gint* value_ids, guint value_count, guint64 generation);
+/* takes a reference to names, an array of strings */
+void listcache_store(gint attr_id, const gint* value_ids, guint value_count, guint64 generation, GPtrArray* names);
+
+/* hits, misses and size */
+gchar* listcache_format(void);
+/* drops every listing and zeroes the counters */
+void listcache_reset(void);
+
+#endif
@@ -0,0 +1,224 @@
+#include <string.h>
+#include <glib.h>
+
+#include "metainfo.h"
+
+#define ARENA_MIN 256
+#define ENTRIES_MIN 8
+
+typedef struct tagEntry
+{
+  guint32 key;   /* offsets into arena */
+  guint32 value;
+} entry_t;
+
+struct tagMetainfo
+{
+  gchar* arena;
+  gsize arena_len;
+  gsize arena_size;
+  gsize garbage;  /* bytes of replaced strings */
+  entry_t* entries;
+  guint len;
+  guint size;
+};
+
+Metainfo* metainfo_new(void)
+{
+  return g_slice_new0(Metainfo);
+}
+
+void metainfo_free(Metainfo* mi)
+{
+  if (mi == NULL)
+    return;
+  g_free(mi->arena);
+  g_free(mi->entries);
+  g_slice_free(Metainfo, mi);
+}
+
+void metainfo_clear(Metainfo* mi)
+{
+  mi->arena_len = 0;
+  mi->garbage = 0;
+  mi->len = 0;
+}
+
+static guint32 arena_add(Metainfo* mi, const gchar* s, gsize len)
+{
+  if (mi->arena_len + len + 1 > mi->arena_size)
+    {
+      gsize size = MAX(mi->arena_size * 2, ARENA_MIN);
+      while (size < mi->arena_len + len + 1)
+	size *= 2;
+      mi->arena = g_realloc(mi->arena, size);
+      mi->arena_size = size;
+    }
+
+  guint32 offset = mi->arena_len;
+  memcpy(mi->arena + offset, s, len);
+  mi->arena[offset + len] = '\0';
+  mi->arena_len += len + 1;
+  return offset;
+}
+
+/* drops replaced strings once they take half of the arena */
+static void arena_compact(Metainfo* mi)
+{
+  if (mi->garbage * 2 < mi->arena_len)
+    return;
+
+  gchar* old = mi->arena;
+  mi->arena = g_malloc(mi->arena_size);
+  mi->arena_len = 0;
+  mi->garbage = 0;
+
+  guint i;
+  for (i = 0; i < mi->len; ++i)
+    {
+      const gchar* key = old + mi->entries[i].key;
+      const gchar* value = old + mi->entries[i].value;
+      mi->entries[i].key = arena_add(mi, key, strlen(key));
+      mi->entries[i].value = arena_add(mi, value, strlen(value));
+    }
+  g_free(old);
+}
+
+static gint compare_key(const Metainfo* mi, guint index, const gchar* key, gsize key_len)
+{
+  const gchar* k = mi->arena + mi->entries[index].key;
+  gint r = strncmp(k, key, key_len);
+  if (r != 0)
+    return r;
+  return k[key_len] == '\0' ? 0 : 1;
+}
+
+/* index of key, or of its insertion point when *found is FALSE */
+static guint lookup(const Metainfo* mi, const gchar* key, gsize key_len, gboolean* found)
+{
+  guint lo = 0;
+  guint hi = mi->len;
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      gint r = compare_key(mi, mid, key, key_len);
+      if (r == 0)
+	{
+	  *found = TRUE;
+	  return mid;
+	}
+      if (r < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  *found = FALSE;
+  return lo;
+}
+
+void metainfo_set_len(Metainfo* mi, const gchar* key, gsize key_len, const gchar* value, gsize value_len)
+{
+  gboolean found;
+  guint index = lookup(mi, key, key_len, &found);
+
+  if (found)
+    {
+      mi->garbage += strlen(mi->arena + mi->entries[index].value) + 1;
+      mi->entries[index].value = arena_add(mi, value, value_len);
+      arena_compact(mi);
+      return;
+    }
+
+  if (mi->len == mi->size)
+    {
+      mi->size = MAX(mi->size * 2, ENTRIES_MIN);
+      mi->entries = g_renew(entry_t, mi->entries, mi->size);
+    }
+
+  memmove(mi->entries + index + 1, mi->entries + index, (mi->len - index) * sizeof(entry_t));
+  ++mi->len;
+  mi->entries[index].key = arena_add(mi, key, key_len);
+  mi->entries[index].value = arena_add(mi, value, value_len);
+}
+
+void metainfo_set(Metainfo* mi, const gchar* key, const gchar* value)
+{
+  metainfo_set_len(mi, key, strlen(key), value, strlen(value));
+}
+
+gboolean metainfo_remove(Metainfo* mi, const gchar* key)
+{
+  gboolean found;
+  guint index = lookup(mi, key, strlen(key), &found);
+  if (!found)
+    return FALSE;
+
+  mi->garbage += strlen(mi->arena + mi->entries[index].key) + 1;
+  mi->garbage += strlen(mi->arena + mi->entries[index].value) + 1;
+  --mi->len;
+  memmove(mi->entries + index, mi->entries + index + 1, (mi->len - index) * sizeof(entry_t));
+  arena_compact(mi);
+  return TRUE;
+}
+
+const gchar* metainfo_get(const Metainfo* mi, const gchar* key)
+{
+  if (mi == NULL)
+    return NULL;
+
+  gboolean found;
+  guint index = lookup(mi, key, strlen(key), &found);
+  return found ? mi->arena + mi->entries[index].value : NULL;
+}
+
+guint metainfo_size(const Metainfo* mi)
+{
+  return mi != NULL ? mi->len : 0;
+}
+
+const gchar* metainfo_key(const Metainfo* mi, guint index)
+{
+  return mi->arena + mi->entries[index].key;
+}
+
+const gchar* metainfo_value(const Metainfo* mi, guint index)
+{
+  return mi->arena + mi->entries[index].value;
+}
+
+void metainfo_foreach(const Metainfo* mi, metainfo_func_t func, gpointer user_data)
+{
+  guint i;
+  for (i = 0; i < metainfo_size(mi); ++i)
+    func(metainfo_key(mi, i), metainfo_value(mi, i), user_data);
+}
+
+Metainfo* metainfo_copy(const Metainfo* mi)
+{
+  Metainfo* result = metainfo_new();
+  guint i;
+  for (i = 0; i < metainfo_size(mi); ++i)
+    {
+      /* already sorted: append */
+      const gchar* key = metainfo_key(mi, i);
+      const gchar* value = metainfo_value(mi, i);
+      metainfo_set_len(result, key, strlen(key), value, strlen(value));
+    }
+  return result;
+}
+
+gboolean metainfo_equal(const Metainfo* mi1, const Metainfo* mi2)
+{
+  guint len = metainfo_size(mi1);
+  if (len != metainfo_size(mi2))
+    return FALSE;
+
+  guint i;
+  for (i = 0; i < len; ++i)
+    {
+      if (strcmp(metainfo_key(mi1, i), metainfo_key(mi2, i)) != 0
+	  || strcmp(metainfo_value(mi1, i), metainfo_value(mi2, i)) != 0)
+	return FALSE;
+    }
+  return TRUE;
+}
@@ -0,0 +1,43 @@
+#ifndef METAINFO_H
+#define METAINFO_H
+
+#include <glib.h>
+
+/*
+ * Key/value metainfo of a single file.
+ *
+ * Keys and values are copied into a private arena and indexed by an
+ * array sorted by key, so lookups are logarithmic and comparison is a
+ * linear merge. Strings returned by accessors stay valid until the next
+ * modification. A Metainfo has exactly one owner: functions taking a
+ * Metainfo* never keep it, use metainfo_steal() to pass ownership on.
+ */
+typedef struct tagMetainfo Metainfo;
+
+typedef void (*metainfo_func_t)(const gchar* key, const gchar* value, gpointer user_data);
+
+Metainfo* metainfo_new(void);
+Metainfo* metainfo_copy(const Metainfo* mi);
+void metainfo_free(Metainfo* mi);
+void metainfo_clear(Metainfo* mi);
+
+void metainfo_set(Metainfo* mi, const gchar* key, const gchar* value);
+void metainfo_set_len(Metainfo* mi, const gchar* key, gsize key_len, const gchar* value, gsize value_len);
+gboolean metainfo_remove(Metainfo* mi, const gchar* key);
+const gchar* metainfo_get(const Metainfo* mi, const gchar* key);
+
+guint metainfo_size(const Metainfo* mi);
+const gchar* metainfo_key(const Metainfo* mi, guint index);
+const gchar* metainfo_value(const Metainfo* mi, guint index);
+void metainfo_foreach(const Metainfo* mi, metainfo_func_t func, gpointer user_data);
+
+gboolean metainfo_equal(const Metainfo* mi1, const Metainfo* mi2);
+
+static inline Metainfo* metainfo_steal(Metainfo** mi)
+{
+  Metainfo* result = *mi;
+  *mi = NULL;
+  return result;
+}
+
+#endif
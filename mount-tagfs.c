@@ -20,6 +20,9 @@
 #endif
 
 #include <malloc.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -38,293 +41,206 @@
 #include <sqlite3.h>
 #include <magic.h>
 
-#include "plugin_interface.h"
 #include "helpers.h"
-
-static sqlite3* db = NULL;
-static magic_t magic;
-#define MAXDIGITS 15
-
-static gint sql_exec(const char* sql)
-{
-  sqlite3_stmt *statement;
-  if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK)
-    sqlite3_step(statement);
-  sqlite3_finalize(statement);
-  return sqlite3_last_insert_rowid(db);
-}
-
-static gint find_attr_id(const gchar* attr)
-{
-  sqlite3_stmt *statement;
-  sqlite3_prepare_v2(db, "select id from attr where name = ?", -1, &statement, NULL);
-  sqlite3_bind_text(statement, 1, g_utf8_strdown(attr, -1), -1, g_free);
-
-  gint result = 0;
-  if (sqlite3_step(statement) == SQLITE_ROW)
-    result = sqlite3_column_int(statement, 0);
-  sqlite3_finalize(statement);
-  return result;
-}
-
-static gint find_attr_value_id(const gchar* value)
-{
-  sqlite3_stmt *statement;
-  sqlite3_prepare_v2(db, "select id from attr_value where value = ?", -1, &statement, NULL);
-  sqlite3_bind_text(statement, 1, value, -1, SQLITE_STATIC);
-
-  gint result = 0;
-  if (sqlite3_step(statement) == SQLITE_ROW)
-    result = sqlite3_column_int(statement, 0);
-  sqlite3_finalize(statement);
-  return result;
-}
-
-static gint insert_attr(const gchar* attr_)
+#include "plugins.h"
+#include "index.h"
+#include "snapshot.h"
+#include "scan.h"
+#include "query.h"
+#include "listcache.h"
+#include "stats.h"
+#include "slowlog.h"
+#include "trace.h"
+#include "optrace.h"
+#include "service.h"
+
+static int getattr_real(const char *path, struct stat *stbuf)
 {
-  gchar* attr = g_utf8_strdown(attr_, -1);
-
-  sqlite3_stmt *statement;
-
-  sqlite3_prepare_v2(db, "select id from attr where name = ?", -1, &statement, NULL);
-  sqlite3_bind_text(statement, 1, attr, -1, SQLITE_STATIC);
-
-  if (sqlite3_step(statement) == SQLITE_ROW)
+  gboolean error = FALSE;
+  gchar filepath[PATH_MAX];
+  query_begin();
+  gsize length = find_realpath(path, filepath, sizeof(filepath), &error);
+  query_end();
+  if (error)
+    return -ENOENT;
+  
+  if (length == 0)
     {
-      gint id = sqlite3_column_int(statement, 0);
-      sqlite3_finalize(statement);
-
-      g_free(attr);
-      return id;
+      memset(stbuf, 0, sizeof(struct stat));
+      stbuf->st_mode = S_IFDIR | 0755;
+      stbuf->st_nlink = 2;
+      return 0;
+    }
+  else if (length >= sizeof(filepath))
+    {
+      return -ENAMETOOLONG;
     }
   else
     {
-      sqlite3_finalize(statement);
-
-      sqlite3_prepare_v2(db, "insert into attr values (null, ?)", -1, &statement, NULL);
-      sqlite3_bind_text(statement, 1, attr, -1, SQLITE_STATIC);
-      sqlite3_step(statement);
-      gint id = sqlite3_last_insert_rowid(db);
-      sqlite3_finalize(statement);
+      int res = stat(filepath, stbuf);
 
-      g_free(attr);
-      return id;
+      if (res == -1)
+	return -errno;
+      
+      stbuf->st_nlink = 1;
+      if (S_ISDIR(stbuf->st_mode))
+	stbuf->st_mode = (stbuf->st_mode & ~S_IFDIR) | S_IFLNK;
+      else
+	stbuf->st_mode = stbuf->st_mode | S_IFLNK;
+      return 0;
     }
 }
 
-static gint insert_attr_value(const gchar* value)
-{
-  sqlite3_stmt *statement;
-
-  sqlite3_prepare_v2(db, "select id from attr_value where value = ?", -1, &statement, NULL);
-  sqlite3_bind_text(statement, 1, value, -1, SQLITE_STATIC);
+/* control files */
 
-  if (sqlite3_step(statement) == SQLITE_ROW)
-    {
-      gint id = sqlite3_column_int(statement, 0);
-      sqlite3_finalize(statement);
-      return id;
-    }
-  else
-    {
-      sqlite3_finalize(statement);
-
-      sqlite3_prepare_v2(db, "insert into attr_value values (null, ?)", -1, &statement, NULL);
-      sqlite3_bind_text(statement, 1, value, -1, SQLITE_STATIC);
-      sqlite3_step(statement);
-      gint id = sqlite3_last_insert_rowid(db);
-      sqlite3_finalize(statement);
-      return id;
-    }
-}
+#define CONTROL_DIR "/.tagfs"
 
-typedef struct tagPath
+typedef struct tagControlFile
 {
-  gint attr_id;
-  GArray* value_ids;
-  gchar* tail;
-} path_t;
+  const gchar* name;
+  gchar* (*read)(void);   /* whole contents */
+  void (*reset)(void);    /* on write or truncate */
+} control_file_t;
 
-static void free_path(path_t* ps)
+static const control_file_t s_control_files[] = {
+  { "stats", stats_format, stats_reset },
+  { "slowlog", slowlog_format, slowlog_reset },
+  { "trace", trace_format, trace_reset },
+  { "listcache", listcache_format, listcache_reset },
+};
+
+static gboolean is_control_path(const char *path)
 {
-  if (ps->value_ids != NULL)
-    g_array_free(ps->value_ids, TRUE);
-  if (ps->tail)
-    g_free(ps->tail);
+  return g_str_has_prefix(path, CONTROL_DIR)
+    && (path[strlen(CONTROL_DIR)] == '\0' || path[strlen(CONTROL_DIR)] == '/');
 }
 
-static path_t* split_path(const gchar* path)
+static const control_file_t* find_control_file(const char *path)
 {
-  if (!strcmp(path, "/"))
-    {
-      path_t* ps = g_slice_new(path_t);
-      ps->attr_id = 0;
-      ps->value_ids = NULL;
-      ps->tail = NULL;
-      return ps;
-    }
+  if (!is_control_path(path) || path[strlen(CONTROL_DIR)] != '/')
+    return NULL;
 
-  gchar** pp = g_strsplit(path + 1, "/", 0); /* + 1 to skip leading '/' */
+  guint i;
+  for (i = 0; i < G_N_ELEMENTS(s_control_files); ++i)
+    if (strcmp(path + strlen(CONTROL_DIR) + 1, s_control_files[i].name) == 0)
+      return &s_control_files[i];
+  return NULL;
+}
 
-  gchar* attr = pp[0];
-  gint attr_id = find_attr_id(attr);
-  if (attr_id == 0)
+static int control_getattr(const char *path, struct stat *stbuf)
+{
+  memset(stbuf, 0, sizeof(struct stat));
+  if (strcmp(path, CONTROL_DIR) == 0)
     {
-      g_strfreev(pp);
-      return NULL;
+      stbuf->st_mode = S_IFDIR | 0755;
+      stbuf->st_nlink = 2;
+      return 0;
     }
 
-  path_t* ps = g_slice_new(path_t);
-  ps->attr_id = attr_id;
-  ps->value_ids = g_array_new(FALSE, FALSE, sizeof(gint));
-  ps->tail = NULL;
-
-  gboolean st = TRUE;
-  gchar** p;
-  for (p = pp + 1; *p != NULL; ++p)
-    {
-      if (**p == '\0') /* (*p) == "" */
-	continue;
+  if (find_control_file(path) == NULL)
+    return -ENOENT;
 
-      if (st)
-	{
-	  gint value_id = find_attr_value_id(*p);
-	  if (value_id != 0)
-	    {
-	      g_array_append_val(ps->value_ids, value_id);
-	    }
-	  else
-	    {
-	      st = FALSE;
-	      ps->tail = g_strdup(*p);
-	    }
-	}
-      else
-	{
-	  gchar* newtail = g_strdup_printf("%s/%s", ps->tail, *p);
-	  g_free(ps->tail);
-	  ps->tail = newtail;
-	}
-    }
-  g_strfreev(pp);
-  return ps;
+  /* contents are generated on open, read with direct_io */
+  stbuf->st_mode = S_IFREG | 0644;
+  stbuf->st_nlink = 1;
+  return 0;
 }
 
-static gchar* get_ids_string(GArray* arr)
+static int control_readdir(const char *path, void *buf, fuse_fill_dir_t filler)
 {
-  if (arr == NULL)
-    return g_strdup("");
+  if (strcmp(path, CONTROL_DIR) != 0)
+    return -ENOTDIR;
 
-  gchar* ids = g_malloc(arr->len * (MAXDIGITS + 1) + 1);
-  if (arr->len != 0)
-    {
-      gchar* ptr = ids;
-      gint i;
-      for (i = 0; i < arr->len; ++i)
-	ptr += g_sprintf(ptr, "%d,", g_array_index(arr, gint, i));
-      ptr[-1] = '\0'; /* remove last ',' */
-    }
-  else
-    *ids = '\0';
-
-  return ids;
+  filler(buf, ".", NULL, 0);
+  filler(buf, "..", NULL, 0);
+  guint i;
+  for (i = 0; i < G_N_ELEMENTS(s_control_files); ++i)
+    filler(buf, s_control_files[i].name, NULL, 0);
+  return 0;
 }
 
-static gchar* find_realpath(const char *path, gboolean* error)
+static int tfs_getattr(const char *path, struct stat *stbuf)
 {
-  path_t* sp = split_path(path);
-  if (sp == NULL)
-    {
-      if (error) *error = TRUE;
-      return NULL;
-    }
-
-  if (sp->attr_id == 0) /* root */
-    {
-      free_path(sp);
-      return NULL;
-    }
-
-  if (sp->tail == NULL)
-    {
-      free_path(sp);
-      return NULL;
-    }
-
-  sqlite3_stmt *statement;
-  if (sp->value_ids->len != 0)
-    {
-      gchar* ids = get_ids_string(sp->value_ids);
-      gchar* sql = g_strdup_printf("select file.path from link, file where "
-				   "link.file_id = file.id "
-				   "and link.attr_id = ? "
-				   "and link.value_id in (%s) "
-				   "and file.name = ?",
-				   ids);
-      g_free(ids);
+  guint64 start = stats_now();
+  int result = is_control_path(path)
+    ? control_getattr(path, stbuf)
+    : getattr_real(path, stbuf);
+  stats_record(STAT_GETATTR, start);
+  optrace_record(OPTRACE_GETATTR, path, start, result, 0, 0);
+  return result;
+}
 
-      sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
-      sqlite3_bind_int(statement, 1, sp->attr_id);
-      sqlite3_bind_text(statement, 2, sp->tail, -1, SQLITE_STATIC);
+static int open_control(const char *path, struct fuse_file_info *fi)
+{
+  const control_file_t* file = find_control_file(path);
+  if (file == NULL)
+    return -ENOENT;
 
-      g_free(sql);
-    }
-  else
-    {
-      const gchar* sql =
-	"select file.path from link, file where "
-	"link.file_id = file.id "
-	"and link.attr_id = ? "
-	"and file.name = ?";
-
-      sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
-      sqlite3_bind_int(statement, 1, sp->attr_id);
-      sqlite3_bind_text(statement, 2, sp->tail, -1, SQLITE_STATIC);
-    }
+  if ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC))
+    file->reset();
 
-  gchar* realpath = NULL;
-  if (sqlite3_step(statement) == SQLITE_ROW)
-    realpath = g_strdup((const gchar*)sqlite3_column_text(statement, 0));
-  sqlite3_finalize(statement);
+  /* a snapshot, so that sequential reads see consistent contents */
+  fi->fh = (uint64_t)(guintptr)file->read();
+  fi->direct_io = 1;
+  return 0;
+}
 
-  free_path(sp);
+static int tfs_open(const char *path, struct fuse_file_info *fi)
+{
+  guint64 start = stats_now();
+  int result = open_control(path, fi);
+  stats_record(STAT_OPEN, start);
+  optrace_record(OPTRACE_OPEN, path, start, result, fi->flags, 0);
+  return result;
+}
 
-  return realpath;
+static int tfs_read(const char *path, char *buf, size_t size, off_t offset,
+		    struct fuse_file_info *fi)
+{
+  guint64 start = stats_now();
+  const gchar* contents = (const gchar*)(guintptr)fi->fh;
+  size_t len = contents != NULL ? strlen(contents) : 0;
+  if (offset >= len)
+    size = 0;
+  else if (offset + size > len)
+    size = len - offset;
+  if (size > 0)
+    memcpy(buf, contents + offset, size);
+  stats_record(STAT_READ, start);
+  optrace_record(OPTRACE_READ, path, start, size, size, offset);
+  return size;
+}
+
+static int tfs_write(const char *path, const char *buf, size_t size, off_t offset,
+		     struct fuse_file_info *fi)
+{
+  guint64 start = stats_now();
+  const control_file_t* file = find_control_file(path);
+  int result = file != NULL ? size : -EBADF;
+  if (file != NULL)
+    file->reset();
+  stats_record(STAT_WRITE, start);
+  optrace_record(OPTRACE_WRITE, path, start, result, size, offset);
+  return result;
 }
 
-static int tfs_getattr(const char *path, struct stat *stbuf)
+static int tfs_truncate(const char *path, off_t size)
 {
-  gboolean error = FALSE;
-  gchar* filepath = find_realpath(path, &error);
-  if (error)
-    return -ENOENT;
-  
-  if (filepath == NULL)
-    {
-      memset(stbuf, 0, sizeof(struct stat));
-      stbuf->st_mode = S_IFDIR | 0755;
-      stbuf->st_nlink = 2;
-      return 0;
-    }
-  else
-    {
-      int res = stat(filepath, stbuf);
-      g_free(filepath);
-
-      if (res == -1)
-	return -errno;
-      
-      stbuf->st_nlink = 1;
-      if (S_ISDIR(stbuf->st_mode))
-	stbuf->st_mode = (stbuf->st_mode & ~S_IFDIR) | S_IFLNK;
-      else
-	stbuf->st_mode = stbuf->st_mode | S_IFLNK;
-      return 0;
-    }
+  guint64 start = stats_now();
+  const control_file_t* file = find_control_file(path);
+  int result = file != NULL ? 0 : -EACCES;
+  if (file != NULL)
+    file->reset();
+  stats_record(STAT_TRUNCATE, start);
+  optrace_record(OPTRACE_TRUNCATE, path, start, result, size, 0);
+  return result;
 }
 
 static int tfs_access(const char *path, int mask)
 {
+  guint64 start = stats_now();
+  stats_record(STAT_ACCESS, start);
+  optrace_record(OPTRACE_ACCESS, path, start, 0, mask, 0);
   return 0;
 
   /*
@@ -375,58 +291,77 @@ static int tfs_access(const char *path, int mask)
   ***/
 }
 
-static int tfs_readlink(const char *path, char *buf, size_t size)
+static int readlink_real(const char *path, char *buf, size_t size)
 {
-  gchar* filepath = find_realpath(path, NULL);
-  if (filepath == NULL)
+  if (is_control_path(path))
+    return -EINVAL;
+
+  query_begin();
+  gsize length = find_realpath(path, buf, size, NULL);
+  query_end();
+  if (length == 0)
     {
       return -ENOENT;
     }
   else
     {
-      strncpy(buf, filepath, size-1);
-      g_free(filepath);
       return 0;
     }
 }
 
-static int tfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                       off_t offset, struct fuse_file_info *fi)
+static int tfs_readlink(const char *path, char *buf, size_t size)
 {
-  path_t* sp = split_path(path);
-  if (sp == NULL)
-    return -1;
+  guint64 start = stats_now();
+  int result = readlink_real(path, buf, size);
+  stats_record(STAT_READLINK, start);
+  optrace_record(OPTRACE_READLINK, path, start, result, size, 0);
+  return result;
+}
 
-  if (sp->tail != NULL)
-    return -2;
+static void add_name(const gchar* name, gpointer user_data)
+{
+  g_ptr_array_add(user_data, g_strdup(name));
+}
 
-  filler(buf, ".", NULL, 0);
-  filler(buf, "..", NULL, 0);
+static void add_rows(const gchar* sql, GPtrArray* names)
+{
+  guint64 start = stats_now();
+  sqlite3_stmt *statement;
+  sqlite3_prepare_v2(index_db(), sql, -1, &statement, NULL); // SQLITE_OK
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      add_name((const gchar*)sqlite3_column_text(statement, 0), names);
+    }
+  sqlite3_finalize(statement);
+  stats_record(STAT_SQL_READDIR, start);
+}
 
-  if (sp->attr_id == 0) /* root */
+static GPtrArray* list_dir(const path_t* sp)
+{
+  GPtrArray* names = g_ptr_array_new_with_free_func(g_free);
+
+  if (snapshot_is_open())
     {
-      sqlite3_stmt *statement;
-      sqlite3_prepare_v2(db, "select name from attr", -1, &statement, NULL); // SQLITE_OK
-      while (sqlite3_step(statement) == SQLITE_ROW)
-	{
-	  filler(buf, (const char*)sqlite3_column_text(statement, 0), NULL, 0);
-	}
-      sqlite3_finalize(statement);
+      snapshot_list_dir(sp->attr_id, sp->value_ids, sp->value_count, add_name, names);
+    }
+  else if (sp->attr_id == 0) /* root */
+    {
+      add_rows("select name from attr", names);
     }
   else
     {
-      gchar* ids = get_ids_string(sp->value_ids);
+      gchar* ids = get_ids_string(sp);
 
       gchar* sql;
-      if (sp->value_ids != NULL && sp->value_ids->len != 0)
+      if (sp->value_count != 0)
 	{
 	  sql = g_strdup_printf("select file.name from link, file where"
 				" link.file_id = file.id and"
 				" link.attr_id = %d and"
 				" value_id in (%s)"
 				" group by link.file_id"
-				" having count(link.id) = %d",
-				sp->attr_id, ids, sp->value_ids->len);
+				" having count(*) = %d",
+				sp->attr_id, ids, sp->value_count);
 	}
       else
 	{
@@ -436,17 +371,10 @@ static int tfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 				" group by link.file_id",
 				sp->attr_id);
 	}
-
-      sqlite3_stmt *statement;
-      sqlite3_prepare_v2(db, sql, -1, &statement, NULL); // SQLITE_OK
+      add_rows(sql, names);
       g_free(sql);
-      while (sqlite3_step(statement) == SQLITE_ROW)
-	{
-	  filler(buf, (const char*)sqlite3_column_text(statement, 0), NULL, 0);
-	}
-      sqlite3_finalize(statement);
 
-      if (sp->value_ids != NULL && sp->value_ids->len != 0)
+      if (sp->value_count != 0)
 	{
 	  sql = g_strdup_printf("select attr_value.value from attr_value, link where "
 				"attr_value.id = link.value_id and "
@@ -456,11 +384,11 @@ static int tfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 				" attr_id = %d and "
 				" value_id in (%s) "
 				" group by file_id "
-				" having count(id) = %d "
+				" having count(*) = %d "
 				") and "
 				"link.value_id not in (%s) "
 				"group by attr_value.id",
-				sp->attr_id, sp->attr_id, ids, sp->value_ids->len, ids);
+				sp->attr_id, sp->attr_id, ids, sp->value_count, ids);
 	}
       else
 	{
@@ -470,20 +398,61 @@ static int tfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 				" group by attr_value.id",
 				sp->attr_id);
 	}
-
-      sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+      add_rows(sql, names);
       g_free(sql);
-      while (sqlite3_step(statement) == SQLITE_ROW)
-	{
-	  filler(buf, (const char*)sqlite3_column_text(statement, 0), NULL, 0);
-	}
-      sqlite3_finalize(statement);
 
       g_free(ids);
     }
+  return names;
+}
+
+static int readdir_locked(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+  path_t sp;
+  if (!split_path(path, &sp))
+    return -1;
+
+  if (sp.tail != NULL)
+    return -2;
+
+  /* file managers list the same directories over and over */
+  guint64 generation = query_generation();
+  GPtrArray* names = listcache_lookup(sp.attr_id, sp.value_ids, sp.value_count, generation);
+  if (names == NULL)
+    {
+      names = list_dir(&sp);
+      listcache_store(sp.attr_id, sp.value_ids, sp.value_count, generation, names);
+    }
+
+  filler(buf, ".", NULL, 0);
+  filler(buf, "..", NULL, 0);
+  guint i;
+  for (i = 0; i < names->len; ++i)
+    filler(buf, g_ptr_array_index(names, i), NULL, 0);
+  g_ptr_array_unref(names);
   return 0;
 }
 
+static int tfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                       off_t offset, struct fuse_file_info *fi)
+{
+  guint64 start = stats_now();
+  int result;
+  if (is_control_path(path))
+    {
+      result = control_readdir(path, buf, filler);
+    }
+  else
+    {
+      query_begin();
+      result = readdir_locked(path, buf, filler);
+      query_end();
+      stats_record(STAT_READDIR, start);
+    }
+  optrace_record(OPTRACE_READDIR, path, start, result, 0, 0);
+  return result;
+}
+
 /* DO IT */
 static int tfs_mknod(const char *path, mode_t mode, dev_t rdev)
 {
@@ -632,11 +601,8 @@ static int tfs_statfs(const char *path, struct statvfs *stbuf)
 
 static int tfs_release(const char *path, struct fuse_file_info *fi)
 {
-    /* Just a stub.  This method is optional and can safely be left
-       unimplemented */
-
-    (void) path;
-    (void) fi;
+    /* snapshot of a control file */
+    g_free((gchar*)(guintptr)fi->fh);
     return 0;
 }
 
@@ -689,11 +655,34 @@ static int tfs_removexattr(const char *path, const char *name)
 }
 #endif /* HAVE_SETXATTR */
 
+/* after fuse_main has daemonized: threads started earlier would be lost */
+static void* tfs_init(struct fuse_conn_info *conn)
+{
+  GError* error = NULL;
+  if (!service_start(&error))
+    {
+      syslog(LOG_WARNING, "Metainfo service is not available: %s", error->message);
+      g_error_free(error);
+    }
+  return NULL;
+}
+
+static void tfs_destroy(void *private_data)
+{
+  service_stop();
+}
+
 static struct fuse_operations tfs_oper = {
+    .init	= tfs_init,
+    .destroy	= tfs_destroy,
     .getattr	= tfs_getattr,
     .access	= tfs_access,
     .readlink	= tfs_readlink,
     .readdir	= tfs_readdir,
+    .open	= tfs_open,
+    .read	= tfs_read,
+    .write	= tfs_write,
+    .truncate	= tfs_truncate,
 #if 0
     .mknod	= tfs_mknod,
     .mkdir	= tfs_mkdir,
@@ -720,7 +709,7 @@ static struct fuse_operations tfs_oper = {
     .chown	= NULL,
     .utimens	= NULL,
     .statfs	= NULL,
-    .release	= NULL,
+    .release	= tfs_release,
     .fsync	= NULL,
 #endif
 #ifdef HAVE_SETXATTR
@@ -733,107 +722,36 @@ static struct fuse_operations tfs_oper = {
 
 /* main */
 
-extern PluginInterface djvu_interface;
-extern PluginInterface pdf_interface;
-
-static PluginInterface* s_plugins[] = {
-  &djvu_interface,
-  &pdf_interface
+typedef struct tagOptions
+{
+  gchar* root;
+  gint slowlog_us;    /* -1: off */
+  gchar* record;      /* operation trace file */
+  gint scan_threads;
+  gchar* index;       /* NULL: in memory */
+  gint prebuilt;      /* open index read-only, no scan */
+  gchar* snapshot;    /* serve a snapshot instead of an index */
+  gint lockfree;      /* serve lookups from snapshots of the index */
+} options_t;
+
+static struct fuse_opt tfs_opts[] = {
+  { "slowlog=%i", offsetof(options_t, slowlog_us), 0 },
+  { "record=%s", offsetof(options_t, record), 0 },
+  { "scan_threads=%i", offsetof(options_t, scan_threads), 0 },
+  { "index=%s", offsetof(options_t, index), 0 },
+  { "prebuilt", offsetof(options_t, prebuilt), 1 },
+  { "snapshot=%s", offsetof(options_t, snapshot), 0 },
+  { "lockfree", offsetof(options_t, lockfree), 1 },
+  FUSE_OPT_END
 };
-#define PLUGINS_COUNT (sizeof(s_plugins)/sizeof(*s_plugins))
 
-static void put_metainfo_to_db(GQuark key_id, gpointer data, gpointer user_data)
+/* indexed paths are absolute */
+static gboolean check_root(const gchar* filename, const gchar* built, const gchar* root)
 {
-  const gint file_id = GPOINTER_TO_INT(user_data);
-
-  const gchar* attr = g_quark_to_string(key_id);
-  const gint attr_id = insert_attr(attr);
-
-  if (!g_ascii_strcasecmp(attr, "keywords") || !g_ascii_strcasecmp(attr, "author"))
-    {
-      gchar** vals = g_strsplit((gchar*)data, ",", 0);
-      gchar** val;
-      for (val = vals; *val; ++val)
-	{
-	  g_strstrip(*val);
-
-	  const gint value_id = insert_attr_value(*val);
-
-	  gchar* sql = g_strdup_printf("insert into link values (null, %d, %d, %d)", file_id, attr_id, value_id);
-	  sql_exec(sql);
-	  g_free(sql);
-	}
-      g_strfreev(vals);
-    }
-  else
-    {
-      gint value_id = insert_attr_value((gchar*)data);
-
-      gchar* sql = g_strdup_printf("insert into link values (null, %d, %d, %d)", file_id, attr_id, value_id);
-      sql_exec(sql);
-      g_free(sql);
-    }
-}
-
-static void get_attrs(const char* name, const char* path)
-{
-  GData* metainfo;
-  g_datalist_init(&metainfo);
-
-  const gchar* mime = magic_file(magic, name);
-
-  gint i;
-  for (i = 0; i < PLUGINS_COUNT; ++i)
-    {
-      if (s_plugins[i]->check_file(path, mime))
-	{
-	  metainfo = s_plugins[i]->get_metainfo(path, NULL);
-	  // print error??
-	  break;
-	}
-    }
-
-  gint file_id;
-  {
-    sqlite3_stmt *statement;
-    sqlite3_prepare_v2(db, "insert into file values (null, ?, ?)", -1, &statement, NULL);
-    sqlite3_bind_text(statement, 1, name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(statement, 2, path, -1, SQLITE_STATIC);
-    sqlite3_step(statement);
-    file_id = sqlite3_last_insert_rowid(db);
-    sqlite3_finalize(statement);
-  }
-
-  g_datalist_foreach(&metainfo, put_metainfo_to_db, GINT_TO_POINTER(file_id));
-}
-
-static void scan_dir(const char* path)
-{
-  DIR* d;
-  d = opendir(path);
-  if (!d)
-      return;
-
-  struct dirent* e;
-  while ((e = readdir(d)) != 0)
-    {
-      char* full_name = g_strdup_printf("%s/%s", path, e->d_name);
-
-      struct stat st;
-      stat(full_name, &st);
-
-      if (S_ISREG(st.st_mode))
-	{
-	  get_attrs(e->d_name, full_name);
-	}
-      else if (S_ISDIR(st.st_mode))
-	{
-	  if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))
-	    scan_dir(full_name);
-	}
-      g_free(full_name);
-    }
-  closedir(d);
+  if (strcmp(built, root) == 0)
+    return TRUE;
+  fprintf(stderr, "%s was built for %s, not %s\n", filename, built, root);
+  return FALSE;
 }
 
 static int opt_process(void *data,
@@ -842,6 +760,7 @@ static int opt_process(void *data,
 		       struct fuse_args *outargs)
 {
   static int found = 0;
+  options_t* options = (options_t*)data;
 
   /*
    * Grab the first non-option argument as the query text, but make sure
@@ -852,12 +771,12 @@ static int opt_process(void *data,
       found = 1;
       if (g_path_is_absolute(arg))
 	{
-	  *(gchar**)data = g_strdup(arg);
+	  options->root = g_strdup(arg);
 	}
       else
 	{
 	  gchar *pwd = g_get_current_dir();
-	  *(gchar**)data = g_build_filename(pwd, arg, NULL);
+	  options->root = g_build_filename(pwd, arg, NULL);
 	  g_free(pwd);
 	}
       return 0;
@@ -866,47 +785,28 @@ static int opt_process(void *data,
   return 1;
 }
 
-static void create_db()
-{
-  sqlite3_open(":memory:", &db);
-  // sqlite3_open("/home/andy/tags.db", &db);
-
-  sql_exec("create table file ("
-	   "id integer primary key,"
-	   "name varchar(255),"
-	   "path varchar(255))");
-
-  sql_exec("create table attr ("
-	   "id integer primary key,"
-	   "name varchar(255))");
-
-  sql_exec("create table attr_value ("
-	   "id integer primary key,"
-	   "value varchar(255))");
-
-  sql_exec("create table link ("
-	   "id integer primary key,"
-	   "file_id integer,"
-	   "attr_id integer,"
-	   "value_id integer)");
-}
-
 int main(int argc, char *argv[])
 {
-  magic = magic_open(MAGIC_MIME_TYPE);
+  trace_init_from_env();
+
+  magic_t magic = magic_open(MAGIC_MIME_TYPE);
   g_assert(magic != NULL);
 
   int magic_load_result = magic_load(magic, NULL);
   g_assert(magic_load_result == 0);
 
+  if (plugins_load() == 0)
+    fprintf(stderr, "Warning: no plugins found in %s\n", PLUGINDIR);
+
   struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-  gchar* root = NULL;
-  if (fuse_opt_parse(&args, &root, NULL, opt_process) == -1)
+  options_t options = { NULL, -1, NULL, 1, NULL, 0, NULL, 0 };
+  if (fuse_opt_parse(&args, &options, tfs_opts, opt_process) == -1)
     {
       fprintf(stderr, "usage: %s <dir> <mount point> [OPTIONS...]\n", argv[0]);
       return 1;
     }
 
+  gchar* root = options.root;
   if (root == NULL)
     {
       fprintf(stderr, "usage: %s <dir> <mount point> [OPTIONS...]\n", argv[0]);
@@ -916,17 +816,97 @@ int main(int argc, char *argv[])
   openlog(argv[0], 0, LOG_USER);
   syslog(LOG_INFO, "Started successfully");
 
-  create_db();
-  scan_dir(root);
+  /* clients look files up by canonical path */
+  {
+    gchar* canonical = realpath(root, NULL);
+    if (canonical != NULL)
+      {
+	g_free(root);
+	root = g_strdup(canonical);
+	free(canonical);
+      }
+  }
+
+  if (options.prebuilt && options.index == NULL)
+    {
+      fprintf(stderr, "-o prebuilt needs -o index=FILE\n");
+      return 1;
+    }
+  if (options.snapshot != NULL && options.index != NULL)
+    {
+      fprintf(stderr, "-o snapshot and -o index exclude each other\n");
+      return 1;
+    }
+
+  GError* error = NULL;
+  if (options.snapshot != NULL)
+    {
+      /* the index stays closed, there is nothing to scan or log */
+      if (!snapshot_open(options.snapshot, &error))
+	{
+	  fprintf(stderr, "%s\n", error->message);
+	  g_error_free(error);
+	  return 1;
+	}
+      if (!check_root(options.snapshot, snapshot_root(), root))
+	return 1;
+    }
+  else
+    {
+      if (!index_open(options.index, options.prebuilt, &error))
+	{
+	  fprintf(stderr, "%s\n", error->message);
+	  g_error_free(error);
+	  return 1;
+	}
+      if (options.slowlog_us >= 0)
+	slowlog_enable(options.slowlog_us);
+
+      if (options.prebuilt)
+	{
+	  gchar* built = index_scan_root();
+	  if (!check_root(options.index, built, root))
+	    return 1;
+	  g_free(built);
+	}
+      else
+	{
+	  scan_tree(magic, root, MAX(options.scan_threads, 1));
+	  index_analyze();
+	}
+
+      /* updates through the service publish new generations */
+      if (options.lockfree && !snapshot_publish_index(&error))
+	{
+	  fprintf(stderr, "%s\n", error->message);
+	  g_error_free(error);
+	  return 1;
+	}
+    }
+
+  /* opened here: fuse_main changes to / when it daemonizes */
+  if (options.record != NULL)
+    {
+      if (!optrace_open(options.record, &error))
+	{
+	  fprintf(stderr, "%s\n", error->message);
+	  g_error_free(error);
+	  return 1;
+	}
+    }
 
   int result = fuse_main(args.argc, args.argv, &tfs_oper, NULL);
 
-  sqlite3_close(db);
+  optrace_close();
+  snapshot_close();
+  index_close();
 
   syslog(LOG_INFO, "Exiting");
   closelog();
 
   magic_close(magic);
+  trace_shutdown();
+  plugins_unload();
 
   return result;
 }
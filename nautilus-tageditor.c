@@ -6,14 +6,11 @@
 #include "nautilus-tageditor.h"
 
 #include "core.h"
+#include "plugins.h"
 
-static GList* get_pages(NautilusPropertyPageProvider* provider, GList* files)
+/* local file name of a regular file, or NULL */
+static gchar* get_local_filename(NautilusFileInfo* file)
 {
-  if (files == NULL || files->next != NULL) // files.length == 0 || files.length > 1
-    return NULL;
-
-  NautilusFileInfo* file = files->data; // files[0]
-
   gboolean file_scheme;
   {
     char* scheme = nautilus_file_info_get_uri_scheme(file);
@@ -27,21 +24,41 @@ static GList* get_pages(NautilusPropertyPageProvider* provider, GList* files)
   if (nautilus_file_info_is_directory(file))
     return NULL;
 
-  gchar* filename;
-  {
-    gchar* uri = nautilus_file_info_get_uri(file);
-    filename = g_filename_from_uri(uri, NULL, NULL);
-    g_free(uri);
-  }
+  gchar* uri = nautilus_file_info_get_uri(file);
+  gchar* filename = g_filename_from_uri(uri, NULL, NULL);
+  g_free(uri);
+  return filename;
+}
 
-  if (filename == NULL)
-    return NULL;
+static GList* get_pages(NautilusPropertyPageProvider* provider, GList* files)
+{
+  GPtrArray* filenames = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray* mimes = g_ptr_array_new_with_free_func(g_free);
+
+  GList* item;
+  for (item = files; item != NULL; item = item->next)
+    {
+      NautilusFileInfo* file = item->data;
+
+      gchar* filename = get_local_filename(file);
+      if (filename == NULL)
+	continue;
+
+      g_ptr_array_add(filenames, filename);
+      g_ptr_array_add(mimes, nautilus_file_info_get_mime_type(file));
+    }
 
-  gchar* mime = nautilus_file_info_get_mime_type(file);
+  GtkWidget* page = NULL;
+  if (filenames->len == 1)
+    page = get_page(g_ptr_array_index(filenames, 0), g_ptr_array_index(mimes, 0), NULL);
+  else if (filenames->len > 1)
+    page = get_multi_page((const gchar* const*)filenames->pdata,
+			  (const gchar* const*)mimes->pdata,
+			  filenames->len,
+			  NULL);
 
-  GtkWidget* page = get_page(filename, mime, NULL);
-  g_free(filename);
-  g_free(mime);
+  g_ptr_array_free(filenames, TRUE);
+  g_ptr_array_free(mimes, TRUE);
 
   if (page == NULL)
     return NULL;
@@ -97,6 +114,9 @@ static void register_type(GTypeModule* module)
 
 void nautilus_module_initialize(GTypeModule* module)
 {
+  plugins_load();
+  /* a plugin crashing on a file must not take the file manager down */
+  plugins_start_helpers();
   register_type(module);
 }
 
@@ -108,4 +128,5 @@ void nautilus_module_list_types(const GType** types, int* num_types)
 
 void nautilus_module_shutdown(void)
 {
+  plugins_unload();
 }
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+#include "optrace.h"
+#include "stats.h"
+
+#define FLUSH_SIZE 65536
+#define MAX_VARINT 10
+
+static const gchar* const s_names[OPTRACE_COUNT] = {
+  "getattr",
+  "access",
+  "readlink",
+  "readdir",
+  "open",
+  "read",
+  "write",
+  "truncate",
+};
+
+gboolean optrace_enabled = FALSE;
+
+static FILE* s_file = NULL;
+static GMutex s_lock;
+static GByteArray* s_buffer = NULL;
+static guint64 s_origin = 0;
+/* previous record, for deltas */
+static guint64 s_last_start = 0;
+static gchar* s_last_path = NULL;
+static guint s_threads = 0;
+
+const gchar* optrace_op_name(optrace_op_t op)
+{
+  return op < OPTRACE_COUNT ? s_names[op] : "unknown";
+}
+
+static guint64 zigzag(gint64 value)
+{
+  return ((guint64)value << 1) ^ (guint64)(value >> 63);
+}
+
+static gint64 unzigzag(guint64 value)
+{
+  return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+}
+
+static void put_varint(GByteArray* buffer, guint64 value)
+{
+  guint8 bytes[MAX_VARINT];
+  guint len = 0;
+  while (value >= 0x80)
+    {
+      bytes[len++] = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+  bytes[len++] = value;
+  g_byte_array_append(buffer, bytes, len);
+}
+
+static guint thread_number(void)
+{
+  static __thread guint number = 0;
+  if (number == 0)
+    number = __atomic_add_fetch(&s_threads, 1, __ATOMIC_RELAXED);
+  return number - 1;
+}
+
+static void flush_locked(void)
+{
+  if (s_buffer->len > 0)
+    fwrite(s_buffer->data, 1, s_buffer->len, s_file);
+  g_byte_array_set_size(s_buffer, 0);
+}
+
+gboolean optrace_open(const gchar* filename, GError** error)
+{
+  s_file = fopen(filename, "wb");
+  if (s_file == NULL)
+    {
+      int saved_errno = errno;
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+		  "Cannot create %s: %s", filename, g_strerror(saved_errno));
+      return FALSE;
+    }
+
+  fwrite(OPTRACE_MAGIC, 1, strlen(OPTRACE_MAGIC), s_file);
+  s_buffer = g_byte_array_sized_new(FLUSH_SIZE + 256);
+  s_origin = stats_now();
+  s_last_start = 0;
+  s_last_path = g_strdup("");
+  optrace_enabled = TRUE;
+  return TRUE;
+}
+
+void optrace_record_op(optrace_op_t op, const gchar* path, guint64 start, gint64 result, guint64 arg1, guint64 arg2)
+{
+  guint64 end = stats_now();
+  guint thread = thread_number();
+  start = start > s_origin ? start - s_origin : 0;
+
+  g_mutex_lock(&s_lock);
+  if (s_file != NULL)
+    {
+      guint8 code = op;
+      g_byte_array_append(s_buffer, &code, 1);
+      put_varint(s_buffer, thread);
+      put_varint(s_buffer, zigzag((gint64)(start - s_last_start)));
+      put_varint(s_buffer, end - s_origin - start);
+      put_varint(s_buffer, zigzag(result));
+      put_varint(s_buffer, arg1);
+      put_varint(s_buffer, arg2);
+
+      gsize shared = 0;
+      while (path[shared] != '\0' && path[shared] == s_last_path[shared])
+	++shared;
+      gsize suffix = strlen(path + shared);
+      put_varint(s_buffer, shared);
+      put_varint(s_buffer, suffix);
+      g_byte_array_append(s_buffer, (const guint8*)path + shared, suffix);
+
+      s_last_start = start;
+      g_free(s_last_path);
+      s_last_path = g_strdup(path);
+
+      if (s_buffer->len >= FLUSH_SIZE)
+	flush_locked();
+    }
+  g_mutex_unlock(&s_lock);
+}
+
+void optrace_close(void)
+{
+  g_mutex_lock(&s_lock);
+  if (s_file != NULL)
+    {
+      optrace_enabled = FALSE;
+      flush_locked();
+      fclose(s_file);
+      s_file = NULL;
+      g_byte_array_free(s_buffer, TRUE);
+      s_buffer = NULL;
+      g_free(s_last_path);
+      s_last_path = NULL;
+    }
+  g_mutex_unlock(&s_lock);
+}
+
+/* reading */
+
+static gboolean get_varint(const guint8** p, const guint8* end, guint64* value)
+{
+  guint shift = 0;
+  *value = 0;
+  while (*p < end && shift < 7 * MAX_VARINT)
+    {
+      guint8 byte = *(*p)++;
+      *value |= (guint64)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+	return TRUE;
+      shift += 7;
+    }
+  return FALSE;
+}
+
+GArray* optrace_load(const gchar* filename, GError** error)
+{
+  gchar* contents;
+  gsize length;
+  if (!g_file_get_contents(filename, &contents, &length, error))
+    return NULL;
+
+  gsize magic_len = strlen(OPTRACE_MAGIC);
+  if (length < magic_len || memcmp(contents, OPTRACE_MAGIC, magic_len) != 0)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not an operation trace", filename);
+      g_free(contents);
+      return NULL;
+    }
+
+  GArray* records = g_array_new(FALSE, FALSE, sizeof(optrace_record_t));
+  const guint8* p = (const guint8*)contents + magic_len;
+  const guint8* end = (const guint8*)contents + length;
+  const gchar* last_path = "";
+  guint64 last_start = 0;
+
+  while (p < end)
+    {
+      optrace_record_t record;
+      guint64 thread, delta, result, shared, suffix;
+
+      record.op = *p++;
+      if (!get_varint(&p, end, &thread) ||
+	  !get_varint(&p, end, &delta) ||
+	  !get_varint(&p, end, &record.duration) ||
+	  !get_varint(&p, end, &result) ||
+	  !get_varint(&p, end, &record.arg1) ||
+	  !get_varint(&p, end, &record.arg2) ||
+	  !get_varint(&p, end, &shared) ||
+	  !get_varint(&p, end, &suffix) ||
+	  shared > strlen(last_path) || suffix > (guint64)(end - p) ||
+	  record.op >= OPTRACE_COUNT)
+	/* a truncated tail is expected after a crash */
+	break;
+
+      record.thread = thread;
+      record.start = last_start + unzigzag(delta);
+      record.result = unzigzag(result);
+
+      GString* path = g_string_new_len(last_path, shared);
+      g_string_append_len(path, (const gchar*)p, suffix);
+      p += suffix;
+      record.path = g_string_free(path, FALSE);
+
+      g_array_append_val(records, record);
+      last_start = record.start;
+      last_path = record.path;
+    }
+
+  g_free(contents);
+  return records;
+}
+
+void optrace_free(GArray* records)
+{
+  guint i;
+  for (i = 0; i < records->len; ++i)
+    g_free(g_array_index(records, optrace_record_t, i).path);
+  g_array_free(records, TRUE);
+}
@@ -0,0 +1,67 @@
+#ifndef OPTRACE_H
+#define OPTRACE_H
+
+#include <glib.h>
+
+/*
+ * Binary log of FUSE operations for replaying real access patterns
+ * (mount.tagfs -o record=FILE, tagfs-replay). A file is a header
+ * followed by records of varints:
+ *
+ *   op (1 byte), thread, start delta (zigzag, ns), duration (ns),
+ *   result (zigzag), arg1, arg2, shared path prefix, suffix length,
+ *   suffix bytes
+ *
+ * Start deltas are relative to the previous record, paths share a
+ * prefix with the previous path. Op codes are part of the format:
+ * only append to the enum.
+ */
+
+#define OPTRACE_MAGIC "TFSOPS1\n"
+
+typedef enum
+{
+  OPTRACE_GETATTR,
+  OPTRACE_ACCESS,     /* arg1: mask */
+  OPTRACE_READLINK,
+  OPTRACE_READDIR,
+  OPTRACE_OPEN,       /* arg1: flags */
+  OPTRACE_READ,       /* arg1: size, arg2: offset */
+  OPTRACE_WRITE,      /* arg1: size, arg2: offset */
+  OPTRACE_TRUNCATE,   /* arg1: size */
+  OPTRACE_COUNT
+} optrace_op_t;
+
+typedef struct tagOptraceRecord
+{
+  optrace_op_t op;
+  guint thread;       /* small per-thread number, in order of appearance */
+  guint64 start;      /* ns since recording started */
+  guint64 duration;   /* ns */
+  gint64 result;      /* as returned to FUSE */
+  guint64 arg1;
+  guint64 arg2;
+  gchar* path;
+} optrace_record_t;
+
+const gchar* optrace_op_name(optrace_op_t op);
+
+/* recording, a no-op unless optrace_open succeeded */
+extern gboolean optrace_enabled;
+
+gboolean optrace_open(const gchar* filename, GError** error);
+/* start as of stats_now() */
+void optrace_record_op(optrace_op_t op, const gchar* path, guint64 start, gint64 result, guint64 arg1, guint64 arg2);
+void optrace_close(void);
+
+static inline void optrace_record(optrace_op_t op, const gchar* path, guint64 start, gint64 result, guint64 arg1, guint64 arg2)
+{
+  if (optrace_enabled)
+    optrace_record_op(op, path, start, result, arg1, arg2);
+}
+
+/* reading: all records at once, free with optrace_free */
+GArray* optrace_load(const gchar* filename, GError** error);
+void optrace_free(GArray* records);
+
+#endif
@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <glib.h>
 
 #include "plugin_interface.h"
 
 #include "helpers.h"
+#include "spawn.h"
+#include "trace.h"
 
 static gboolean djvu_check_file(const gchar* filename, const gchar* mime)
 {
@@ -14,102 +17,89 @@ static gboolean djvu_check_file(const gchar* filename, const gchar* mime)
     || !strcmp(mime, "image/x-djvu");
 }
 
-static GData* djvu_get_metainfo(const gchar *filename, GError** error)
+static void read_callback(void* user_data, gchar* line)
 {
-  FILE* pipe;
-  GIOChannel* channel;
-  GData* result;
-  gchar* cmdline;
-
-  g_datalist_init(&result);
-  
-  {
-    gchar* q = g_shell_quote(filename);
-    cmdline = g_strdup_printf("djvused %s -e print-meta", q);
-    g_free(q);
-  }
-
-  pipe = popen(cmdline, "r");
-  if (!pipe)
+  Metainfo* result = (Metainfo*)user_data;
+
+  gchar* val = strchr(line, '\t');
+  if (val != NULL)
     {
-      g_free(cmdline);
-      g_set_error(error,
-		  g_quark_from_static_string("plugin_djvu"),
-		  1,
-		  "Pipe error.");
-      return NULL;
+      *val = '\0';
+      ++val;
+      if (strchr(val, '\t') == NULL) /* there is one '\t' in line */
+	{
+	  gchar* value = dequote(val, '"');
+	  metainfo_set(result, line, value);
+	  g_free(value);
+	}
     }
+}
 
-  channel = g_io_channel_unix_new(fileno(pipe));
+static Metainfo* djvu_get_metainfo(const gchar *filename, GError** error)
+{
+  Metainfo* result = metainfo_new();
 
-  while (TRUE)
+  const gchar* argv[] = { "djvused", filename, "-e", "print-meta", NULL };
+  if (!exec_and_read_output(argv, read_callback, result, error))
     {
-      gchar* line;
-        
-      if (G_IO_STATUS_NORMAL != g_io_channel_read_line(channel, &line, NULL, NULL, NULL))
-	break;
-      g_strchomp(line);
-	
-      gchar* val;
-      
-      val = strchr(line, '\t');
-      if (val != NULL)
-        {
-	  *val = '\0';
-	  ++val;
-	  if (strchr(val, '\t') == NULL) /* there is one '\t' in line */
-            {
-	      g_datalist_set_data_full(&result, line, dequote(val, '"'), g_free);
-            }
-        }
-        
-      g_free(line);
+      metainfo_free(result);
+      return NULL;
     }
-  
-  g_io_channel_unref(channel);
-  pclose(pipe);
-  g_free(cmdline);
-  
+
   return result;
 }
 
-static void print_metainfo(GQuark key_id, gpointer data, gpointer user_data)
+static void print_metainfo(const gchar* key, const gchar* value, gpointer user_data)
 {
-  gchar* quoted = quote((gchar*)data, '"');
-  fprintf((FILE*)user_data, "%s\t%s\n", g_quark_to_string(key_id), quoted);
+  gchar* quoted = quote(value, '"');
+  fprintf((FILE*)user_data, "%s\t%s\n", key, quoted);
   g_free(quoted);
 }
 
-static void djvu_set_metainfo(const gchar* filename, GData* metainfo)
+static gboolean djvu_set_metainfo(const gchar* filename, const Metainfo* metainfo, GError** error)
 {
   gchar tempfile[] = "/tmp/metainfo-XXXXXX";
-  int fd = mkstemp(tempfile);
-  if (fd < 0)
-    return; // error
-
-  FILE* f = fdopen(fd, "w");
-  g_datalist_foreach(&metainfo, print_metainfo, f);
-  fclose(f);
-
-  gchar* cmdline;
-  {
-    gchar* qf = g_shell_quote(filename);
-
-    gchar* cmd = g_strdup_printf("set-meta %s; save", tempfile);
-    gchar* qc = g_shell_quote(cmd);
-    g_free(cmd);
-    
-    cmdline = g_strdup_printf("djvused %s -e %s", qf, qc);
-    g_free(qf);
-    g_free(qc);
-  }
-
-  system(cmdline);
+  if (!write_metainfo_file(tempfile, metainfo, print_metainfo, error))
+    return FALSE;
+
+  gchar* script = g_strdup_printf("set-meta %s; save", tempfile);
+  const gchar* argv[] = { "djvused", filename, "-e", script, NULL };
+  gboolean result = spawn_and_wait(argv, spawn_default_limits(), error);
+
+  g_free(script);
+  unlink(tempfile);
+  return result;
 }
 
-PluginInterface djvu_interface =
+static const gchar* const s_mime_types[] = {
+  "image/vnd.djvu",
+  "image/x.djvu",
+  "image/x-djvu",
+  NULL
+};
+
+static const PluginInterface djvu_interface =
 {
+  TAGFS_PLUGIN_ABI_VERSION,
+  "djvu",
+  1,
+  PLUGIN_CAP_THREAD_SAFE,
+  s_mime_types,
   djvu_check_file,
   djvu_get_metainfo,
-  djvu_set_metainfo
+  djvu_set_metainfo,
+  NULL,
+  0,
+  0,
+  NULL
 };
+
+const PluginInterface* tagfs_plugin_interface(void)
+{
+  return &djvu_interface;
+}
+
+void tagfs_plugin_set_trace_sink(trace_sink_t sink)
+{
+  trace_sink = sink;
+}
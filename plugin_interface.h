@@ -3,12 +3,60 @@
 
 #include <glib.h>
 
+#include "metainfo.h"
+
+/*
+ * Plugins are shared objects exporting TAGFS_PLUGIN_ENTRY. The host
+ * refuses any plugin whose abi_version differs from its own, so bump
+ * TAGFS_PLUGIN_ABI_VERSION on every incompatible change of this header.
+ * Plugins may also export TAGFS_PLUGIN_TRACE_ENTRY, see trace.h.
+ */
+#define TAGFS_PLUGIN_ABI_VERSION 5
+#define TAGFS_PLUGIN_ENTRY "tagfs_plugin_interface"
+
+/* capabilities */
+#define PLUGIN_CAP_FD          (1 << 0) /* get_metainfo_fd is implemented */
+#define PLUGIN_CAP_THREAD_SAFE (1 << 1) /* entry points may run concurrently */
+#define PLUGIN_CAP_REGIONS     (1 << 2) /* get_metainfo_regions is implemented */
+
+/*
+ * The first and last bytes of a file, read by the host ahead of
+ * extraction. When the file is small enough both cover all of it, and
+ * trailer may point into header.
+ */
+typedef struct tagPluginRegions
+{
+  guint64 file_size;
+  const guchar* header;  /* from offset 0 */
+  gsize header_size;
+  const guchar* trailer; /* ending at file_size */
+  gsize trailer_size;
+} PluginRegions;
+
 typedef struct tagPluginInterface
 {
+  guint abi_version;
+  const gchar* name;
+  guint version;
+  guint capabilities;
+  const gchar* const* mime_types; /* NULL-terminated */
+
   gboolean (*check_file)(const gchar* filename, const gchar* mime);
-  GData* (*get_metainfo)(const gchar* filename, GError** error);
-  void (*set_metainfo)(const gchar* filename, GData* metainfo);
+  /* returned Metainfo belongs to the caller */
+  Metainfo* (*get_metainfo)(const gchar* filename, GError** error);
+  /* FALSE when the file was left unchanged */
+  gboolean (*set_metainfo)(const gchar* filename, const Metainfo* metainfo, GError** error);
+
+  /* optional, see capabilities */
+  Metainfo* (*get_metainfo_fd)(int fd, const gchar* filename, GError** error);
+
+  /* bytes wanted at either end of a file, and an in-process extractor
+     returning NULL without error when they are not enough */
+  gsize header_size;
+  gsize trailer_size;
+  Metainfo* (*get_metainfo_regions)(const PluginRegions* regions, const gchar* filename, GError** error);
 } PluginInterface;
 
-#endif
+typedef const PluginInterface* (*PluginEntry)(void);
 
+#endif
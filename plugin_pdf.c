@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib.h>
 
 #include "plugin_interface.h"
 
 #include "helpers.h"
+#include "spawn.h"
+#include "trace.h"
 
 static gboolean pdf_check_file(const gchar* filename, const gchar* mime)
 {
@@ -32,7 +37,7 @@ struct read_context
 {
   gint state;
   gchar* key;
-  GData* result;
+  Metainfo* result;
 };
 
 static void read_callback(void* user_data, gchar* line)
@@ -52,86 +57,610 @@ static void read_callback(void* user_data, gchar* line)
       if (memcmp(line, "InfoValue: ", 11) == 0)
 	{
 	  rc->state = 0;
-	  gchar* value = g_strdup(line + 11);
-
-	  g_datalist_set_data_full(&rc->result, rc->key, value, g_free);
+	  metainfo_set(rc->result, rc->key, line + 11);
 	  g_free(rc->key);
 	  rc->key = NULL;
 	}
     }
 }
 
-static GData* pdf_get_metainfo(const gchar* filename, GError** error)
+static Metainfo* pdf_get_metainfo(const gchar* filename, GError** error)
 {
-  gchar* cmdline;
-
-  {
-    gchar* q = g_shell_quote(filename);
-    cmdline = g_strdup_printf("pdftk %s dump_data output -", q);
-    g_free(q);
-  }
-
   struct read_context rc;
   rc.state = 0;
   rc.key = NULL;
-  g_datalist_init(&rc.result);
+  rc.result = metainfo_new();
 
-  gboolean r = exec_and_read_output(cmdline, read_callback, &rc);
-  g_free(cmdline);
+  const gchar* argv[] = { "pdftk", filename, "dump_data", "output", "-", NULL };
+  gboolean r = exec_and_read_output(argv, read_callback, &rc, error);
 
   if (rc.key != NULL)
     g_free(rc.key);
 
   if (r)
     return rc.result;
-  else
+
+  metainfo_free(rc.result);
+  return NULL;
+}
+
+/*
+ * In-process extraction of the document information dictionary from the
+ * regions the host prefetched, or from an open descriptor, which also
+ * reaches an Info dictionary outside the regions through the
+ * cross-reference table. Anything unusual (encryption, an Info
+ * dictionary in an object stream, cross-reference streams, indirect or
+ * non-Latin values) is left to pdftk. Values are encoded as pdftk's
+ * dump_data encodes them, so both paths index the same strings.
+ */
+
+#define PDF_REGION_SIZE 65536
+
+typedef struct tagPdfLexer
+{
+  const guchar* p;
+  const guchar* end;
+} pdf_lexer_t;
+
+static gboolean pdf_is_space(guchar c)
+{
+  return c == 0 || c == '\t' || c == '\n' || c == '\f' || c == '\r' || c == ' ';
+}
+
+static gboolean pdf_is_delimiter(guchar c)
+{
+  return c != 0 && strchr("()<>[]{}/%", c) != NULL;
+}
+
+static void pdf_skip_space(pdf_lexer_t* lx)
+{
+  while (lx->p < lx->end)
+    {
+      if (pdf_is_space(*lx->p))
+	++lx->p;
+      else if (*lx->p == '%')
+	while (lx->p < lx->end && *lx->p != '\n' && *lx->p != '\r')
+	  ++lx->p;
+      else
+	break;
+    }
+}
+
+static gboolean pdf_parse_uint(pdf_lexer_t* lx, guint* value)
+{
+  const guchar* start = lx->p;
+  *value = 0;
+  while (lx->p < lx->end && g_ascii_isdigit(*lx->p) && lx->p - start < 9)
+    *value = *value * 10 + (*lx->p++ - '0');
+  return lx->p > start;
+}
+
+/* "N G R" */
+static gboolean pdf_parse_ref(pdf_lexer_t* lx, guint* num, guint* gen)
+{
+  pdf_lexer_t save = *lx;
+  if (pdf_parse_uint(lx, num))
+    {
+      pdf_skip_space(lx);
+      if (pdf_parse_uint(lx, gen))
+	{
+	  pdf_skip_space(lx);
+	  if (lx->p < lx->end && *lx->p == 'R')
+	    {
+	      ++lx->p;
+	      return TRUE;
+	    }
+	}
+    }
+  *lx = save;
+  return FALSE;
+}
+
+static GString* pdf_parse_literal(pdf_lexer_t* lx)
+{
+  GString* out = g_string_new(NULL);
+  gint depth = 1;
+  ++lx->p;
+  while (lx->p < lx->end)
+    {
+      guchar c = *lx->p++;
+      if (c == '\\' && lx->p < lx->end)
+	{
+	  c = *lx->p++;
+	  switch (c)
+	    {
+	    case 'n': g_string_append_c(out, '\n'); break;
+	    case 'r': g_string_append_c(out, '\r'); break;
+	    case 't': g_string_append_c(out, '\t'); break;
+	    case 'b': g_string_append_c(out, '\b'); break;
+	    case 'f': g_string_append_c(out, '\f'); break;
+	    case '\r':
+	      if (lx->p < lx->end && *lx->p == '\n')
+		++lx->p;
+	      break;
+	    case '\n':
+	      break;
+	    default:
+	      if (c >= '0' && c <= '7')
+		{
+		  guint code = c - '0';
+		  gint digits;
+		  for (digits = 1; digits < 3 && lx->p < lx->end && *lx->p >= '0' && *lx->p <= '7'; ++digits)
+		    code = code * 8 + (*lx->p++ - '0');
+		  g_string_append_c(out, (gchar)code);
+		}
+	      else
+		g_string_append_c(out, c);
+	    }
+	}
+      else if (c == '(')
+	{
+	  ++depth;
+	  g_string_append_c(out, c);
+	}
+      else if (c == ')')
+	{
+	  if (--depth == 0)
+	    return out;
+	  g_string_append_c(out, c);
+	}
+      else if (c == '\r')
+	{
+	  if (lx->p < lx->end && *lx->p == '\n')
+	    ++lx->p;
+	  g_string_append_c(out, '\n');
+	}
+      else
+	g_string_append_c(out, c);
+    }
+  g_string_free(out, TRUE);
+  return NULL;
+}
+
+static GString* pdf_parse_hex(pdf_lexer_t* lx)
+{
+  GString* out = g_string_new(NULL);
+  gint high = -1;
+  ++lx->p;
+  while (lx->p < lx->end)
+    {
+      guchar c = *lx->p++;
+      if (c == '>')
+	{
+	  if (high >= 0)
+	    g_string_append_c(out, (gchar)(high << 4));
+	  return out;
+	}
+      if (pdf_is_space(c))
+	continue;
+      if (!g_ascii_isxdigit(c))
+	break;
+      if (high < 0)
+	high = g_ascii_xdigit_value(c);
+      else
+	{
+	  g_string_append_c(out, (gchar)((high << 4) | g_ascii_xdigit_value(c)));
+	  high = -1;
+	}
+    }
+  g_string_free(out, TRUE);
+  return NULL;
+}
+
+static gboolean pdf_skip_value(pdf_lexer_t* lx, gint depth)
+{
+  if (lx->p >= lx->end || depth > 32)
+    return FALSE;
+
+  GString* string;
+  const guchar* start = lx->p;
+  switch (*lx->p)
+    {
+    case '(':
+    case '<':
+      if (*lx->p == '<' && lx->p + 1 < lx->end && lx->p[1] == '<')
+	{
+	  lx->p += 2;
+	  for (;;)
+	    {
+	      pdf_skip_space(lx);
+	      if (lx->p + 1 < lx->end && lx->p[0] == '>' && lx->p[1] == '>')
+		{
+		  lx->p += 2;
+		  return TRUE;
+		}
+	      if (!pdf_skip_value(lx, depth + 1))
+		return FALSE;
+	    }
+	}
+      string = *lx->p == '(' ? pdf_parse_literal(lx) : pdf_parse_hex(lx);
+      if (string == NULL)
+	return FALSE;
+      g_string_free(string, TRUE);
+      return TRUE;
+    case '[':
+      ++lx->p;
+      for (;;)
+	{
+	  pdf_skip_space(lx);
+	  if (lx->p < lx->end && *lx->p == ']')
+	    {
+	      ++lx->p;
+	      return TRUE;
+	    }
+	  if (!pdf_skip_value(lx, depth + 1))
+	    return FALSE;
+	}
+    case '/':
+      ++lx->p;
+      /* fall through */
+    default:
+      while (lx->p < lx->end && !pdf_is_space(*lx->p) && !pdf_is_delimiter(*lx->p))
+	++lx->p;
+      return lx->p > start;
+    }
+}
+
+/* name after '/', with #xx escapes decoded */
+static gchar* pdf_parse_name(pdf_lexer_t* lx)
+{
+  GString* out = g_string_new(NULL);
+  ++lx->p;
+  while (lx->p < lx->end && !pdf_is_space(*lx->p) && !pdf_is_delimiter(*lx->p))
+    {
+      guchar c = *lx->p++;
+      if (c == '#' && lx->end - lx->p >= 2 && g_ascii_isxdigit(lx->p[0]) && g_ascii_isxdigit(lx->p[1]))
+	{
+	  c = (g_ascii_xdigit_value(lx->p[0]) << 4) | g_ascii_xdigit_value(lx->p[1]);
+	  lx->p += 2;
+	}
+      g_string_append_c(out, c);
+    }
+  return g_string_free(out, FALSE);
+}
+
+/* text string to UTF-8: UTF-16BE with a byte order mark, else PDFDocEncoding */
+static gchar* pdf_decode_text(const GString* s)
+{
+  if (s->len >= 2 && (guchar)s->str[0] == 0xfe && (guchar)s->str[1] == 0xff)
+    return g_convert(s->str + 2, s->len - 2, "UTF-8", "UTF-16BE", NULL, NULL, NULL);
+
+  if (s->len >= 3 && memcmp(s->str, "\xef\xbb\xbf", 3) == 0)
+    return g_utf8_validate(s->str + 3, s->len - 3, NULL) ? g_strndup(s->str + 3, s->len - 3) : NULL;
+
+  /* PDFDocEncoding is Latin-1 but for these */
+  gsize i;
+  for (i = 0; i < s->len; ++i)
+    {
+      guchar c = s->str[i];
+      if ((c >= 0x18 && c <= 0x1f) || (c >= 0x7f && c <= 0xa0) || c == 0)
+	return NULL;
+    }
+  return g_convert(s->str, s->len, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+}
+
+/* as pdftk dump_data prints strings: printable ASCII, else UTF-16 code units as entities */
+static gchar* pdf_xml_encode(const gchar* utf8)
+{
+  GString* out = g_string_new(NULL);
+  const gchar* p;
+  for (p = utf8; *p != '\0'; p = g_utf8_next_char(p))
+    {
+      gunichar c = g_utf8_get_char(p);
+      if (c >= 0x20 && c <= 0x7e)
+	{
+	  switch (c)
+	    {
+	    case '<': g_string_append(out, "&lt;"); break;
+	    case '>': g_string_append(out, "&gt;"); break;
+	    case '&': g_string_append(out, "&amp;"); break;
+	    case '\'': g_string_append(out, "&apos;"); break;
+	    case '"': g_string_append(out, "&quot;"); break;
+	    default: g_string_append_c(out, c);
+	    }
+	}
+      else if (c > 0xffff)
+	g_string_append_printf(out, "&#%u;&#%u;",
+			       0xd800 + ((c - 0x10000) >> 10), 0xdc00 + ((c - 0x10000) & 0x3ff));
+      else
+	g_string_append_printf(out, "&#%u;", c);
+    }
+  return g_string_free(out, FALSE);
+}
+
+static const guchar* pdf_find(const guchar* data, gsize size, const gchar* needle, gboolean last)
+{
+  gsize len = strlen(needle);
+  const guchar* found = NULL;
+  gsize i;
+  for (i = 0; i + len <= size; ++i)
+    if (data[i] == (guchar)needle[0] && memcmp(data + i, needle, len) == 0)
+      {
+	found = data + i;
+	if (!last)
+	  break;
+      }
+  return found;
+}
+
+/* "N G obj" at the start of a line or after whitespace, the last definition wins */
+static const guchar* pdf_find_object(const guchar* data, gsize size, guint num, guint gen)
+{
+  gchar* needle = g_strdup_printf("%u %u obj", num, gen);
+  gsize len = strlen(needle);
+  const guchar* found = NULL;
+  gsize i;
+  for (i = 0; i + len <= size; ++i)
+    if (data[i] == (guchar)needle[0] && memcmp(data + i, needle, len) == 0
+	&& (i == 0 || pdf_is_space(data[i - 1])))
+      found = data + i + len;
+  g_free(needle);
+  return found;
+}
+
+static Metainfo* pdf_parse_info(pdf_lexer_t* lx)
+{
+  pdf_skip_space(lx);
+  if (lx->end - lx->p < 2 || lx->p[0] != '<' || lx->p[1] != '<')
+    return NULL;
+  lx->p += 2;
+
+  Metainfo* result = metainfo_new();
+  for (;;)
+    {
+      pdf_skip_space(lx);
+      if (lx->end - lx->p >= 2 && lx->p[0] == '>' && lx->p[1] == '>')
+	return result;
+      if (lx->p >= lx->end || *lx->p != '/')
+	break;
+
+      gchar* key = pdf_parse_name(lx);
+      pdf_skip_space(lx);
+
+      guint num, gen;
+      GString* raw = NULL;
+      if (lx->p < lx->end && *lx->p == '(')
+	raw = pdf_parse_literal(lx);
+      else if (lx->end - lx->p >= 2 && lx->p[0] == '<' && lx->p[1] != '<')
+	raw = pdf_parse_hex(lx);
+      else if (pdf_parse_ref(lx, &num, &gen) || !pdf_skip_value(lx, 0))
+	{
+	  /* an indirect value lives elsewhere */
+	  g_free(key);
+	  break;
+	}
+      else
+	{
+	  /* pdftk only prints strings */
+	  g_free(key);
+	  continue;
+	}
+
+      gchar* text = raw != NULL ? pdf_decode_text(raw) : NULL;
+      if (raw != NULL)
+	g_string_free(raw, TRUE);
+      if (text == NULL)
+	{
+	  g_free(key);
+	  break;
+	}
+
+      gchar* xml_key = pdf_xml_encode(key);
+      gchar* xml_value = pdf_xml_encode(text);
+      metainfo_set(result, xml_key, xml_value);
+      g_free(xml_key);
+      g_free(xml_value);
+      g_free(text);
+      g_free(key);
+    }
+
+  metainfo_free(result);
+  return NULL;
+}
+
+/* the Info reference of the trailer, FALSE for none or an encrypted document */
+static gboolean pdf_info_ref(const PluginRegions* regions, guint* num, guint* gen)
+{
+  /* the trailer, or the cross-reference stream dictionary, names the Info dictionary */
+  const guchar* info = pdf_find(regions->trailer, regions->trailer_size, "/Info", TRUE);
+  if (info == NULL || pdf_find(regions->trailer, regions->trailer_size, "/Encrypt", FALSE) != NULL)
+    return FALSE;
+
+  pdf_lexer_t lx = { info + 5, regions->trailer + regions->trailer_size };
+  pdf_skip_space(&lx);
+  return pdf_parse_ref(&lx, num, gen);
+}
+
+static Metainfo* pdf_parse_object(const guchar* data, gsize size, guint num, guint gen)
+{
+  const guchar* object = pdf_find_object(data, size, num, gen);
+  if (object == NULL)
     return NULL;
+  pdf_lexer_t lx = { object, data + size };
+  return pdf_parse_info(&lx);
 }
 
-static void print_metainfo(GQuark key_id, gpointer data, gpointer user_data)
+static Metainfo* pdf_info_in_regions(const PluginRegions* regions, guint num, guint gen)
 {
-  gchar* quoted = quote((gchar*)data, '"');
-  fprintf((FILE*)user_data, "InfoKey: %s\n", g_quark_to_string(key_id));
+  if (pdf_find_object(regions->trailer, regions->trailer_size, num, gen) != NULL)
+    return pdf_parse_object(regions->trailer, regions->trailer_size, num, gen);
+  return pdf_parse_object(regions->header, regions->header_size, num, gen);
+}
+
+static Metainfo* pdf_get_metainfo_regions(const PluginRegions* regions, const gchar* filename, GError** error)
+{
+  guint64 span = trace_begin();
+  Metainfo* result = NULL;
+
+  guint num, gen;
+  if (pdf_info_ref(regions, &num, &gen))
+    result = pdf_info_in_regions(regions, num, gen);
+
+  trace_end("pdf", "extract", span);
+  return result;
+}
+
+#define PDF_XREF_SECTIONS 1024 /* subsections looked at */
+
+/*
+ * The offset of an object in use according to the cross-reference table
+ * startxref points to, 0 when unknown. Earlier tables (/Prev) are not
+ * followed.
+ */
+static guint64 pdf_xref_offset(int fd, const PluginRegions* regions, guint num, guint gen)
+{
+  const guchar* startxref = pdf_find(regions->trailer, regions->trailer_size, "startxref", TRUE);
+  if (startxref == NULL)
+    return 0;
+  pdf_lexer_t lx = { startxref + 9, regions->trailer + regions->trailer_size };
+  guint offset;
+  pdf_skip_space(&lx);
+  if (!pdf_parse_uint(&lx, &offset))
+    return 0;
+
+  /* "xref", then subsections of "<first> <count>" and 20-byte entries */
+  guint64 pos = offset;
+  guint i;
+  for (i = 0; i < PDF_XREF_SECTIONS; ++i)
+    {
+      guchar line[64];
+      ssize_t n = pread(fd, line, sizeof(line), pos);
+      if (n <= 0)
+	return 0;
+      lx.p = line;
+      lx.end = line + n;
+      if (i == 0)
+	{
+	  if (n < 4 || memcmp(line, "xref", 4) != 0)
+	    return 0;
+	  lx.p += 4;
+	}
+
+      guint first, count;
+      pdf_skip_space(&lx);
+      if (!pdf_parse_uint(&lx, &first))
+	return 0; /* "trailer" */
+      pdf_skip_space(&lx);
+      if (!pdf_parse_uint(&lx, &count))
+	return 0;
+      pdf_skip_space(&lx);
+      if (lx.p == lx.end)
+	return 0;
+      guint64 entries = pos + (lx.p - line);
+
+      if (num >= first && num - first < count)
+	{
+	  gchar entry[21];
+	  if (pread(fd, entry, 20, entries + (guint64)(num - first) * 20) != 20)
+	    return 0;
+	  entry[20] = '\0';
+	  gchar* end;
+	  guint64 result = g_ascii_strtoull(entry, &end, 10);
+	  if (end != entry + 10 || entry[10] != ' ' || entry[16] != ' ' || entry[17] != 'n'
+	      || g_ascii_strtoull(entry + 11, NULL, 10) != gen)
+	    return 0;
+	  return result;
+	}
+      pos = entries + (guint64)count * 20;
+    }
+  return 0;
+}
+
+static Metainfo* pdf_get_metainfo_fd(int fd, const gchar* filename, GError** error)
+{
+  guint64 span = trace_begin();
+  Metainfo* result = NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      gsize size = MIN((guint64)st.st_size, PDF_REGION_SIZE);
+      guchar* buffer = g_malloc(2 * size);
+      PluginRegions regions = { st.st_size, buffer, size, buffer + size, size };
+      guint num, gen;
+      /* a file changing meanwhile is left to pdftk */
+      if (pread(fd, buffer, size, 0) == (ssize_t)size
+	  && pread(fd, buffer + size, size, st.st_size - size) == (ssize_t)size
+	  && pdf_info_ref(&regions, &num, &gen))
+	{
+	  result = pdf_info_in_regions(&regions, num, gen);
+	  guint64 offset = result == NULL ? pdf_xref_offset(fd, &regions, num, gen) : 0;
+	  ssize_t n = offset != 0 ? pread(fd, buffer, size, offset) : 0;
+	  /* the entry points at "N G obj" */
+	  const guchar* object = n > 0 ? pdf_find_object(buffer, MIN((gsize)n, 32), num, gen) : NULL;
+	  if (object != NULL)
+	    {
+	      pdf_lexer_t lx = { object, buffer + n };
+	      result = pdf_parse_info(&lx);
+	    }
+	}
+      g_free(buffer);
+    }
+
+  trace_end("pdf", "extract", span);
+  return result != NULL ? result : pdf_get_metainfo(filename, error);
+}
+
+static void print_metainfo(const gchar* key, const gchar* value, gpointer user_data)
+{
+  gchar* quoted = quote(value, '"');
+  fprintf((FILE*)user_data, "InfoKey: %s\n", key);
   fprintf((FILE*)user_data, "InfoValue: %s\n", quoted);
   g_free(quoted);
 }
 
-static void pdf_set_metainfo(const gchar* filename, GData* metainfo)
+static gboolean pdf_set_metainfo(const gchar* filename, const Metainfo* metainfo, GError** error)
 {
   gchar tempfile[] = "/tmp/metainfo-XXXXXX";
-  int fd = mkstemp(tempfile);
-  if (fd < 0)
-    return; // error
-
-  FILE* f = fdopen(fd, "w");
-  g_datalist_foreach(&metainfo, print_metainfo, f);
-  fclose(f);
+  if (!write_metainfo_file(tempfile, metainfo, print_metainfo, error))
+    return FALSE;
 
-  gchar* cmdline;
-  {
-    gchar* qf = g_shell_quote(filename);
+  gchar* output = g_strdup_printf("%s.metainfo-new", filename);
+  const gchar* argv[] = { "pdftk", filename, "update_info", tempfile, "output", output, NULL };
 
-    gchar* cmd = g_strdup_printf("set-meta %s; save", tempfile);
-    gchar* qc = g_shell_quote(cmd);
-    g_free(cmd);
-    
-    // "pdftk %s update_info %s output %s", filename, tempfile, new
-    cmdline = g_strdup_printf("djvused %s -e %s", qf, qc);
-    g_free(qf);
-    g_free(qc);
-  }
-
-  system(cmdline);
+  gboolean result = spawn_and_wait(argv, spawn_default_limits(), error);
+  if (result && rename(output, filename) < 0)
+    {
+      int saved_errno = errno;
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+		  "%s: %s", filename, g_strerror(saved_errno));
+      result = FALSE;
+    }
+  if (!result)
+    unlink(output);
 
-    /*
-    os.unlink(filename)
-    os.rename(new, filename)
-    */
+  g_free(output);
+  unlink(tempfile);
+  return result;
 }
 
-PluginInterface pdf_interface =
+static const gchar* const s_mime_types[] = {
+  "application/pdf",
+  NULL
+};
+
+static const PluginInterface pdf_interface =
 {
+  TAGFS_PLUGIN_ABI_VERSION,
+  "pdf",
+  2,
+  PLUGIN_CAP_FD | PLUGIN_CAP_THREAD_SAFE | PLUGIN_CAP_REGIONS,
+  s_mime_types,
   pdf_check_file,
   pdf_get_metainfo,
-  pdf_set_metainfo
+  pdf_set_metainfo,
+  pdf_get_metainfo_fd,
+  PDF_REGION_SIZE,
+  PDF_REGION_SIZE,
+  pdf_get_metainfo_regions
 };
+
+const PluginInterface* tagfs_plugin_interface(void)
+{
+  return &pdf_interface;
+}
+
+void tagfs_plugin_set_trace_sink(trace_sink_t sink)
+{
+  trace_sink = sink;
+}
@@ -0,0 +1,334 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#include <gmodule.h>
+
+#include "plugins.h"
+#include "coproc.h"
+#include "excache.h"
+#include "trace.h"
+
+static GPtrArray* s_modules = NULL;
+static GPtrArray* s_plugins = NULL;
+static GHashTable* s_by_mime = NULL; /* mime -> GSList of plugins */
+static CoprocPool* s_helpers = NULL;
+
+static gboolean register_plugin(const PluginInterface* plugin, const gchar* filename)
+{
+  if (plugin == NULL)
+    return FALSE;
+
+  if (plugin->abi_version != TAGFS_PLUGIN_ABI_VERSION)
+    {
+      g_warning("%s: plugin ABI version %u, expected %u",
+		filename, plugin->abi_version, TAGFS_PLUGIN_ABI_VERSION);
+      return FALSE;
+    }
+
+  if (plugin->get_metainfo == NULL)
+    {
+      g_warning("%s: plugin has no get_metainfo", filename);
+      return FALSE;
+    }
+
+  g_ptr_array_add(s_plugins, (gpointer)plugin);
+
+  if (plugin->mime_types != NULL)
+    {
+      const gchar* const* mime;
+      for (mime = plugin->mime_types; *mime != NULL; ++mime)
+	{
+	  GSList* list = g_hash_table_lookup(s_by_mime, *mime);
+	  list = g_slist_append(list, (gpointer)plugin);
+	  g_hash_table_insert(s_by_mime, (gpointer)*mime, list);
+	}
+    }
+  return TRUE;
+}
+
+static void load_module(const gchar* filename)
+{
+  GModule* module = g_module_open(filename, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+  if (module == NULL)
+    {
+      g_warning("%s", g_module_error());
+      return;
+    }
+
+  PluginEntry entry = NULL;
+  if (!g_module_symbol(module, TAGFS_PLUGIN_ENTRY, (gpointer*)&entry) || entry == NULL)
+    {
+      g_warning("%s: no %s symbol", filename, TAGFS_PLUGIN_ENTRY);
+      g_module_close(module);
+      return;
+    }
+
+  if (!register_plugin(entry(), filename))
+    {
+      g_module_close(module);
+      return;
+    }
+
+  /* optional: spans recorded inside the plugin */
+  PluginTraceEntry set_trace_sink = NULL;
+  if (g_module_symbol(module, TAGFS_PLUGIN_TRACE_ENTRY, (gpointer*)&set_trace_sink) && set_trace_sink != NULL)
+    set_trace_sink(trace_sink);
+
+  g_ptr_array_add(s_modules, module);
+}
+
+static void load_dir(const gchar* dirname)
+{
+  GDir* dir = g_dir_open(dirname, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  const gchar* name;
+  while ((name = g_dir_read_name(dir)) != NULL)
+    {
+      if (!g_str_has_suffix(name, "." G_MODULE_SUFFIX))
+	continue;
+
+      gchar* filename = g_build_filename(dirname, name, NULL);
+      load_module(filename);
+      g_free(filename);
+    }
+  g_dir_close(dir);
+}
+
+static void free_mime_list(gpointer data)
+{
+  g_slist_free((GSList*)data);
+}
+
+guint plugins_load(void)
+{
+  if (s_plugins != NULL)
+    return s_plugins->len;
+
+  s_modules = g_ptr_array_new();
+  s_plugins = g_ptr_array_new();
+  s_by_mime = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_mime_list);
+
+  const gchar* path = g_getenv("TAGFS_PLUGIN_PATH");
+  if (path == NULL || *path == '\0')
+    path = PLUGINDIR;
+
+  gchar** dirs = g_strsplit(path, G_SEARCHPATH_SEPARATOR_S, 0);
+  gchar** dir;
+  for (dir = dirs; *dir != NULL; ++dir)
+    if (**dir != '\0')
+      load_dir(*dir);
+  g_strfreev(dirs);
+
+  return s_plugins->len;
+}
+
+void plugins_unload(void)
+{
+  if (s_plugins == NULL)
+    return;
+
+  coproc_pool_free(s_helpers);
+  s_helpers = NULL;
+
+  g_hash_table_destroy(s_by_mime);
+  g_ptr_array_free(s_plugins, TRUE);
+
+  guint i;
+  for (i = 0; i < s_modules->len; ++i)
+    g_module_close(g_ptr_array_index(s_modules, i));
+  g_ptr_array_free(s_modules, TRUE);
+
+  s_by_mime = NULL;
+  s_plugins = NULL;
+  s_modules = NULL;
+
+  excache_close();
+}
+
+const PluginInterface* plugins_find(const gchar* filename, const gchar* mime)
+{
+  if (s_plugins == NULL || mime == NULL)
+    return NULL;
+
+  GSList* list;
+  for (list = g_hash_table_lookup(s_by_mime, mime); list != NULL; list = list->next)
+    {
+      const PluginInterface* plugin = list->data;
+      if (plugin->check_file == NULL || plugin->check_file(filename, mime))
+	return plugin;
+    }
+
+  /* plugins without a mime table can only be probed */
+  guint i;
+  for (i = 0; i < s_plugins->len; ++i)
+    {
+      const PluginInterface* plugin = g_ptr_array_index(s_plugins, i);
+      if (plugin->mime_types == NULL
+	  && plugin->check_file != NULL
+	  && plugin->check_file(filename, mime))
+	return plugin;
+    }
+
+  return NULL;
+}
+
+const PluginInterface* plugins_find_name(const gchar* name)
+{
+  guint i;
+  for (i = 0; s_plugins != NULL && i < s_plugins->len; ++i)
+    {
+      const PluginInterface* plugin = g_ptr_array_index(s_plugins, i);
+      if (strcmp(plugin->name, name) == 0)
+	return plugin;
+    }
+  return NULL;
+}
+
+void plugins_start_helpers(void)
+{
+  if (s_plugins == NULL || s_helpers != NULL)
+    return;
+
+  const gchar* helper = g_getenv("TAGFS_HELPER");
+  if (helper == NULL)
+    helper = HELPER;
+  if (*helper == '\0')
+    return;
+  if (!g_file_test(helper, G_FILE_TEST_IS_EXECUTABLE))
+    {
+      g_warning("%s: not executable, extracting in process", helper);
+      return;
+    }
+
+  const gchar* size = g_getenv("TAGFS_HELPER_POOL_SIZE");
+  const gchar* timeout = g_getenv("TAGFS_HELPER_TIMEOUT");
+  const gchar* argv[] = { helper, NULL };
+  s_helpers = coproc_pool_new(argv,
+			      size != NULL ? strtoul(size, NULL, 10) : g_get_num_processors(),
+			      timeout != NULL ? strtoul(timeout, NULL, 10) : 120000);
+}
+
+static void read_pair(void* user_data, gchar* line)
+{
+  gchar* tab = strchr(line, '\t');
+  if (tab == NULL)
+    return;
+  *tab = '\0';
+  gchar* key = g_strcompress(line);
+  gchar* value = g_strcompress(tab + 1);
+  metainfo_set((Metainfo*)user_data, key, value);
+  g_free(key);
+  g_free(value);
+}
+
+/* by a helper, see tagfs-extract.c */
+static Metainfo* extract_by_helper(const PluginInterface* plugin, const gchar* filename, GError** error)
+{
+  gchar* path = g_strescape(filename, NULL);
+  gchar* request = g_strdup_printf("%s\t%s", plugin->name, path);
+  Metainfo* result = metainfo_new();
+  if (!coproc_pool_request(s_helpers, request, read_pair, result, error))
+    {
+      metainfo_free(result);
+      result = NULL;
+    }
+  g_free(request);
+  g_free(path);
+  return result;
+}
+
+/* fd is the caller's open descriptor of filename, or -1 */
+static Metainfo* extract(const PluginInterface* plugin, int fd, const gchar* filename, GError** error)
+{
+  if ((plugin->capabilities & PLUGIN_CAP_FD) && plugin->get_metainfo_fd != NULL)
+    {
+      int own = fd < 0 ? open(filename, O_RDONLY | O_CLOEXEC) : -1;
+      if (fd >= 0 || own >= 0)
+	{
+	  Metainfo* result = plugin->get_metainfo_fd(fd >= 0 ? fd : own, filename, error);
+	  if (own >= 0)
+	    close(own);
+	  return result;
+	}
+    }
+
+  return plugin->get_metainfo(filename, error);
+}
+
+static Metainfo* get_metainfo(const PluginInterface* plugin, int fd, const gchar* filename, GError** error)
+{
+  excache_key_t key;
+  gboolean cacheable = excache_fingerprint(filename, &key);
+  if (cacheable)
+    {
+      Metainfo* cached = excache_lookup(&key, plugin);
+      if (cached != NULL)
+	return cached;
+    }
+
+  Metainfo* result = s_helpers != NULL
+    ? extract_by_helper(plugin, filename, error)
+    : extract(plugin, fd, filename, error);
+  if (cacheable && result != NULL)
+    excache_store(&key, plugin, result);
+  return result;
+}
+
+Metainfo* plugins_get_metainfo(const PluginInterface* plugin, const gchar* filename, GError** error)
+{
+  return get_metainfo(plugin, -1, filename, error);
+}
+
+gboolean plugins_set_metainfo(const PluginInterface* plugin, const gchar* filename,
+			      const Metainfo* metainfo, GError** error)
+{
+  if (!plugin->set_metainfo(filename, metainfo, error))
+    return FALSE;
+
+  excache_key_t key;
+  if (excache_fingerprint(filename, &key))
+    excache_forget(&key, plugin);
+  return TRUE;
+}
+
+void plugins_region_sizes(gsize* header_size, gsize* trailer_size)
+{
+  *header_size = 0;
+  *trailer_size = 0;
+  guint i;
+  for (i = 0; s_plugins != NULL && i < s_plugins->len; ++i)
+    {
+      const PluginInterface* plugin = g_ptr_array_index(s_plugins, i);
+      if (plugin->capabilities & PLUGIN_CAP_REGIONS)
+	{
+	  *header_size = MAX(*header_size, plugin->header_size);
+	  *trailer_size = MAX(*trailer_size, plugin->trailer_size);
+	}
+    }
+}
+
+Metainfo* plugins_get_metainfo_regions(const PluginInterface* plugin,
+				       const PluginRegions* regions,
+				       int fd,
+				       const gchar* filename,
+				       GError** error)
+{
+  if (regions != NULL && (plugin->capabilities & PLUGIN_CAP_REGIONS) && plugin->get_metainfo_regions != NULL)
+    {
+      GError* local_error = NULL;
+      Metainfo* result = plugin->get_metainfo_regions(regions, filename, &local_error);
+      if (result != NULL)
+	return result;
+      if (local_error != NULL)
+	{
+	  g_propagate_error(error, local_error);
+	  return NULL;
+	}
+    }
+
+  return get_metainfo(plugin, fd, filename, error);
+}
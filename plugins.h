@@ -0,0 +1,55 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include <glib.h>
+
+#include "plugin_interface.h"
+
+#ifndef PLUGINDIR
+#define PLUGINDIR "/usr/lib/tagfs/plugins"
+#endif
+#ifndef HELPER
+#define HELPER "/usr/lib/tagfs/tagfs-extract"
+#endif
+
+/* Loads every plugin from $TAGFS_PLUGIN_PATH (colon-separated) or PLUGINDIR. */
+guint plugins_load(void);
+void plugins_unload(void);
+
+/* the largest regions any loaded plugin asks for */
+void plugins_region_sizes(gsize* header_size, gsize* trailer_size);
+
+const PluginInterface* plugins_find(const gchar* filename, const gchar* mime);
+/* NULL if no plugin of that name is loaded */
+const PluginInterface* plugins_find_name(const gchar* name);
+
+/*
+ * From now on plugins_get_metainfo extracts in a pool of tagfs-extract
+ * processes ($TAGFS_HELPER, by default HELPER), so that a plugin that
+ * crashes or hangs on a file takes down a helper only, while helpers
+ * start once rather than once per file. TAGFS_HELPER_POOL_SIZE (number
+ * of processors) and TAGFS_HELPER_TIMEOUT (ms per file, 120000) size
+ * it; an empty TAGFS_HELPER keeps extraction in process. Stopped by
+ * plugins_unload.
+ */
+void plugins_start_helpers(void);
+
+Metainfo* plugins_get_metainfo(const PluginInterface* plugin, const gchar* filename, GError** error);
+/*
+ * Through the plugin. A cached extraction of the new contents is
+ * dropped: an edit may keep the size and every sampled block.
+ */
+gboolean plugins_set_metainfo(const PluginInterface* plugin, const gchar* filename,
+			      const Metainfo* metainfo, GError** error);
+
+/*
+ * In process from prefetched regions when the plugin can, else as above
+ * but through fd, the caller's open descriptor of filename, if not -1.
+ */
+Metainfo* plugins_get_metainfo_regions(const PluginInterface* plugin,
+				       const PluginRegions* regions,
+				       int fd,
+				       const gchar* filename,
+				       GError** error);
+
+#endif
@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "prefetch.h"
+
+typedef enum
+{
+  REQUEST_OPEN,
+  REQUEST_HEADER,
+  REQUEST_TRAILER
+} request_kind_t;
+
+typedef struct tagRequest
+{
+  prefetch_item_t* item;
+  request_kind_t kind;
+} request_t;
+
+void prefetch_item_init(prefetch_item_t* item, const gchar* path, const gchar* name)
+{
+  memset(item, 0, sizeof(*item));
+  item->path = g_strdup(path);
+  item->name = g_strdup(name);
+  item->fd = -1;
+}
+
+void prefetch_item_clear(prefetch_item_t* item)
+{
+  if (item->fd >= 0)
+    close(item->fd);
+  g_free(item->buffer);
+  g_free(item->path);
+  g_free(item->name);
+  memset(item, 0, sizeof(*item));
+  item->fd = -1;
+}
+
+/* sizes the regions of an opened file, returns the number of reads */
+static guint layout(prefetch_item_t* item, gsize header_size, gsize trailer_size)
+{
+  struct stat st;
+  if (fstat(item->fd, &st) == -1)
+    {
+      item->error = errno;
+      return 0;
+    }
+
+  item->mtime = st.st_mtim;
+  PluginRegions* r = &item->regions;
+  guint64 size = st.st_size;
+  r->file_size = size;
+  if (size <= header_size + trailer_size)
+    {
+      /* one read covers both */
+      item->buffer = g_malloc(MAX(size, 1));
+      r->header = item->buffer;
+      r->header_size = size;
+      r->trailer_size = MIN(size, trailer_size);
+      r->trailer = item->buffer + size - r->trailer_size;
+      return size > 0 ? 1 : 0;
+    }
+
+  item->buffer = g_malloc(header_size + trailer_size);
+  r->header = item->buffer;
+  r->header_size = header_size;
+  r->trailer = item->buffer + header_size;
+  r->trailer_size = trailer_size;
+  return 2;
+}
+
+static gboolean separate_trailer(const prefetch_item_t* item)
+{
+  return item->regions.trailer_size > 0
+    && item->regions.trailer == item->buffer + item->regions.header_size;
+}
+
+/*
+ * A short read means the file shrank since the stat: the regions no
+ * longer end at file_size, so the file is extracted from its path like
+ * an unreadable one.
+ */
+static void complete_read(prefetch_item_t* item, request_kind_t kind, gssize result)
+{
+  gsize wanted = kind == REQUEST_HEADER ? item->regions.header_size : item->regions.trailer_size;
+  if (result < 0)
+    item->error = -result;
+  else if ((gsize)result < wanted && item->error == 0)
+    item->error = EAGAIN;
+}
+
+static void fallback_batch(prefetch_item_t* items, guint count, gsize header_size, gsize trailer_size)
+{
+  guint i;
+  /* queue every read in the kernel first... */
+  for (i = 0; i < count; ++i)
+    {
+      prefetch_item_t* item = &items[i];
+      item->fd = open(item->path, O_RDONLY | O_CLOEXEC);
+      if (item->fd == -1)
+	{
+	  item->error = errno;
+	  continue;
+	}
+      if (layout(item, header_size, trailer_size) == 0)
+	continue;
+      posix_fadvise(item->fd, 0, item->regions.header_size, POSIX_FADV_WILLNEED);
+      if (separate_trailer(item))
+	posix_fadvise(item->fd, item->regions.file_size - item->regions.trailer_size,
+		      item->regions.trailer_size, POSIX_FADV_WILLNEED);
+    }
+
+  /* ...then collect them in order */
+  for (i = 0; i < count; ++i)
+    {
+      prefetch_item_t* item = &items[i];
+      PluginRegions* r = &item->regions;
+      if (item->error != 0 || item->buffer == NULL)
+	continue;
+      ssize_t n = pread(item->fd, item->buffer, r->header_size, 0);
+      complete_read(item, REQUEST_HEADER, n == -1 ? -errno : n);
+      if (item->error == 0 && separate_trailer(item))
+	{
+	  n = pread(item->fd, item->buffer + r->header_size, r->trailer_size,
+		    r->file_size - r->trailer_size);
+	  complete_read(item, REQUEST_TRAILER, n == -1 ? -errno : n);
+	}
+    }
+}
+
+#ifdef HAVE_LIBURING
+
+#define RING_ENTRIES 128
+
+static void close_ring(gpointer data)
+{
+  io_uring_queue_exit(data);
+  g_free(data);
+}
+
+/* one ring per scanning thread */
+static GPrivate s_ring = G_PRIVATE_INIT(close_ring);
+static gint s_uring_unavailable = 0;
+
+/* kernels before 5.6 have io_uring but not these */
+static gboolean supports_ops(struct io_uring* ring)
+{
+  struct io_uring_probe* probe = io_uring_get_probe_ring(ring);
+  gboolean result = probe != NULL
+    && io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+    && io_uring_opcode_supported(probe, IORING_OP_READ);
+  if (probe != NULL)
+    io_uring_free_probe(probe);
+  return result;
+}
+
+static struct io_uring* get_ring(void)
+{
+  if (g_atomic_int_get(&s_uring_unavailable))
+    return NULL;
+
+  struct io_uring* ring = g_private_get(&s_ring);
+  if (ring == NULL)
+    {
+      ring = g_new0(struct io_uring, 1);
+      /* old kernels, or forbidden by seccomp */
+      if (io_uring_queue_init(RING_ENTRIES, ring, 0) < 0)
+	{
+	  g_free(ring);
+	  g_atomic_int_set(&s_uring_unavailable, 1);
+	  return NULL;
+	}
+      if (!supports_ops(ring))
+	{
+	  close_ring(ring);
+	  g_atomic_int_set(&s_uring_unavailable, 1);
+	  return NULL;
+	}
+      g_private_set(&s_ring, ring);
+    }
+  return ring;
+}
+
+static void prep(struct io_uring_sqe* sqe, const request_t* request)
+{
+  prefetch_item_t* item = request->item;
+  PluginRegions* r = &item->regions;
+  switch (request->kind)
+    {
+    case REQUEST_OPEN:
+      io_uring_prep_openat(sqe, AT_FDCWD, item->path, O_RDONLY | O_CLOEXEC, 0);
+      break;
+    case REQUEST_HEADER:
+      io_uring_prep_read(sqe, item->fd, item->buffer, r->header_size, 0);
+      break;
+    case REQUEST_TRAILER:
+      io_uring_prep_read(sqe, item->fd, item->buffer + r->header_size, r->trailer_size,
+			 r->file_size - r->trailer_size);
+      break;
+    }
+}
+
+static void complete(const request_t* request, gint result)
+{
+  prefetch_item_t* item = request->item;
+  if (request->kind != REQUEST_OPEN)
+    complete_read(item, request->kind, result);
+  else if (result < 0)
+    item->error = -result;
+  else
+    item->fd = result;
+}
+
+/*
+ * Keeps up to RING_ENTRIES requests in flight until all completed.
+ * FALSE when the ring failed: requests submitted before are waited for,
+ * the others never run and the ring must not be used again.
+ */
+static gboolean run_requests(struct io_uring* ring, const request_t* requests, guint count)
+{
+  guint next = 0;
+  guint inflight = 0;
+  while (next < count || inflight > 0)
+    {
+      guint submitted = inflight;
+      struct io_uring_sqe* sqe;
+      while (next < count && (sqe = io_uring_get_sqe(ring)) != NULL)
+	{
+	  prep(sqe, &requests[next]);
+	  io_uring_sqe_set_data(sqe, (gpointer)&requests[next]);
+	  ++next;
+	  ++inflight;
+	}
+
+      int result = io_uring_submit_and_wait(ring, 1);
+      if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+	{
+	  /* their buffers go away with the batch */
+	  struct io_uring_cqe* cqe;
+	  while (submitted > 0 && io_uring_wait_cqe(ring, &cqe) == 0)
+	    {
+	      io_uring_cqe_seen(ring, cqe);
+	      --submitted;
+	    }
+	  return FALSE;
+	}
+
+      struct io_uring_cqe* cqe;
+      unsigned head;
+      unsigned seen = 0;
+      io_uring_for_each_cqe(ring, head, cqe)
+	{
+	  complete(io_uring_cqe_get_data(cqe), cqe->res);
+	  ++seen;
+	}
+      io_uring_cq_advance(ring, seen);
+      inflight -= seen;
+    }
+  return TRUE;
+}
+
+/* back to the state before the batch, for fallback_batch */
+static void reset_item(prefetch_item_t* item)
+{
+  if (item->fd >= 0)
+    close(item->fd);
+  g_free(item->buffer);
+  item->fd = -1;
+  item->buffer = NULL;
+  item->error = 0;
+  memset(&item->regions, 0, sizeof(item->regions));
+}
+
+static gboolean uring_batch(prefetch_item_t* items, guint count, gsize header_size, gsize trailer_size)
+{
+  struct io_uring* ring = get_ring();
+  if (ring == NULL)
+    return FALSE;
+
+  request_t* requests = g_new(request_t, 2 * count);
+  guint i;
+  for (i = 0; i < count; ++i)
+    {
+      requests[i].item = &items[i];
+      requests[i].kind = REQUEST_OPEN;
+    }
+  gboolean result = run_requests(ring, requests, count);
+
+  guint n = 0;
+  for (i = 0; i < count && result; ++i)
+    {
+      prefetch_item_t* item = &items[i];
+      if (item->error != 0 || layout(item, header_size, trailer_size) == 0)
+	continue;
+      requests[n].item = item;
+      requests[n++].kind = REQUEST_HEADER;
+      if (separate_trailer(item))
+	{
+	  requests[n].item = item;
+	  requests[n++].kind = REQUEST_TRAILER;
+	}
+    }
+  result = result && run_requests(ring, requests, n);
+  g_free(requests);
+
+  if (!result)
+    {
+      g_warning("io_uring failed, reading with pread from now on");
+      g_private_replace(&s_ring, NULL);
+      g_atomic_int_set(&s_uring_unavailable, 1);
+      for (i = 0; i < count; ++i)
+	reset_item(&items[i]);
+    }
+  return result;
+}
+
+#endif /* HAVE_LIBURING */
+
+void prefetch_batch(prefetch_item_t* items, guint count, gsize header_size, gsize trailer_size)
+{
+#ifdef HAVE_LIBURING
+  if (!uring_batch(items, count, header_size, trailer_size))
+#endif
+    fallback_batch(items, count, header_size, trailer_size);
+}
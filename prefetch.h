@@ -0,0 +1,32 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <time.h>
+#include <glib.h>
+
+#include "plugin_interface.h"
+
+/*
+ * Reads the first and last bytes of a batch of files with many requests
+ * in flight: through io_uring when built with HAVE_LIBURING and the
+ * kernel allows it, else with readahead hints followed by pread.
+ */
+
+typedef struct tagPrefetchItem
+{
+  gchar* path;
+  gchar* name;
+  gint error;           /* errno of open, stat or read, or 0 */
+  struct timespec mtime; /* as of the reads */
+  PluginRegions regions;
+  gint fd;              /* open until prefetch_item_clear, or -1 */
+  /* private */
+  guchar* buffer;
+} prefetch_item_t;
+
+void prefetch_item_init(prefetch_item_t* item, const gchar* path, const gchar* name);
+void prefetch_item_clear(prefetch_item_t* item);
+
+void prefetch_batch(prefetch_item_t* items, guint count, gsize header_size, gsize trailer_size);
+
+#endif
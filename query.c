@@ -0,0 +1,173 @@
+#include <string.h>
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <sqlite3.h>
+
+#include "query.h"
+#include "index.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define MAXDIGITS 15
+
+void query_begin(void)
+{
+  snapshot_pin();
+  if (!snapshot_is_open())
+    index_lock();
+}
+
+void query_end(void)
+{
+  if (!snapshot_is_open())
+    index_unlock();
+  snapshot_unpin();
+}
+
+guint64 query_generation(void)
+{
+  /* snapshot generations count apart from index changes */
+  guint serial = snapshot_generation();
+  return serial != 0 ? (guint64)serial << 32 : index_generation();
+}
+
+/* attr is a copy of ours, it is folded in place */
+static gint find_attr_id(gchar* attr)
+{
+  gchar* p;
+  for (p = attr; *p != '\0' && !(*p & 0x80); ++p)
+    *p = g_ascii_tolower(*p);
+  /* the rare names beyond ASCII are folded the way they were stored */
+  gchar* folded = *p != '\0' ? g_utf8_strdown(attr, -1) : NULL;
+  const gchar* name = folded != NULL ? folded : attr;
+  gint result = snapshot_is_open() ? snapshot_find_attr_id(name) : index_find_attr_id(name);
+  g_free(folded);
+  return result;
+}
+
+static gint find_attr_value_id(const gchar* value)
+{
+  return snapshot_is_open() ? snapshot_find_attr_value_id(value) : index_find_attr_value_id(value);
+}
+
+/* the component at *p into buf, *p moves past it; FALSE if it is too long */
+static gboolean next_component(const gchar** p, gchar* buf)
+{
+  const gchar* end = strchr(*p, '/');
+  if (end == NULL)
+    end = *p + strlen(*p);
+  gsize length = end - *p;
+  if (length <= PATH_MAX_NAME)
+    {
+      memcpy(buf, *p, length);
+      buf[length] = '\0';
+    }
+  *p = *end == '/' ? end + 1 : end;
+  return length <= PATH_MAX_NAME;
+}
+
+gboolean split_path(const gchar* path, path_t* sp)
+{
+  gchar component[PATH_MAX_NAME + 1];
+  const gchar* p = path + 1; /* skip leading '/' */
+
+  sp->attr_id = 0;
+  sp->value_count = 0;
+  sp->tail = NULL;
+  if (*p == '\0') /* root */
+    return TRUE;
+
+  if (!next_component(&p, component))
+    return FALSE;
+  sp->attr_id = find_attr_id(component);
+  if (sp->attr_id == 0)
+    return FALSE;
+
+  while (*p != '\0')
+    {
+      const gchar* start = p;
+      if (*p == '/') /* empty component */
+	{
+	  ++p;
+	  continue;
+	}
+
+      gint value_id = next_component(&p, component) ? find_attr_value_id(component) : 0;
+      if (value_id == 0)
+	{
+	  sp->tail = start;
+	  break;
+	}
+      if (sp->value_count == PATH_MAX_VALUES)
+	return FALSE;
+      sp->value_ids[sp->value_count++] = value_id;
+    }
+  return TRUE;
+}
+
+gchar* get_ids_string(const path_t* sp)
+{
+  gchar* ids = g_malloc(sp->value_count * (MAXDIGITS + 1) + 1);
+  if (sp->value_count != 0)
+    {
+      gchar* ptr = ids;
+      guint i;
+      for (i = 0; i < sp->value_count; ++i)
+	ptr += g_sprintf(ptr, "%d,", sp->value_ids[i]);
+      ptr[-1] = '\0'; /* remove last ',' */
+    }
+  else
+    *ids = '\0';
+
+  return ids;
+}
+
+gsize find_realpath(const char *path, gchar* buf, gsize size, gboolean* error)
+{
+  path_t sp;
+  if (!split_path(path, &sp))
+    {
+      if (error) *error = TRUE;
+      return 0;
+    }
+
+  if (sp.attr_id == 0 || sp.tail == NULL)
+    return 0;
+
+  if (snapshot_is_open())
+    {
+      const gchar* realpath = snapshot_find_file(sp.attr_id, sp.value_ids, sp.value_count, sp.tail);
+      return realpath != NULL ? g_strlcpy(buf, realpath, size) : 0;
+    }
+
+  /* one statement per value rather than an "in" list, so both are prepared once */
+  sqlite3_stmt *statement = sp.value_count != 0
+    ? index_cached_statement("select file.dir_id, file.name from link, file where "
+			     "link.file_id = file.id "
+			     "and link.attr_id = ? "
+			     "and file.name = ? "
+			     "and link.value_id = ?")
+    : index_cached_statement("select file.dir_id, file.name from link, file where "
+			     "link.file_id = file.id "
+			     "and link.attr_id = ? "
+			     "and file.name = ?");
+
+  gsize length = 0;
+  guint64 start = stats_now();
+  guint i = 0;
+  do
+    {
+      sqlite3_bind_int(statement, 1, sp.attr_id);
+      sqlite3_bind_text(statement, 2, sp.tail, -1, SQLITE_STATIC);
+      if (sp.value_count != 0)
+	sqlite3_bind_int(statement, 3, sp.value_ids[i]);
+      if (sqlite3_step(statement) == SQLITE_ROW)
+	length = index_copy_file_path(sqlite3_column_int(statement, 0),
+				      (const gchar*)sqlite3_column_text(statement, 1), buf, size);
+      sqlite3_reset(statement);
+    }
+  while (length == 0 && ++i < sp.value_count);
+  stats_record(STAT_SQL_REALPATH, start);
+
+  return length;
+}
@@ -0,0 +1,46 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <glib.h>
+
+/*
+ * Translation of mount paths to index queries. A path is
+ * /attr/value.../name: value_ids are the leading components that are
+ * known values, tail is the rest. Callers bracket lookups with
+ * query_begin()/query_end(). split_path and find_realpath do not
+ * allocate.
+ */
+
+#define PATH_MAX_VALUES 64  /* deeper paths are unknown */
+#define PATH_MAX_NAME 1024  /* FUSE_NAME_MAX, longer components are unknown */
+
+typedef struct tagPath
+{
+  gint attr_id;       /* 0 for the root */
+  guint value_count;
+  gint value_ids[PATH_MAX_VALUES];
+  const gchar* tail;  /* the rest of the parsed path, or NULL */
+} path_t;
+
+/*
+ * Pins the current snapshot generation if one is published, which
+ * takes no lock, else takes the index lock.
+ */
+void query_begin(void);
+void query_end(void);
+/* identifies what lookups between them see; equal means equal results */
+guint64 query_generation(void);
+
+/* FALSE if the attribute is unknown; sp points into path */
+gboolean split_path(const gchar* path, path_t* sp);
+
+/* "1,2,3" */
+gchar* get_ids_string(const path_t* sp);
+
+/*
+ * Copies the file behind a path to buf as g_strlcpy does and returns
+ * its length, 0 for directories; *error is set for unknown paths.
+ */
+gsize find_realpath(const char *path, gchar* buf, gsize size, gboolean* error);
+
+#endif
@@ -0,0 +1,220 @@
+#include <glib.h>
+#include <magic.h>
+
+#include "scan.h"
+#include "walk.h"
+#include "prefetch.h"
+#include "index.h"
+#include "plugins.h"
+#include "stats.h"
+#include "trace.h"
+
+/* files read ahead together, and the least libmagic gets to look at */
+#define SCAN_BATCH 64
+#define SNIFF_SIZE 65536
+
+/* a directory whose files are not all committed yet */
+typedef struct tagDirProgress
+{
+  gchar* path;
+  gint refs;          /* the walker, until it leaves, and every queued file */
+} dir_progress_t;
+
+typedef struct tagScan
+{
+  magic_t* magic;     /* per worker, 0 is the caller's */
+  GArray** pending;   /* per worker, of prefetch_item_t */
+  GPtrArray** dirs;   /* per worker, dir_progress_t of every pending file */
+  dir_progress_t** current; /* per worker, the directory being listed */
+  gboolean resume;
+  gsize header_size;
+  gsize trailer_size;
+} scan_t;
+
+/* plugins not declaring PLUGIN_CAP_THREAD_SAFE run one at a time */
+G_LOCK_DEFINE_STATIC(unsafe_plugins);
+
+static magic_t worker_magic(scan_t* scan, guint worker)
+{
+  /* libmagic handles are not thread-safe: one per worker */
+  if (scan->magic[worker] == NULL)
+    {
+      magic_t magic = magic_open(MAGIC_MIME_TYPE);
+      g_assert(magic != NULL);
+
+      int magic_load_result = magic_load(magic, NULL);
+      g_assert(magic_load_result == 0);
+
+      scan->magic[worker] = magic;
+    }
+  return scan->magic[worker];
+}
+
+/* the last reference checkpoints the directory */
+static void dir_unref(dir_progress_t* dir)
+{
+  if (!g_atomic_int_dec_and_test(&dir->refs))
+    return;
+  index_scan_mark_dir(dir->path);
+  g_free(dir->path);
+  g_slice_free(dir_progress_t, dir);
+}
+
+static Metainfo* get_attrs(magic_t magic, const prefetch_item_t* item)
+{
+  Metainfo* metainfo = NULL;
+  /* unreadable files get the old treatment, for the same result */
+  const PluginRegions* regions = item->error == 0 ? &item->regions : NULL;
+
+  guint64 span = trace_begin();
+  guint64 start = stats_now();
+  const gchar* mime = regions != NULL
+    ? magic_buffer(magic, regions->header, regions->header_size)
+    : magic_file(magic, item->path);
+  stats_record(STAT_MAGIC, start);
+  trace_end("magic", "scan", span);
+
+  const PluginInterface* plugin = plugins_find(item->path, mime);
+  if (plugin != NULL)
+    {
+      gboolean thread_safe = (plugin->capabilities & PLUGIN_CAP_THREAD_SAFE) != 0;
+      if (!thread_safe)
+	G_LOCK(unsafe_plugins);
+      span = trace_begin();
+      start = stats_now();
+      metainfo = plugins_get_metainfo_regions(plugin, regions, regions != NULL ? item->fd : -1, item->path, NULL);
+      stats_record(STAT_EXTRACT, start);
+      trace_end("extract", "scan", span);
+      if (!thread_safe)
+	G_UNLOCK(unsafe_plugins);
+      // print error??
+    }
+  return metainfo;
+}
+
+/* extracts a batch, then commits it in one transaction */
+static void flush(scan_t* scan, guint worker)
+{
+  GArray* pending = scan->pending[worker];
+  GPtrArray* dirs = scan->dirs[worker];
+  if (pending->len == 0)
+    return;
+
+  guint64 span = trace_begin();
+  guint64 start = stats_now();
+  prefetch_batch((prefetch_item_t*)pending->data, pending->len, scan->header_size, scan->trailer_size);
+  stats_record(STAT_PREFETCH, start);
+  trace_end("prefetch", "scan", span);
+
+  Metainfo** metainfo = g_new(Metainfo*, pending->len);
+  guint i;
+  for (i = 0; i < pending->len; ++i)
+    metainfo[i] = get_attrs(worker_magic(scan, worker), &g_array_index(pending, prefetch_item_t, i));
+
+  span = trace_begin();
+  index_begin();
+  for (i = 0; i < pending->len; ++i)
+    {
+      prefetch_item_t* item = &g_array_index(pending, prefetch_item_t, i);
+      /* unreadable files are stored as never current */
+      if (item->error == 0)
+	index_add_file(item->name, item->path, metainfo[i], index_mtime(&item->mtime), item->regions.file_size);
+      else
+	index_add_file(item->name, item->path, metainfo[i], 0, -1);
+      metainfo_free(metainfo[i]);
+      prefetch_item_clear(item);
+      dir_unref(g_ptr_array_index(dirs, i));
+    }
+  index_commit();
+  trace_end("index", "scan", span);
+
+  g_free(metainfo);
+  g_array_set_size(pending, 0);
+  g_ptr_array_set_size(dirs, 0);
+}
+
+static gboolean enter_dir(const gchar* path, guint worker, gpointer user_data)
+{
+  scan_t* scan = user_data;
+  if (scan->resume && index_scan_dir_done(path))
+    return FALSE;
+
+  dir_progress_t* dir = g_slice_new(dir_progress_t);
+  dir->path = g_strdup(path);
+  dir->refs = 1;
+  scan->current[worker] = dir;
+  return TRUE;
+}
+
+static void leave_dir(const gchar* path, guint worker, gpointer user_data)
+{
+  scan_t* scan = user_data;
+  if (scan->current[worker] != NULL)
+    dir_unref(scan->current[worker]);
+  scan->current[worker] = NULL;
+}
+
+static void queue_file(const char* path, const char* name, guint worker, gpointer user_data)
+{
+  scan_t* scan = user_data;
+  /* committed before the scan stopped */
+  if (scan->resume && index_has_file(path))
+    return;
+
+  GArray* pending = scan->pending[worker];
+  g_array_set_size(pending, pending->len + 1);
+  prefetch_item_init(&g_array_index(pending, prefetch_item_t, pending->len - 1), path, name);
+
+  dir_progress_t* dir = scan->current[worker];
+  g_atomic_int_inc(&dir->refs);
+  g_ptr_array_add(scan->dirs[worker], dir);
+
+  if (pending->len >= SCAN_BATCH)
+    flush(scan, worker);
+}
+
+guint scan_tree(magic_t magic, const gchar* root, guint threads)
+{
+  static const walk_callbacks_t callbacks = { queue_file, enter_dir, leave_dir };
+
+  threads = MAX(threads, 1);
+  scan_t scan;
+  scan.magic = g_new0(magic_t, threads);
+  scan.magic[0] = magic;
+  scan.pending = g_new(GArray*, threads);
+  scan.dirs = g_new(GPtrArray*, threads);
+  scan.current = g_new0(dir_progress_t*, threads);
+  plugins_region_sizes(&scan.header_size, &scan.trailer_size);
+  scan.header_size = MAX(scan.header_size, SNIFF_SIZE);
+
+  guint i;
+  for (i = 0; i < threads; ++i)
+    {
+      scan.pending[i] = g_array_sized_new(FALSE, FALSE, sizeof(prefetch_item_t), SCAN_BATCH);
+      scan.dirs[i] = g_ptr_array_sized_new(SCAN_BATCH);
+    }
+
+  scan.resume = index_scan_start(root);
+
+  guint errors = 0;
+  guint count = walk_tree(root, threads, &callbacks, &scan, &errors);
+  if (errors > 0)
+    g_warning("%u entries below %s could not be read", errors, root);
+
+  /* the workers are done: their leftovers are finished here */
+  for (i = 0; i < threads; ++i)
+    {
+      flush(&scan, i);
+      g_array_free(scan.pending[i], TRUE);
+      g_ptr_array_free(scan.dirs[i], TRUE);
+      if (i > 0 && scan.magic[i] != NULL)
+	magic_close(scan.magic[i]);
+    }
+  index_scan_finish();
+
+  g_free(scan.current);
+  g_free(scan.dirs);
+  g_free(scan.pending);
+  g_free(scan.magic);
+  return count;
+}
@@ -0,0 +1,15 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <glib.h>
+#include <magic.h>
+
+/*
+ * Adds every regular file below root to the index, returns their number.
+ * magic serves the calling thread, other workers open their own. Files
+ * are committed in batches and directories checkpointed, so that an
+ * interrupted scan of a persistent index resumes where it stopped.
+ */
+guint scan_tree(magic_t magic, const gchar* root, guint threads);
+
+#endif
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE /* accept4 */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <glib.h>
+
+#include "service.h"
+#include "client.h"
+#include "index.h"
+#include "snapshot.h"
+#include "query.h"
+#include "stats.h"
+
+#define SERVICE_TIMEOUT 5 /* seconds a client may stay silent */
+
+static int s_listen_fd = -1;
+static gchar* s_filename = NULL;
+static GThread* s_thread = NULL;
+
+static gchar* read_line(FILE* in)
+{
+  gchar* line = NULL;
+  size_t size = 0;
+  ssize_t len = getline(&line, &size, in);
+  if (len <= 0)
+    {
+      free(line);
+      return NULL;
+    }
+  if (line[len - 1] == '\n')
+    line[len - 1] = '\0';
+
+  gchar* result = g_strdup(line);
+  free(line);
+  return result;
+}
+
+static void write_pair(const gchar* key, const gchar* value, gpointer user_data)
+{
+  gchar* k = g_strescape(key, NULL);
+  gchar* v = g_strescape(value, NULL);
+  fprintf((FILE*)user_data, "%s\t%s\n", k, v);
+  g_free(k);
+  g_free(v);
+}
+
+static void handle_get(const gchar* path, FILE* out)
+{
+  /* a file changed since it was indexed is extracted again by the client */
+  struct stat st;
+  if (stat(path, &st) != 0)
+    {
+      fputs("ERR not indexed\n", out);
+      return;
+    }
+
+  /* the index, when open, is ahead of a snapshot still being rebuilt
+     after a SET */
+  gint64 mtime = index_mtime(&st.st_mtim);
+  Metainfo* metainfo;
+  if (index_db() != NULL)
+    metainfo = index_get_metainfo(path, mtime, st.st_size);
+  else
+    {
+      query_begin();
+      metainfo = snapshot_get_metainfo(path, mtime, st.st_size);
+      query_end();
+    }
+  if (metainfo == NULL)
+    {
+      fputs("ERR not indexed or changed\n", out);
+      return;
+    }
+
+  fputs("OK\n", out);
+  metainfo_foreach(metainfo, write_pair, out);
+  fputs(".\n", out);
+  metainfo_free(metainfo);
+}
+
+/* <key>\t<value> lines up to ".", NULL if the connection ends first */
+static Metainfo* read_metainfo(FILE* in)
+{
+  Metainfo* metainfo = metainfo_new();
+
+  gchar* line;
+  while ((line = read_line(in)) != NULL)
+    {
+      if (strcmp(line, ".") == 0)
+	{
+	  g_free(line);
+	  return metainfo;
+	}
+
+      gchar* tab = strchr(line, '\t');
+      if (tab != NULL)
+	{
+	  *tab = '\0';
+	  gchar* key = g_strcompress(line);
+	  gchar* value = g_strcompress(tab + 1);
+	  metainfo_set(metainfo, key, value);
+	  g_free(key);
+	  g_free(value);
+	}
+      g_free(line);
+    }
+
+  metainfo_free(metainfo);
+  return NULL;
+}
+
+static void reply_set(guint updated, FILE* out)
+{
+  if (updated != 0)
+    snapshot_schedule_publish();
+  fputs(updated != 0 ? "OK\n"
+	: index_is_read_only() ? "ERR read-only index\n"
+	: "ERR not indexed\n", out);
+}
+
+static gboolean handle_set(const gchar* path, FILE* in, FILE* out)
+{
+  Metainfo* metainfo = read_metainfo(in);
+  if (metainfo == NULL)
+    return FALSE;
+
+  reply_set(index_update_file(path, metainfo), out);
+  metainfo_free(metainfo);
+  return TRUE;
+}
+
+/* files this instance does not index are skipped */
+static gboolean handle_set_many(guint count, FILE* in, FILE* out)
+{
+  GPtrArray* paths = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray* metainfo = g_ptr_array_new_with_free_func((GDestroyNotify)metainfo_free);
+  gboolean complete = TRUE;
+  guint i;
+  for (i = 0; i < count && complete; ++i)
+    {
+      gchar* line = read_line(in);
+      Metainfo* m = line != NULL ? read_metainfo(in) : NULL;
+      complete = m != NULL;
+      if (complete)
+	{
+	  g_ptr_array_add(paths, g_strcompress(line));
+	  g_ptr_array_add(metainfo, m);
+	}
+      g_free(line);
+    }
+
+  if (complete)
+    reply_set(index_update_files((const gchar* const*)paths->pdata,
+				 (const Metainfo* const*)metainfo->pdata, count), out);
+  g_ptr_array_free(metainfo, TRUE);
+  g_ptr_array_free(paths, TRUE);
+  return complete;
+}
+
+static void handle_connection(int fd)
+{
+  struct timeval tv = { SERVICE_TIMEOUT, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  FILE* in = fdopen(fd, "r");
+  FILE* out = fdopen(dup(fd), "w");
+  if (in == NULL || out == NULL)
+    {
+      if (in != NULL)
+	fclose(in);
+      else
+	close(fd);
+      if (out != NULL)
+	fclose(out);
+      return;
+    }
+
+  gchar* line;
+  while ((line = read_line(in)) != NULL)
+    {
+      gchar* path = NULL;
+      if (g_str_has_prefix(line, "GET "))
+	{
+	  guint64 start = stats_now();
+	  path = g_strcompress(line + 4);
+	  handle_get(path, out);
+	  stats_record(STAT_SERVICE_GET, start);
+	}
+      else if (g_str_has_prefix(line, "SET "))
+	{
+	  guint64 start = stats_now();
+	  path = g_strcompress(line + 4);
+	  if (!handle_set(path, in, out))
+	    {
+	      g_free(path);
+	      g_free(line);
+	      break;
+	    }
+	  stats_record(STAT_SERVICE_SET, start);
+	}
+      else if (g_str_has_prefix(line, "MSET "))
+	{
+	  guint64 start = stats_now();
+	  if (!handle_set_many(strtoul(line + 5, NULL, 10), in, out))
+	    {
+	      g_free(line);
+	      break;
+	    }
+	  stats_record(STAT_SERVICE_SET, start);
+	}
+      else
+	fputs("ERR bad request\n", out);
+
+      fflush(out);
+      g_free(path);
+      g_free(line);
+    }
+
+  fclose(out);
+  fclose(in);
+}
+
+/* requests are short: connections are served one by one */
+static gpointer service_thread(gpointer data)
+{
+  for (;;)
+    {
+      int fd = accept4(s_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (fd < 0)
+	{
+	  if (errno == EINTR || errno == ECONNABORTED)
+	    continue;
+	  break; /* shut down by service_stop */
+	}
+      handle_connection(fd);
+    }
+  return NULL;
+}
+
+gboolean service_start(GError** error)
+{
+  gchar* dirname = client_socket_dir();
+  if (g_mkdir_with_parents(dirname, 0700) != 0)
+    {
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		  "Can't create %s: %s", dirname, g_strerror(errno));
+      g_free(dirname);
+      return FALSE;
+    }
+
+  gchar* name = g_strdup_printf("%d.sock", (int)getpid());
+  s_filename = g_build_filename(dirname, name, NULL);
+  g_free(name);
+  g_free(dirname);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy(addr.sun_path, s_filename, sizeof(addr.sun_path));
+
+  unlink(s_filename);
+
+  s_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (s_listen_fd < 0
+      || bind(s_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+      || listen(s_listen_fd, 16) != 0)
+    {
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		  "Can't listen on %s: %s", s_filename, g_strerror(errno));
+      service_stop();
+      return FALSE;
+    }
+  chmod(s_filename, 0600);
+
+  s_thread = g_thread_new("tagfs-service", service_thread, NULL);
+  return TRUE;
+}
+
+void service_stop(void)
+{
+  if (s_listen_fd >= 0)
+    shutdown(s_listen_fd, SHUT_RDWR); /* wakes up accept() */
+
+  if (s_thread != NULL)
+    {
+      g_thread_join(s_thread);
+      s_thread = NULL;
+    }
+
+  if (s_listen_fd >= 0)
+    {
+      close(s_listen_fd);
+      s_listen_fd = -1;
+    }
+
+  if (s_filename != NULL)
+    {
+      unlink(s_filename);
+      g_free(s_filename);
+      s_filename = NULL;
+    }
+}
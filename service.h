@@ -0,0 +1,10 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <glib.h>
+
+/* serves the index to clients, see client.h for the protocol */
+gboolean service_start(GError** error);
+void service_stop(void);
+
+#endif
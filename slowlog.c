@@ -0,0 +1,222 @@
+#include <string.h>
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "slowlog.h"
+#include "index.h"
+
+typedef struct tagShape
+{
+  gchar* shape;
+  guint64 count;
+  guint64 total_ns;
+  guint64 max_ns;
+  guint min_params;
+  guint max_params;
+  gchar* slowest;   /* expanded SQL of the slowest call */
+} shape_t;
+
+/* all of it is guarded by the index lock, statements run under it */
+static gboolean s_enabled = FALSE;
+static gboolean s_explaining = FALSE;
+static guint64 s_threshold_ns = 0;
+static GHashTable* s_shapes = NULL;
+
+static void free_shape(gpointer data)
+{
+  shape_t* shape = (shape_t*)data;
+  g_free(shape->shape);
+  g_free(shape->slowest);
+  g_free(shape);
+}
+
+static gboolean is_word_char(gchar c)
+{
+  return g_ascii_isalnum(c) || c == '_' || c == '.';
+}
+
+/* literals become `?', lists of them `?...'; *literals counts them */
+static gchar* normalize(const gchar* sql, guint* literals)
+{
+  GString* out = g_string_new(NULL);
+  const gchar* p = sql;
+  *literals = 0;
+
+  while (*p != '\0')
+    {
+      if (g_ascii_isspace(*p))
+	{
+	  while (g_ascii_isspace(*p))
+	    ++p;
+	  if (out->len != 0 && *p != '\0')
+	    g_string_append_c(out, ' ');
+	}
+      else if (*p == '\'')
+	{
+	  for (++p; *p != '\0'; ++p)
+	    if (*p == '\'' && *++p != '\'')
+	      break;
+	  g_string_append_c(out, '?');
+	  ++*literals;
+	}
+      else if (g_ascii_isdigit(*p) && (out->len == 0 || !is_word_char(out->str[out->len - 1])))
+	{
+	  while (is_word_char(*p))
+	    ++p;
+	  g_string_append_c(out, '?');
+	  ++*literals;
+	}
+      else
+	g_string_append_c(out, *p++);
+    }
+
+  static GRegex* list = NULL;
+  static gsize initialized = 0;
+  if (g_once_init_enter(&initialized))
+    {
+      list = g_regex_new("\\?( ?, ?\\?)+", G_REGEX_OPTIMIZE, 0, NULL);
+      g_once_init_leave(&initialized, 1);
+    }
+
+  gchar* result = g_regex_replace_literal(list, out->str, -1, 0, "?...", 0, NULL);
+  g_string_free(out, TRUE);
+  return result;
+}
+
+static int profile(unsigned mask, void* context, void* p, void* x)
+{
+  sqlite3_stmt* statement = (sqlite3_stmt*)p;
+  guint64 ns = *(sqlite3_int64*)x;
+
+  if (s_explaining || ns < s_threshold_ns)
+    return 0;
+
+  guint literals;
+  gchar* text = normalize(sqlite3_sql(statement), &literals);
+  guint params = literals + sqlite3_bind_parameter_count(statement);
+
+  shape_t* shape = g_hash_table_lookup(s_shapes, text);
+  if (shape == NULL)
+    {
+      shape = g_new0(shape_t, 1);
+      shape->shape = text;
+      shape->min_params = params;
+      g_hash_table_insert(s_shapes, shape->shape, shape);
+    }
+  else
+    g_free(text);
+
+  ++shape->count;
+  shape->total_ns += ns;
+  shape->min_params = MIN(shape->min_params, params);
+  shape->max_params = MAX(shape->max_params, params);
+  if (ns >= shape->max_ns)
+    {
+      shape->max_ns = ns;
+      g_free(shape->slowest);
+      char* expanded = sqlite3_expanded_sql(statement);
+      shape->slowest = g_strdup(expanded != NULL ? expanded : sqlite3_sql(statement));
+      sqlite3_free(expanded);
+    }
+  return 0;
+}
+
+void slowlog_enable(guint threshold_us)
+{
+  index_lock();
+  s_threshold_ns = (guint64)threshold_us * 1000;
+  if (s_shapes == NULL)
+    s_shapes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_shape);
+  sqlite3_trace_v2(index_db(), SQLITE_TRACE_PROFILE, profile, NULL);
+  s_enabled = TRUE;
+  index_unlock();
+}
+
+static void append_plan(GString* out, const gchar* sql)
+{
+  gchar* explain = g_strdup_printf("explain query plan %s", sql);
+  sqlite3_stmt *statement;
+  if (sqlite3_prepare_v2(index_db(), explain, -1, &statement, NULL) != SQLITE_OK)
+    {
+      g_string_append_printf(out, "  (%s)\n", sqlite3_errmsg(index_db()));
+      g_free(explain);
+      return;
+    }
+  g_free(explain);
+
+  /* rows come parent first: indent by depth */
+  GHashTable* depths = g_hash_table_new(g_direct_hash, g_direct_equal);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      gint id = sqlite3_column_int(statement, 0);
+      gint parent = sqlite3_column_int(statement, 1);
+      gint depth = GPOINTER_TO_INT(g_hash_table_lookup(depths, GINT_TO_POINTER(parent))) + 1;
+      g_hash_table_insert(depths, GINT_TO_POINTER(id), GINT_TO_POINTER(depth));
+
+      g_string_append_printf(out, "%*s%s\n", depth * 2, "", (const gchar*)sqlite3_column_text(statement, 3));
+    }
+  sqlite3_finalize(statement);
+  g_hash_table_destroy(depths);
+}
+
+static gint compare_total(gconstpointer a, gconstpointer b)
+{
+  const shape_t* x = *(const shape_t* const*)a;
+  const shape_t* y = *(const shape_t* const*)b;
+  return x->total_ns < y->total_ns ? 1 : x->total_ns > y->total_ns ? -1 : 0;
+}
+
+gchar* slowlog_format(void)
+{
+  if (!s_enabled)
+    return g_strdup("# slow-query log is off, mount with -o slowlog=USEC\n");
+
+  index_lock();
+
+  GString* out = g_string_new(NULL);
+  g_string_append_printf(out, "# statements slower than %" G_GUINT64_FORMAT "us, by total time\n",
+			 s_threshold_ns / 1000);
+
+  GPtrArray* shapes = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, s_shapes);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    g_ptr_array_add(shapes, value);
+  g_ptr_array_sort(shapes, compare_total);
+
+  s_explaining = TRUE;
+  guint i;
+  for (i = 0; i < shapes->len; ++i)
+    {
+      shape_t* shape = g_ptr_array_index(shapes, i);
+      g_string_append_printf(out,
+			     "\ncalls %" G_GUINT64_FORMAT ", total %.3fms, mean %.3fms, max %.3fms, params %u..%u\n"
+			     "shape: %s\n"
+			     "slowest: %s\n"
+			     "plan:\n",
+			     shape->count,
+			     shape->total_ns / 1e6,
+			     shape->total_ns / 1e6 / shape->count,
+			     shape->max_ns / 1e6,
+			     shape->min_params,
+			     shape->max_params,
+			     shape->shape,
+			     shape->slowest);
+      append_plan(out, shape->slowest);
+    }
+  s_explaining = FALSE;
+
+  g_ptr_array_free(shapes, TRUE);
+  index_unlock();
+
+  return g_string_free(out, FALSE);
+}
+
+void slowlog_reset(void)
+{
+  index_lock();
+  if (s_shapes != NULL)
+    g_hash_table_remove_all(s_shapes);
+  index_unlock();
+}
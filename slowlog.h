@@ -0,0 +1,16 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <glib.h>
+
+/*
+ * Opt-in log of index statements slower than a threshold, aggregated by
+ * normalised statement shape. Query plans of the slowest sample of every
+ * shape are only computed when the log is read.
+ */
+void slowlog_enable(guint threshold_us);
+
+gchar* slowlog_format(void);
+void slowlog_reset(void);
+
+#endif
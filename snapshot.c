@@ -0,0 +1,1009 @@
+#include <string.h>
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "snapshot.h"
+#include "index.h"
+
+#define SNAPSHOT_MAGIC "TFSSNAP\n"
+#define SNAPSHOT_VERSION 2
+#define BYTE_ORDER_MARK 0x01020304
+#define ALIGNMENT 8
+
+typedef enum
+{
+  SECTION_STRINGS,  /* NUL-terminated, referenced by offset */
+  SECTION_ATTRS,    /* attr_record_t by name */
+  SECTION_VALUES,   /* string offsets by value */
+  SECTION_PAIRS,    /* pair_record_t by attr, value */
+  SECTION_POSTINGS, /* file indices, ascending within a list */
+  SECTION_FILES,    /* file_record_t */
+  SECTION_NAMES,    /* file indices by name, path */
+  SECTION_PATHS,    /* file indices by path */
+  SECTION_LINKS,    /* link_record_t by file, attr, value */
+  SECTION_METAINFO, /* metainfo_record_t by file */
+  SECTION_COUNT
+} section_t;
+
+typedef struct tagExtent
+{
+  guint64 offset;
+  guint64 size;
+} extent_t;
+
+typedef struct tagSnapshotHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 root;         /* string */
+  guint32 reserved;
+  extent_t sections[SECTION_COUNT];
+} snapshot_header_t;
+
+/* attribute ids are indices + 1, likewise value ids */
+typedef struct tagAttrRecord
+{
+  guint32 name;
+  guint32 pairs_first;
+  guint32 pairs_count;
+  guint32 files_first;  /* postings of every file having the attribute */
+  guint32 files_count;
+} attr_record_t;
+
+typedef struct tagPairRecord
+{
+  guint32 value_id;
+  guint32 postings_first;
+  guint32 postings_count;
+} pair_record_t;
+
+typedef struct tagFileRecord
+{
+  guint32 name;
+  guint32 path;
+  guint32 links_first;
+  guint32 links_count;
+  guint32 metainfo_first;
+  guint32 metainfo_count;
+  gint64 mtime;         /* as in the index */
+  gint64 size;
+} file_record_t;
+
+typedef struct tagLinkRecord
+{
+  guint32 attr_id;
+  guint32 value_id;
+} link_record_t;
+
+typedef struct tagMetainfoRecord
+{
+  guint32 key;
+  guint32 value;
+} metainfo_record_t;
+
+/* reading */
+
+/* a generation: one snapshot, from a file or built from the index */
+typedef struct tagSnapshot
+{
+  GBytes* bytes;
+  const gchar* strings;
+  guint strings_size;
+  const attr_record_t* attrs;
+  guint attr_count;
+  const guint32* values;
+  guint value_count;
+  const pair_record_t* pairs;
+  guint pair_count;
+  const guint32* postings;
+  guint posting_count;
+  const file_record_t* files;
+  guint file_count;
+  const guint32* names;
+  guint name_count;
+  const guint32* paths;
+  guint path_count;
+  const link_record_t* links;
+  guint link_count;
+  const metainfo_record_t* metainfo;
+  guint metainfo_count;
+  const gchar* root;
+  guint serial;              /* counts publications, from 1 */
+} snapshot_t;
+
+/*
+ * Only the header and section bounds are checked on load, which keeps
+ * it O(1); references inside records are checked where they are used.
+ */
+static const gchar* str(const snapshot_t* s, guint32 offset)
+{
+  return offset < s->strings_size ? s->strings + offset : "";
+}
+
+static gboolean in_range(guint32 first, guint32 count, guint total)
+{
+  return first <= total && count <= total - first;
+}
+
+static gconstpointer section(const gchar* base, gsize length, const snapshot_header_t* header,
+			     section_t s, gsize record_size, guint* count)
+{
+  const extent_t* e = &header->sections[s];
+  if (e->offset > length || e->size > length - e->offset
+      || e->offset % ALIGNMENT != 0 || e->size % record_size != 0
+      || e->size / record_size > G_MAXUINT32)
+    return NULL;
+  *count = e->size / record_size;
+  return base + e->offset;
+}
+
+/* takes bytes */
+static snapshot_t* load(GBytes* bytes, const gchar* filename, GError** error)
+{
+  gsize length;
+  const gchar* base = g_bytes_get_data(bytes, &length);
+  const snapshot_header_t* header = (const snapshot_header_t*)base;
+  if (length < sizeof(*header) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s: not a tagfs snapshot", filename);
+      g_bytes_unref(bytes);
+      return NULL;
+    }
+  if (header->version != SNAPSHOT_VERSION || header->byte_order != BYTE_ORDER_MARK)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		  "%s: snapshot version %u or byte order differs, rebuild it with tagfs-index",
+		  filename, header->version);
+      g_bytes_unref(bytes);
+      return NULL;
+    }
+
+  snapshot_t* s = g_slice_new0(snapshot_t);
+  s->strings = section(base, length, header, SECTION_STRINGS, 1, &s->strings_size);
+  s->attrs = section(base, length, header, SECTION_ATTRS, sizeof(attr_record_t), &s->attr_count);
+  s->values = section(base, length, header, SECTION_VALUES, sizeof(guint32), &s->value_count);
+  s->pairs = section(base, length, header, SECTION_PAIRS, sizeof(pair_record_t), &s->pair_count);
+  s->postings = section(base, length, header, SECTION_POSTINGS, sizeof(guint32), &s->posting_count);
+  s->files = section(base, length, header, SECTION_FILES, sizeof(file_record_t), &s->file_count);
+  s->names = section(base, length, header, SECTION_NAMES, sizeof(guint32), &s->name_count);
+  s->paths = section(base, length, header, SECTION_PATHS, sizeof(guint32), &s->path_count);
+  s->links = section(base, length, header, SECTION_LINKS, sizeof(link_record_t), &s->link_count);
+  s->metainfo = section(base, length, header, SECTION_METAINFO, sizeof(metainfo_record_t), &s->metainfo_count);
+
+  /* every string ends inside the table */
+  if (s->strings == NULL || s->attrs == NULL || s->values == NULL || s->pairs == NULL
+      || s->postings == NULL || s->files == NULL || s->names == NULL || s->paths == NULL
+      || s->links == NULL || s->metainfo == NULL
+      || s->strings_size == 0 || s->strings[s->strings_size - 1] != '\0'
+      || s->name_count != s->file_count || s->path_count != s->file_count)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s: snapshot is truncated or corrupt", filename);
+      g_slice_free(snapshot_t, s);
+      g_bytes_unref(bytes);
+      return NULL;
+    }
+
+  s->bytes = bytes;
+  s->root = str(s, header->root);
+  return s;
+}
+
+static void free_snapshot(snapshot_t* s)
+{
+  if (s == NULL)
+    return;
+  g_bytes_unref(s->bytes);
+  g_slice_free(snapshot_t, s);
+}
+
+static const snapshot_t* current(void);
+
+gboolean snapshot_is_open(void)
+{
+  return current() != NULL;
+}
+
+guint snapshot_generation(void)
+{
+  const snapshot_t* s = current();
+  return s != NULL ? s->serial : 0;
+}
+
+const gchar* snapshot_root(void)
+{
+  const snapshot_t* s = current();
+  return s != NULL ? s->root : NULL;
+}
+
+gint snapshot_find_attr_id(const gchar* attr)
+{
+  const snapshot_t* s = current();
+  if (s == NULL)
+    return 0;
+
+  guint low = 0;
+  guint high = s->attr_count;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      int c = strcmp(str(s, s->attrs[middle].name), attr);
+      if (c == 0)
+	return middle + 1;
+      if (c < 0)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+  return 0;
+}
+
+gint snapshot_find_attr_value_id(const gchar* value)
+{
+  const snapshot_t* s = current();
+  if (s == NULL)
+    return 0;
+
+  guint low = 0;
+  guint high = s->value_count;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      int c = strcmp(str(s, s->values[middle]), value);
+      if (c == 0)
+	return middle + 1;
+      if (c < 0)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+  return 0;
+}
+
+static const attr_record_t* get_attr(const snapshot_t* s, gint attr_id)
+{
+  return attr_id >= 1 && (guint)attr_id <= s->attr_count ? &s->attrs[attr_id - 1] : NULL;
+}
+
+static const file_record_t* get_file(const snapshot_t* s, guint32 index)
+{
+  return index < s->file_count ? &s->files[index] : NULL;
+}
+
+static const link_record_t* file_links(const snapshot_t* s, const file_record_t* file, guint* count)
+{
+  *count = 0;
+  if (!in_range(file->links_first, file->links_count, s->link_count))
+    return NULL;
+  *count = file->links_count;
+  return s->links + file->links_first;
+}
+
+static const guint32* posting_list(const snapshot_t* s, guint32 first, guint32 count, guint* length)
+{
+  *length = 0;
+  if (!in_range(first, count, s->posting_count))
+    return NULL;
+  *length = count;
+  return s->postings + first;
+}
+
+static const pair_record_t* find_pair(const snapshot_t* s, const attr_record_t* attr, guint32 value_id)
+{
+  if (!in_range(attr->pairs_first, attr->pairs_count, s->pair_count))
+    return NULL;
+  const pair_record_t* pairs = s->pairs + attr->pairs_first;
+  guint low = 0;
+  guint high = attr->pairs_count;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      if (pairs[middle].value_id == value_id)
+	return &pairs[middle];
+      if (pairs[middle].value_id < value_id)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+  return NULL;
+}
+
+static gboolean contains(const guint32* list, guint count, guint32 item)
+{
+  guint low = 0;
+  guint high = count;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      if (list[middle] == item)
+	return TRUE;
+      if (list[middle] < item)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+  return FALSE;
+}
+
+static gboolean has_id(const gint* ids, guint count, guint32 id)
+{
+  guint i;
+  for (i = 0; i < count; ++i)
+    if ((guint32)ids[i] == id)
+      return TRUE;
+  return FALSE;
+}
+
+/* first index in sorted with a string at least key */
+static guint lower_bound(const snapshot_t* s, const guint32* sorted, guint count, gsize field, const gchar* key)
+{
+  guint low = 0;
+  guint high = count;
+  while (low < high)
+    {
+      guint middle = low + (high - low) / 2;
+      const file_record_t* file = get_file(s, sorted[middle]);
+      const gchar* string = file != NULL ? str(s, G_STRUCT_MEMBER(guint32, file, field)) : "";
+      if (strcmp(string, key) < 0)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+  return low;
+}
+
+const gchar* snapshot_find_file(gint attr_id, const gint* value_ids, guint value_count, const gchar* name)
+{
+  const snapshot_t* s = current();
+  if (s == NULL)
+    return NULL;
+
+  guint i;
+  for (i = lower_bound(s, s->names, s->name_count, G_STRUCT_OFFSET(file_record_t, name), name);
+       i < s->name_count; ++i)
+    {
+      const file_record_t* file = get_file(s, s->names[i]);
+      if (file == NULL || strcmp(str(s, file->name), name) != 0)
+	break;
+
+      guint count;
+      const link_record_t* links = file_links(s, file, &count);
+      guint k;
+      for (k = 0; k < count; ++k)
+	if (links[k].attr_id == (guint32)attr_id
+	    && (value_count == 0 || has_id(value_ids, value_count, links[k].value_id)))
+	  return str(s, file->path);
+    }
+  return NULL;
+}
+
+static gint compare_guint32(gconstpointer a, gconstpointer b)
+{
+  guint32 x = *(const guint32*)a;
+  guint32 y = *(const guint32*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void list_values(const snapshot_t* s, GArray* value_ids, snapshot_name_func_t func, gpointer user_data)
+{
+  g_array_sort(value_ids, compare_guint32);
+  guint i;
+  for (i = 0; i < value_ids->len; ++i)
+    {
+      guint32 id = g_array_index(value_ids, guint32, i);
+      if ((i == 0 || id != g_array_index(value_ids, guint32, i - 1))
+	  && id >= 1 && id <= s->value_count)
+	func(str(s, s->values[id - 1]), user_data);
+    }
+}
+
+void snapshot_list_dir(gint attr_id, const gint* value_ids, guint value_count,
+		       snapshot_name_func_t func, gpointer user_data)
+{
+  const snapshot_t* s = current();
+  if (s == NULL)
+    return;
+
+  guint i;
+  if (attr_id == 0)
+    {
+      for (i = 0; i < s->attr_count; ++i)
+	func(str(s, s->attrs[i].name), user_data);
+      return;
+    }
+
+  const attr_record_t* attr = get_attr(s, attr_id);
+  if (attr == NULL)
+    return;
+
+  GArray* values = g_array_new(FALSE, FALSE, sizeof(guint32));
+  guint count;
+  if (value_count == 0)
+    {
+      const guint32* files = posting_list(s, attr->files_first, attr->files_count, &count);
+      for (i = 0; i < count; ++i)
+	{
+	  const file_record_t* file = get_file(s, files[i]);
+	  if (file != NULL)
+	    func(str(s, file->name), user_data);
+	}
+      if (in_range(attr->pairs_first, attr->pairs_count, s->pair_count))
+	for (i = 0; i < attr->pairs_count; ++i)
+	  g_array_append_val(values, s->pairs[attr->pairs_first + i].value_id);
+      list_values(s, values, func, user_data);
+      g_array_free(values, TRUE);
+      return;
+    }
+
+  /* intersect the postings, walking the shortest */
+  const guint32** lists = g_new(const guint32*, value_count);
+  guint* lengths = g_new(guint, value_count);
+  guint shortest = 0;
+  gboolean empty = FALSE;
+  for (i = 0; i < value_count && !empty; ++i)
+    {
+      const pair_record_t* pair = find_pair(s, attr, value_ids[i]);
+      lists[i] = pair != NULL ? posting_list(s, pair->postings_first, pair->postings_count, &lengths[i]) : NULL;
+      empty = lists[i] == NULL || lengths[i] == 0;
+      if (!empty && lengths[i] < lengths[shortest])
+	shortest = i;
+    }
+
+  for (i = 0; !empty && i < lengths[shortest]; ++i)
+    {
+      guint32 index = lists[shortest][i];
+      guint k;
+      for (k = 0; k < value_count; ++k)
+	if (k != shortest && !contains(lists[k], lengths[k], index))
+	  break;
+      const file_record_t* file = get_file(s, index);
+      if (k < value_count || file == NULL)
+	continue;
+
+      func(str(s, file->name), user_data);
+
+      const link_record_t* links = file_links(s, file, &count);
+      for (k = 0; k < count; ++k)
+	if (links[k].attr_id == (guint32)attr_id && !has_id(value_ids, value_count, links[k].value_id))
+	  g_array_append_val(values, links[k].value_id);
+    }
+  list_values(s, values, func, user_data);
+
+  g_array_free(values, TRUE);
+  g_free(lengths);
+  g_free(lists);
+}
+
+Metainfo* snapshot_get_metainfo(const gchar* path, gint64 mtime, gint64 size)
+{
+  const snapshot_t* s = current();
+  if (s == NULL)
+    return NULL;
+
+  guint i = lower_bound(s, s->paths, s->path_count, G_STRUCT_OFFSET(file_record_t, path), path);
+  const file_record_t* file = i < s->path_count ? get_file(s, s->paths[i]) : NULL;
+  if (file == NULL || strcmp(str(s, file->path), path) != 0
+      || file->mtime != mtime || file->size != size
+      || !in_range(file->metainfo_first, file->metainfo_count, s->metainfo_count))
+    return NULL;
+
+  Metainfo* result = metainfo_new();
+  const metainfo_record_t* m = s->metainfo + file->metainfo_first;
+  for (i = 0; i < file->metainfo_count; ++i)
+    metainfo_set(result, str(s, m[i].key), str(s, m[i].value));
+  return result;
+}
+
+/* writing */
+
+typedef struct tagBuilder
+{
+  GString* strings;
+  GHashTable* offsets;  /* string -> offset in strings */
+} builder_t;
+
+typedef struct tagTriple
+{
+  guint32 attr_id;
+  guint32 value_id;
+  guint32 file;
+} triple_t;
+
+static guint32 intern(builder_t* b, const gchar* s)
+{
+  if (s == NULL)
+    s = "";
+  gpointer offset;
+  if (g_hash_table_lookup_extended(b->offsets, s, NULL, &offset))
+    return GPOINTER_TO_UINT(offset);
+
+  guint32 result = b->strings->len;
+  g_string_append_len(b->strings, s, strlen(s) + 1);
+  g_hash_table_insert(b->offsets, g_strdup(s), GUINT_TO_POINTER(result));
+  return result;
+}
+
+static const gchar* column(sqlite3_stmt* statement, int i)
+{
+  return (const gchar*)sqlite3_column_text(statement, i);
+}
+
+static guint32 mapped(GHashTable* map, gint id, gboolean* found)
+{
+  gpointer value = NULL;
+  *found = g_hash_table_lookup_extended(map, GINT_TO_POINTER(id), NULL, &value);
+  return GPOINTER_TO_UINT(value);
+}
+
+static gint compare_by_pair(gconstpointer a, gconstpointer b)
+{
+  const triple_t* x = a;
+  const triple_t* y = b;
+  if (x->attr_id != y->attr_id)
+    return x->attr_id < y->attr_id ? -1 : 1;
+  if (x->value_id != y->value_id)
+    return x->value_id < y->value_id ? -1 : 1;
+  return x->file < y->file ? -1 : x->file > y->file;
+}
+
+static gint compare_by_file(gconstpointer a, gconstpointer b)
+{
+  const triple_t* x = a;
+  const triple_t* y = b;
+  if (x->file != y->file)
+    return x->file < y->file ? -1 : 1;
+  return compare_by_pair(a, b);
+}
+
+typedef struct tagSortContext
+{
+  const builder_t* builder;
+  const file_record_t* files;
+} sort_context_t;
+
+static gint compare_names(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const sort_context_t* c = user_data;
+  const file_record_t* x = &c->files[*(const guint32*)a];
+  const file_record_t* y = &c->files[*(const guint32*)b];
+  int result = strcmp(c->builder->strings->str + x->name, c->builder->strings->str + y->name);
+  return result != 0 ? result : strcmp(c->builder->strings->str + x->path, c->builder->strings->str + y->path);
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const sort_context_t* c = user_data;
+  const file_record_t* x = &c->files[*(const guint32*)a];
+  const file_record_t* y = &c->files[*(const guint32*)b];
+  return strcmp(c->builder->strings->str + x->path, c->builder->strings->str + y->path);
+}
+
+static void append_section(GString* out, snapshot_header_t* header, section_t s, gconstpointer data, gsize size)
+{
+  while (out->len % ALIGNMENT != 0)
+    g_string_append_c(out, '\0');
+  header->sections[s].offset = out->len;
+  header->sections[s].size = size;
+  g_string_append_len(out, data, size);
+}
+
+/* an image of the finished scan in the index, NULL if there is none */
+static GBytes* build(void)
+{
+  gchar* root = index_scan_root();
+  if (root == NULL)
+    return NULL;
+
+  builder_t b;
+  b.strings = g_string_new(NULL);
+  b.offsets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  intern(&b, "");
+  header.root = intern(&b, root);
+  g_free(root);
+
+  GArray* attrs = g_array_new(FALSE, TRUE, sizeof(attr_record_t));
+  GArray* values = g_array_new(FALSE, FALSE, sizeof(guint32));
+  GArray* files = g_array_new(FALSE, TRUE, sizeof(file_record_t));
+  GArray* triples = g_array_new(FALSE, FALSE, sizeof(triple_t));
+  GArray* pairs = g_array_new(FALSE, FALSE, sizeof(pair_record_t));
+  GArray* postings = g_array_new(FALSE, FALSE, sizeof(guint32));
+  GArray* links = g_array_new(FALSE, FALSE, sizeof(link_record_t));
+  GArray* metainfo = g_array_new(FALSE, FALSE, sizeof(metainfo_record_t));
+  GHashTable* attr_map = g_hash_table_new(NULL, NULL);
+  GHashTable* value_map = g_hash_table_new(NULL, NULL);
+  GHashTable* file_map = g_hash_table_new(NULL, NULL);
+
+  index_lock();
+  sqlite3* db = index_db();
+  sqlite3_stmt* statement;
+
+  /* sqlite's binary collation orders like strcmp */
+  sqlite3_prepare_v2(db, "select id, name from attr order by name", -1, &statement, NULL);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      attr_record_t attr = { intern(&b, column(statement, 1)), 0, 0, 0, 0 };
+      g_array_append_val(attrs, attr);
+      g_hash_table_insert(attr_map, GINT_TO_POINTER(sqlite3_column_int(statement, 0)), GUINT_TO_POINTER(attrs->len));
+    }
+  sqlite3_finalize(statement);
+
+  sqlite3_prepare_v2(db, "select id, value from attr_value order by value", -1, &statement, NULL);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      guint32 value = intern(&b, column(statement, 1));
+      g_array_append_val(values, value);
+      g_hash_table_insert(value_map, GINT_TO_POINTER(sqlite3_column_int(statement, 0)), GUINT_TO_POINTER(values->len));
+    }
+  sqlite3_finalize(statement);
+
+  /* files of a directory come in runs, index_file_path caches it */
+  sqlite3_prepare_v2(db, "select id, name, dir_id, mtime, size from file order by id", -1, &statement, NULL);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      gchar* path = index_file_path(sqlite3_column_int(statement, 2), column(statement, 1));
+      file_record_t file = { intern(&b, column(statement, 1)), intern(&b, path), 0, 0, 0, 0,
+			     sqlite3_column_int64(statement, 3), sqlite3_column_int64(statement, 4) };
+      g_free(path);
+      g_hash_table_insert(file_map, GINT_TO_POINTER(sqlite3_column_int(statement, 0)), GUINT_TO_POINTER(files->len));
+      g_array_append_val(files, file);
+    }
+  sqlite3_finalize(statement);
+
+  sqlite3_prepare_v2(db, "select file_id, attr_id, value_id from link", -1, &statement, NULL);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      gboolean f, a, v;
+      triple_t t;
+      t.file = mapped(file_map, sqlite3_column_int(statement, 0), &f);
+      t.attr_id = mapped(attr_map, sqlite3_column_int(statement, 1), &a);
+      t.value_id = mapped(value_map, sqlite3_column_int(statement, 2), &v);
+      if (f && a && v)
+	g_array_append_val(triples, t);
+    }
+  sqlite3_finalize(statement);
+
+  /* files are numbered in id order, so their metainfo comes out grouped */
+  sqlite3_prepare_v2(db, "select file_id, key, value from metainfo order by file_id", -1, &statement, NULL);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+    {
+      gboolean found;
+      guint32 index = mapped(file_map, sqlite3_column_int(statement, 0), &found);
+      if (!found)
+	continue;
+      file_record_t* file = &g_array_index(files, file_record_t, index);
+      if (file->metainfo_count == 0)
+	file->metainfo_first = metainfo->len;
+      metainfo_record_t m = { intern(&b, column(statement, 1)), intern(&b, column(statement, 2)) };
+      g_array_append_val(metainfo, m);
+      ++file->metainfo_count;
+    }
+  sqlite3_finalize(statement);
+  index_unlock();
+
+  /* pairs and their postings, then every file of each attribute */
+  g_array_sort(triples, compare_by_pair);
+  guint i = 0;
+  while (i < triples->len)
+    {
+      guint32 attr_id = g_array_index(triples, triple_t, i).attr_id;
+      attr_record_t* attr = &g_array_index(attrs, attr_record_t, attr_id - 1);
+      attr->pairs_first = pairs->len;
+      guint first = i;
+      while (i < triples->len && g_array_index(triples, triple_t, i).attr_id == attr_id)
+	{
+	  pair_record_t pair = { g_array_index(triples, triple_t, i).value_id, postings->len, 0 };
+	  while (i < triples->len && g_array_index(triples, triple_t, i).attr_id == attr_id
+		 && g_array_index(triples, triple_t, i).value_id == pair.value_id)
+	    {
+	      g_array_append_val(postings, g_array_index(triples, triple_t, i).file);
+	      ++pair.postings_count;
+	      ++i;
+	    }
+	  g_array_append_val(pairs, pair);
+	  ++attr->pairs_count;
+	}
+
+      GArray* all = g_array_new(FALSE, FALSE, sizeof(guint32));
+      guint k;
+      for (k = first; k < i; ++k)
+	g_array_append_val(all, g_array_index(triples, triple_t, k).file);
+      g_array_sort(all, compare_guint32);
+      attr->files_first = postings->len;
+      for (k = 0; k < all->len; ++k)
+	if (k == 0 || g_array_index(all, guint32, k) != g_array_index(all, guint32, k - 1))
+	  {
+	    g_array_append_val(postings, g_array_index(all, guint32, k));
+	    ++attr->files_count;
+	  }
+      g_array_free(all, TRUE);
+    }
+
+  g_array_sort(triples, compare_by_file);
+  for (i = 0; i < triples->len; ++i)
+    {
+      const triple_t* t = &g_array_index(triples, triple_t, i);
+      file_record_t* file = &g_array_index(files, file_record_t, t->file);
+      if (file->links_count == 0)
+	file->links_first = links->len;
+      link_record_t link = { t->attr_id, t->value_id };
+      g_array_append_val(links, link);
+      ++file->links_count;
+    }
+
+  GArray* names = g_array_sized_new(FALSE, FALSE, sizeof(guint32), files->len);
+  GArray* paths = g_array_sized_new(FALSE, FALSE, sizeof(guint32), files->len);
+  for (i = 0; i < files->len; ++i)
+    {
+      guint32 index = i;
+      g_array_append_val(names, index);
+      g_array_append_val(paths, index);
+    }
+  sort_context_t context = { &b, (const file_record_t*)files->data };
+  g_array_sort_with_data(names, compare_names, &context);
+  g_array_sort_with_data(paths, compare_paths, &context);
+
+  GString* out = g_string_new(NULL);
+  g_string_append_len(out, (const gchar*)&header, sizeof(header));
+  append_section(out, &header, SECTION_STRINGS, b.strings->str, b.strings->len);
+  append_section(out, &header, SECTION_ATTRS, attrs->data, attrs->len * sizeof(attr_record_t));
+  append_section(out, &header, SECTION_VALUES, values->data, values->len * sizeof(guint32));
+  append_section(out, &header, SECTION_PAIRS, pairs->data, pairs->len * sizeof(pair_record_t));
+  append_section(out, &header, SECTION_POSTINGS, postings->data, postings->len * sizeof(guint32));
+  append_section(out, &header, SECTION_FILES, files->data, files->len * sizeof(file_record_t));
+  append_section(out, &header, SECTION_NAMES, names->data, names->len * sizeof(guint32));
+  append_section(out, &header, SECTION_PATHS, paths->data, paths->len * sizeof(guint32));
+  append_section(out, &header, SECTION_LINKS, links->data, links->len * sizeof(link_record_t));
+  append_section(out, &header, SECTION_METAINFO, metainfo->data, metainfo->len * sizeof(metainfo_record_t));
+  memcpy(out->str, &header, sizeof(header));
+
+  GBytes* result = g_string_free_to_bytes(out);
+
+  g_array_free(names, TRUE);
+  g_array_free(paths, TRUE);
+  g_hash_table_destroy(attr_map);
+  g_hash_table_destroy(value_map);
+  g_hash_table_destroy(file_map);
+  g_array_free(attrs, TRUE);
+  g_array_free(values, TRUE);
+  g_array_free(files, TRUE);
+  g_array_free(triples, TRUE);
+  g_array_free(pairs, TRUE);
+  g_array_free(postings, TRUE);
+  g_array_free(links, TRUE);
+  g_array_free(metainfo, TRUE);
+  g_string_free(b.strings, TRUE);
+  g_hash_table_destroy(b.offsets);
+  return result;
+}
+
+gboolean snapshot_write(const gchar* filename, GError** error)
+{
+  GBytes* bytes = build();
+  if (bytes == NULL)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s: the index holds no finished scan", filename);
+      return FALSE;
+    }
+
+  /* written aside and renamed, mounts keep their mapping of the old one */
+  gsize length;
+  gconstpointer data = g_bytes_get_data(bytes, &length);
+  gboolean result = g_file_set_contents(filename, data, length, error);
+  g_bytes_unref(bytes);
+  return result;
+}
+
+/* generations */
+
+/*
+ * A reader pins the current generation by announcing the epoch it
+ * started in, in a slot of its own. A writer swaps in the next
+ * generation, bumps the epoch and waits until no reader is left in an
+ * earlier one before freeing the old generation. Readers never wait
+ * and never write shared memory besides their slot.
+ */
+typedef struct tagReader
+{
+  struct tagReader* next;
+  gint owned;
+  gint epoch;                /* 0: not reading */
+  guint depth;               /* nested pins, owner only */
+  const snapshot_t* pinned;  /* owner only */
+} reader_t;
+
+static snapshot_t* s_current = NULL;
+static gint s_epoch = 1;
+static reader_t* s_readers = NULL;
+static guint s_serial = 0; /* under s_publish_lock */
+static GMutex s_publish_lock;
+
+static void release_reader(gpointer data)
+{
+  reader_t* reader = data;
+  g_atomic_int_set(&reader->owned, 0);
+}
+
+static GPrivate s_reader = G_PRIVATE_INIT(release_reader);
+
+/* slots of finished threads are reused, never freed */
+static reader_t* get_reader(void)
+{
+  reader_t* reader = g_private_get(&s_reader);
+  if (reader != NULL)
+    return reader;
+
+  for (reader = g_atomic_pointer_get(&s_readers); reader != NULL; reader = reader->next)
+    if (g_atomic_int_compare_and_exchange(&reader->owned, 0, 1))
+      break;
+
+  if (reader == NULL)
+    {
+      reader = g_new0(reader_t, 1);
+      reader->owned = 1;
+      do
+	reader->next = g_atomic_pointer_get(&s_readers);
+      while (!g_atomic_pointer_compare_and_exchange(&s_readers, reader->next, reader));
+    }
+  g_private_set(&s_reader, reader);
+  return reader;
+}
+
+static const snapshot_t* current(void)
+{
+  reader_t* reader = g_private_get(&s_reader);
+  return reader != NULL ? reader->pinned : NULL;
+}
+
+void snapshot_pin(void)
+{
+  reader_t* reader = get_reader();
+  if (reader->depth++ > 0)
+    return;
+  g_atomic_int_set(&reader->epoch, g_atomic_int_get(&s_epoch));
+  reader->pinned = g_atomic_pointer_get(&s_current);
+}
+
+void snapshot_unpin(void)
+{
+  reader_t* reader = g_private_get(&s_reader);
+  g_return_if_fail(reader != NULL && reader->depth > 0);
+  if (--reader->depth > 0)
+    return;
+  reader->pinned = NULL;
+  g_atomic_int_set(&reader->epoch, 0);
+}
+
+/* takes next, which may be NULL; must not be called with a pin held */
+static void publish(snapshot_t* next)
+{
+  g_mutex_lock(&s_publish_lock);
+  if (next != NULL)
+    next->serial = ++s_serial;
+  snapshot_t* old = g_atomic_pointer_get(&s_current);
+  g_atomic_pointer_set(&s_current, next);
+  gint epoch = g_atomic_int_add(&s_epoch, 1) + 1;
+
+  reader_t* reader;
+  for (reader = g_atomic_pointer_get(&s_readers); reader != NULL; reader = reader->next)
+    {
+      gint e;
+      while ((e = g_atomic_int_get(&reader->epoch)) != 0 && e < epoch)
+	g_thread_yield();
+    }
+  g_mutex_unlock(&s_publish_lock);
+
+  free_snapshot(old);
+}
+
+gboolean snapshot_open(const gchar* filename, GError** error)
+{
+  GMappedFile* file = g_mapped_file_new(filename, FALSE, error);
+  if (file == NULL)
+    return FALSE;
+  GBytes* bytes = g_mapped_file_get_bytes(file);
+  g_mapped_file_unref(file);
+
+  snapshot_t* s = load(bytes, filename, error);
+  if (s == NULL)
+    return FALSE;
+  publish(s);
+  return TRUE;
+}
+
+/* rebuilds from the index */
+
+#define REBUILD_DELAY_MS 100 /* updates within it share one rebuild */
+
+static gint s_live = 0;
+static GMutex s_rebuild_lock;
+static GCond s_rebuild_cond;
+static gboolean s_rebuild_pending = FALSE;
+static gboolean s_rebuild_stop = FALSE;
+static GThread* s_rebuilder = NULL;
+
+gboolean snapshot_publish_index(GError** error)
+{
+  GBytes* bytes = build();
+  if (bytes == NULL)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "the index holds no finished scan");
+      return FALSE;
+    }
+
+  snapshot_t* s = load(bytes, "index", error);
+  if (s == NULL)
+    return FALSE;
+  publish(s);
+  g_atomic_int_set(&s_live, 1);
+  return TRUE;
+}
+
+static gpointer rebuild_thread(gpointer data)
+{
+  g_mutex_lock(&s_rebuild_lock);
+  while (!s_rebuild_stop)
+    {
+      if (!s_rebuild_pending)
+	{
+	  g_cond_wait(&s_rebuild_cond, &s_rebuild_lock);
+	  continue;
+	}
+
+      gint64 deadline = g_get_monotonic_time() + REBUILD_DELAY_MS * G_TIME_SPAN_MILLISECOND;
+      while (!s_rebuild_stop && g_cond_wait_until(&s_rebuild_cond, &s_rebuild_lock, deadline))
+	;
+      if (s_rebuild_stop)
+	break;
+      s_rebuild_pending = FALSE;
+      g_mutex_unlock(&s_rebuild_lock);
+
+      GError* error = NULL;
+      if (!snapshot_publish_index(&error))
+	{
+	  g_warning("%s", error->message);
+	  g_error_free(error);
+	}
+      g_mutex_lock(&s_rebuild_lock);
+    }
+  g_mutex_unlock(&s_rebuild_lock);
+  return NULL;
+}
+
+void snapshot_schedule_publish(void)
+{
+  if (!g_atomic_int_get(&s_live))
+    return;
+
+  g_mutex_lock(&s_rebuild_lock);
+  s_rebuild_pending = TRUE;
+  if (s_rebuilder == NULL)
+    {
+      s_rebuild_stop = FALSE;
+      s_rebuilder = g_thread_new("tagfs-snapshot", rebuild_thread, NULL);
+    }
+  g_cond_signal(&s_rebuild_cond);
+  g_mutex_unlock(&s_rebuild_lock);
+}
+
+void snapshot_close(void)
+{
+  g_atomic_int_set(&s_live, 0);
+
+  g_mutex_lock(&s_rebuild_lock);
+  GThread* thread = s_rebuilder;
+  s_rebuilder = NULL;
+  s_rebuild_stop = TRUE;
+  s_rebuild_pending = FALSE;
+  g_cond_signal(&s_rebuild_cond);
+  g_mutex_unlock(&s_rebuild_lock);
+  if (thread != NULL)
+    g_thread_join(thread);
+
+  publish(NULL);
+}
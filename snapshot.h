@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <glib.h>
+
+#include "metainfo.h"
+
+/*
+ * An immutable image of a finished index: sorted string tables of
+ * attributes, values, names and paths, posting lists per (attribute,
+ * value) and offset arrays, all fixed-size native-endian records. It is
+ * queried in place, so loading costs nothing and mounts of the same
+ * snapshot file share its pages.
+ *
+ * Snapshots are served as generations: one is current, readers pin it
+ * for the duration of an operation without taking locks, and
+ * publishing the next one waits only for readers still pinning the
+ * previous one. Ids are those of the pinned generation.
+ */
+
+/* writes the finished scan in the index to filename */
+gboolean snapshot_write(const gchar* filename, GError** error);
+
+/* publish a snapshot file, or the index as it is now */
+gboolean snapshot_open(const gchar* filename, GError** error);
+gboolean snapshot_publish_index(GError** error);
+/*
+ * After a change to the index: publishes it again shortly after, so a
+ * burst of changes costs one rebuild. Only once the index was published.
+ */
+void snapshot_schedule_publish(void);
+/* stops publishing, readers fall back to the index */
+void snapshot_close(void);
+
+/*
+ * The functions below read the generation the calling thread pinned.
+ * Pins nest; publishing must not happen while holding one.
+ */
+void snapshot_pin(void);
+void snapshot_unpin(void);
+/* a generation is pinned, rather than none published */
+gboolean snapshot_is_open(void);
+/* distinct for every published generation, 0 if none is pinned */
+guint snapshot_generation(void);
+/* the scanned root */
+const gchar* snapshot_root(void);
+
+/* 0 if unknown; attributes are in lower case */
+gint snapshot_find_attr_id(const gchar* attr);
+gint snapshot_find_attr_value_id(const gchar* value);
+
+/*
+ * Path of a file named name having attr_id with any of value_ids, or
+ * with any value if there are none. NULL if there is no such file.
+ */
+const gchar* snapshot_find_file(gint attr_id, const gint* value_ids, guint value_count, const gchar* name);
+
+typedef void (*snapshot_name_func_t)(const gchar* name, gpointer user_data);
+
+/*
+ * Entries of a directory: attributes for attr_id 0, else names of the
+ * files having all value_ids followed by the other values they have.
+ */
+void snapshot_list_dir(gint attr_id, const gint* value_ids, guint value_count,
+		       snapshot_name_func_t func, gpointer user_data);
+
+/* NULL if path is not in the snapshot, or was at another modification time or size */
+Metainfo* snapshot_get_metainfo(const gchar* path, gint64 mtime, gint64 size);
+
+#endif
@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "spawn.h"
+#include "trace.h"
+
+#define READ_CHUNK 65536
+
+GQuark spawn_error_quark(void)
+{
+  return g_quark_from_static_string("spawn");
+}
+
+static guint env_uint(const gchar* name, guint def)
+{
+  const gchar* value = g_getenv(name);
+  return value != NULL ? (guint)strtoul(value, NULL, 10) : def;
+}
+
+const SpawnLimits* spawn_default_limits(void)
+{
+  static SpawnLimits limits;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized))
+    {
+      limits.timeout_ms = env_uint("TAGFS_SPAWN_TIMEOUT", 60000);
+      limits.cpu_seconds = env_uint("TAGFS_SPAWN_CPU", 60);
+      limits.memory_bytes = (gsize)env_uint("TAGFS_SPAWN_MEMORY", 4096) << 20;
+      limits.output_bytes = (gsize)env_uint("TAGFS_SPAWN_OUTPUT", 64) << 20;
+      g_once_init_leave(&initialized, 1);
+    }
+  return &limits;
+}
+
+gboolean spawn_start(const gchar* const* argv,
+		     const SpawnLimits* limits,
+		     int stdin_fd,
+		     int stdout_fd,
+		     pid_t* pid,
+		     GError** error)
+{
+  int devnull = -1;
+  if (stdin_fd < 0 || stdout_fd < 0)
+    {
+      devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+      if (devnull < 0)
+	{
+	  g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+		      "/dev/null: %s", g_strerror(errno));
+	  return FALSE;
+	}
+      if (stdin_fd < 0)
+	stdin_fd = devnull;
+      if (stdout_fd < 0)
+	stdout_fd = devnull;
+    }
+
+  /* everything the child needs is prepared here: it must not allocate */
+  struct rlimit cpu = { 0, 0 };
+  struct rlimit mem = { 0, 0 };
+  if (limits != NULL)
+    {
+      cpu.rlim_cur = limits->cpu_seconds;
+      cpu.rlim_max = limits->cpu_seconds + 1; /* SIGXCPU first, then SIGKILL */
+      mem.rlim_cur = mem.rlim_max = limits->memory_bytes;
+    }
+
+  volatile int exec_errno = 0;
+  pid_t child = vfork();
+  if (child == 0)
+    {
+      if (dup2(stdin_fd, STDIN_FILENO) < 0 || dup2(stdout_fd, STDOUT_FILENO) < 0)
+	{
+	  exec_errno = errno;
+	  _exit(127);
+	}
+      if (cpu.rlim_cur != 0)
+	setrlimit(RLIMIT_CPU, &cpu);
+      if (mem.rlim_cur != 0)
+	setrlimit(RLIMIT_DATA, &mem);
+      execvp(argv[0], (char* const*)argv);
+      exec_errno = errno; /* shared with the parent until exec */
+      _exit(127);
+    }
+
+  int saved_errno = errno;
+  if (devnull >= 0)
+    close(devnull);
+
+  if (child < 0)
+    {
+      g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+		  "vfork: %s", g_strerror(saved_errno));
+      return FALSE;
+    }
+
+  if (exec_errno != 0)
+    {
+      waitpid(child, NULL, 0);
+      g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+		  "Failed to execute %s: %s", argv[0], g_strerror(exec_errno));
+      return FALSE;
+    }
+
+  *pid = child;
+  return TRUE;
+}
+
+static gint64 get_deadline(const SpawnLimits* limits)
+{
+  if (limits == NULL || limits->timeout_ms == 0)
+    return G_MAXINT64;
+  return g_get_monotonic_time() + (gint64)limits->timeout_ms * 1000;
+}
+
+static int poll_timeout(gint64 deadline)
+{
+  if (deadline == G_MAXINT64)
+    return -1;
+  gint64 left = (deadline - g_get_monotonic_time() + 999) / 1000;
+  return left > 0 ? (int)MIN(left, G_MAXINT) : 0;
+}
+
+/* reaps the child, killing it once the deadline passes */
+static gboolean wait_child(const gchar* name, pid_t pid, gint64 deadline, GError** error)
+{
+  int status;
+  gboolean killed = FALSE;
+
+  while (TRUE)
+    {
+      pid_t r = waitpid(pid, &status, killed ? 0 : WNOHANG);
+      if (r == pid)
+	break;
+      if (r < 0 && errno != EINTR)
+	{
+	  g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+		      "waitpid: %s", g_strerror(errno));
+	  return FALSE;
+	}
+      if (g_get_monotonic_time() >= deadline)
+	{
+	  kill(pid, SIGKILL);
+	  killed = TRUE;
+	}
+      else if (r == 0)
+	g_usleep(1000);
+    }
+
+  if (killed)
+    {
+      g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_TIMEOUT,
+		  "%s did not exit in time.", name);
+      return FALSE;
+    }
+
+  if (WIFSIGNALED(status))
+    {
+      g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_SIGNALED,
+		  "%s was killed by signal %d%s.", name, WTERMSIG(status),
+		  WTERMSIG(status) == SIGXCPU ? " (CPU limit)" : "");
+      return FALSE;
+    }
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    {
+      g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_EXIT_STATUS,
+		  "%s exited with status %d.", name, WEXITSTATUS(status));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void abort_child(pid_t pid)
+{
+  kill(pid, SIGKILL);
+  while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+}
+
+gboolean spawn_and_read_output(const gchar* const* argv,
+			       const SpawnLimits* limits,
+			       read_callback_t callback,
+			       void* user_data,
+			       GError** error)
+{
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0)
+    {
+      g_set_error(error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+		  "pipe: %s", g_strerror(errno));
+      return FALSE;
+    }
+
+  guint64 child_start = trace_begin();
+
+  pid_t pid;
+  gboolean started = spawn_start(argv, limits, -1, fds[1], &pid, error);
+  close(fds[1]);
+  if (!started)
+    {
+      close(fds[0]);
+      return FALSE;
+    }
+
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+  gint64 deadline = get_deadline(limits);
+  gsize output_limit = limits != NULL ? limits->output_bytes : 0;
+  gsize total = 0;
+  GString* input = g_string_sized_new(READ_CHUNK);
+  gchar* buf = g_malloc(READ_CHUNK);
+  GError* read_error = NULL;
+
+  while (read_error == NULL)
+    {
+      struct pollfd pfd;
+      pfd.fd = fds[0];
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      int r = poll(&pfd, 1, poll_timeout(deadline));
+      if (r < 0)
+	{
+	  if (errno != EINTR)
+	    g_set_error(&read_error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+			"poll: %s", g_strerror(errno));
+	  continue;
+	}
+      if (r == 0)
+	{
+	  g_set_error(&read_error, SPAWN_ERROR, SPAWN_ERROR_TIMEOUT,
+		      "%s timed out after %u ms.", argv[0], limits->timeout_ms);
+	  continue;
+	}
+
+      ssize_t n = read(fds[0], buf, READ_CHUNK);
+      if (n < 0)
+	{
+	  if (errno != EAGAIN && errno != EINTR)
+	    g_set_error(&read_error, SPAWN_ERROR, SPAWN_ERROR_FAILED,
+			"read: %s", g_strerror(errno));
+	  continue;
+	}
+      if (n == 0)
+	break;
+
+      total += n;
+      if (output_limit != 0 && total > output_limit)
+	{
+	  g_set_error(&read_error, SPAWN_ERROR, SPAWN_ERROR_OUTPUT_LIMIT,
+		      "%s printed more than %" G_GSIZE_FORMAT " bytes.", argv[0], output_limit);
+	  continue;
+	}
+
+      g_string_append_len(input, buf, n);
+
+      guint64 parse_start = trace_begin();
+      gsize start = 0;
+      gchar* nl;
+      while ((nl = memchr(input->str + start, '\n', input->len - start)) != NULL)
+	{
+	  *nl = '\0';
+	  gchar* line = input->str + start;
+	  start = nl - input->str + 1;
+	  g_strchomp(line);
+	  callback(user_data, line);
+	}
+      g_string_erase(input, 0, start);
+      trace_end("parse", "extract", parse_start);
+    }
+
+  if (read_error == NULL && input->len != 0)
+    {
+      g_strchomp(input->str);
+      callback(user_data, input->str);
+    }
+
+  g_free(buf);
+  g_string_free(input, TRUE);
+  close(fds[0]);
+
+  if (read_error != NULL)
+    {
+      abort_child(pid);
+      g_propagate_error(error, read_error);
+      trace_end(g_intern_string(argv[0]), "child", child_start);
+      return FALSE;
+    }
+
+  gboolean result = wait_child(argv[0], pid, deadline, error);
+  trace_end(g_intern_string(argv[0]), "child", child_start);
+  return result;
+}
+
+gboolean spawn_and_wait(const gchar* const* argv,
+			const SpawnLimits* limits,
+			GError** error)
+{
+  pid_t pid;
+  if (!spawn_start(argv, limits, -1, -1, &pid, error))
+    return FALSE;
+  return wait_child(argv[0], pid, get_deadline(limits), error);
+}
@@ -0,0 +1,57 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+#include <glib.h>
+
+#include "helpers.h"
+
+#define SPAWN_ERROR spawn_error_quark()
+
+typedef enum
+{
+  SPAWN_ERROR_FAILED,       /* could not start the child */
+  SPAWN_ERROR_TIMEOUT,      /* wall-clock deadline exceeded */
+  SPAWN_ERROR_SIGNALED,     /* child killed by a signal (incl. rlimits) */
+  SPAWN_ERROR_EXIT_STATUS,  /* child exited with non-zero status */
+  SPAWN_ERROR_OUTPUT_LIMIT  /* child printed more than allowed */
+} SpawnError;
+
+typedef struct tagSpawnLimits
+{
+  guint timeout_ms;   /* wall clock, 0 - none */
+  guint cpu_seconds;  /* RLIMIT_CPU, 0 - none */
+  gsize memory_bytes; /* RLIMIT_DATA, 0 - none */
+  gsize output_bytes; /* stdout size, 0 - unlimited */
+} SpawnLimits;
+
+GQuark spawn_error_quark(void);
+
+/*
+ * Defaults come from TAGFS_SPAWN_TIMEOUT (ms), TAGFS_SPAWN_CPU (s),
+ * TAGFS_SPAWN_MEMORY (MiB) and TAGFS_SPAWN_OUTPUT (MiB).
+ */
+const SpawnLimits* spawn_default_limits(void);
+
+/*
+ * Starts argv[0] (looked up in PATH) without a shell. A negative fd
+ * connects the corresponding stream to /dev/null.
+ */
+gboolean spawn_start(const gchar* const* argv,
+		     const SpawnLimits* limits,
+		     int stdin_fd,
+		     int stdout_fd,
+		     pid_t* pid,
+		     GError** error);
+
+gboolean spawn_and_read_output(const gchar* const* argv,
+			       const SpawnLimits* limits,
+			       read_callback_t callback,
+			       void* user_data,
+			       GError** error);
+
+gboolean spawn_and_wait(const gchar* const* argv,
+			const SpawnLimits* limits,
+			GError** error);
+
+#endif
@@ -0,0 +1,154 @@
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "stats.h"
+
+/*
+ * Log-linear buckets: exact below 16ns, then 8 buckets per power of two,
+ * i.e. at most 12.5% error, up to about 39 hours.
+ */
+#define LINEAR 16
+#define SUB_BITS 3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_EXPONENT 47
+#define BUCKETS (LINEAR + (MAX_EXPONENT - 3) * SUB_BUCKETS)
+
+typedef struct tagHistogram
+{
+  guint64 sum;
+  guint64 max;
+  guint64 buckets[BUCKETS];
+} histogram_t;
+
+static histogram_t s_histograms[STAT_COUNT];
+
+static const gchar* const s_names[STAT_COUNT] = {
+  "getattr",
+  "readlink",
+  "readdir",
+  "open",
+  "read",
+  "write",
+  "truncate",
+  "access",
+  "sql.lookup",
+  "sql.realpath",
+  "sql.readdir",
+  "sql.insert",
+  "sql.get",
+  "sql.update",
+  "scan.prefetch",
+  "scan.magic",
+  "scan.extract",
+  "service.get",
+  "service.set",
+};
+
+guint64 stats_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static guint bucket_of(guint64 ns)
+{
+  if (ns < LINEAR)
+    return ns;
+
+  guint exponent = 63 - __builtin_clzll(ns);
+  guint bucket = LINEAR + (exponent - 4) * SUB_BUCKETS + ((ns >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+  return MIN(bucket, BUCKETS - 1);
+}
+
+/* middle of the bucket */
+static guint64 value_of(guint bucket)
+{
+  if (bucket < LINEAR)
+    return bucket;
+
+  guint exponent = (bucket - LINEAR) / SUB_BUCKETS + 4;
+  guint64 sub = (bucket - LINEAR) % SUB_BUCKETS;
+  guint64 width = (guint64)1 << (exponent - SUB_BITS);
+  return (SUB_BUCKETS + sub) * width + width / 2;
+}
+
+void stats_record(stat_t stat, guint64 start)
+{
+  guint64 ns = stats_now() - start;
+  histogram_t* h = &s_histograms[stat];
+
+  __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+
+  guint64 max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (ns > max
+	 && !__atomic_compare_exchange_n(&h->max, &max, ns, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static gdouble percentile(const guint64* buckets, guint64 count, gdouble p)
+{
+  guint64 rank = (guint64)(p * count + 0.5);
+  guint64 seen = 0;
+  guint i;
+  for (i = 0; i < BUCKETS; ++i)
+    {
+      seen += buckets[i];
+      if (seen >= rank && seen != 0)
+	return value_of(i) / 1000.0;
+    }
+  return 0;
+}
+
+gchar* stats_format(void)
+{
+  GString* out = g_string_new("# operation count mean_us p50_us p90_us p99_us p999_us max_us\n");
+
+  guint i;
+  for (i = 0; i < STAT_COUNT; ++i)
+    {
+      histogram_t* h = &s_histograms[i];
+
+      /* a snapshot, counts may move on while we copy */
+      guint64 buckets[BUCKETS];
+      guint64 count = 0;
+      guint j;
+      for (j = 0; j < BUCKETS; ++j)
+	{
+	  buckets[j] = __atomic_load_n(&h->buckets[j], __ATOMIC_RELAXED);
+	  count += buckets[j];
+	}
+      if (count == 0)
+	continue;
+
+      guint64 sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+      guint64 max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+      g_string_append_printf(out, "%s %" G_GUINT64_FORMAT " %.1f %.1f %.1f %.1f %.1f %.1f\n",
+			     s_names[i],
+			     count,
+			     sum / 1000.0 / count,
+			     percentile(buckets, count, 0.5),
+			     percentile(buckets, count, 0.9),
+			     percentile(buckets, count, 0.99),
+			     percentile(buckets, count, 0.999),
+			     max / 1000.0);
+    }
+
+  return g_string_free(out, FALSE);
+}
+
+void stats_reset(void)
+{
+  guint i, j;
+  for (i = 0; i < STAT_COUNT; ++i)
+    {
+      histogram_t* h = &s_histograms[i];
+      __atomic_store_n(&h->sum, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+      for (j = 0; j < BUCKETS; ++j)
+	__atomic_store_n(&h->buckets[j], 0, __ATOMIC_RELAXED);
+    }
+}
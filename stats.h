@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <glib.h>
+
+/*
+ * Per-operation counters and latency histograms. Recording is lock-free
+ * and cheap enough for every FUSE callback:
+ *
+ *   guint64 start = stats_now();
+ *   ...
+ *   stats_record(STAT_GETATTR, start);
+ */
+
+typedef enum
+{
+  /* FUSE callbacks */
+  STAT_GETATTR,
+  STAT_READLINK,
+  STAT_READDIR,
+  STAT_OPEN,
+  STAT_READ,
+  STAT_WRITE,
+  STAT_TRUNCATE,
+  STAT_ACCESS,
+  /* SQL statement classes */
+  STAT_SQL_LOOKUP,    /* attr and value ids of a path */
+  STAT_SQL_REALPATH,
+  STAT_SQL_READDIR,
+  STAT_SQL_INSERT,
+  STAT_SQL_GET,
+  STAT_SQL_UPDATE,
+  /* scanning */
+  STAT_PREFETCH,      /* a batch of files */
+  STAT_MAGIC,
+  STAT_EXTRACT,
+  /* metainfo service */
+  STAT_SERVICE_GET,
+  STAT_SERVICE_SET,
+  STAT_COUNT
+} stat_t;
+
+/* monotonic nanoseconds */
+guint64 stats_now(void);
+void stats_record(stat_t stat, guint64 start);
+
+/* one line per operation that ran, latencies in microseconds */
+gchar* stats_format(void);
+void stats_reset(void);
+
+#endif
@@ -5,14 +5,23 @@
 #include <gtk/gtk.h>
 #include <magic.h>
 #include "core.h"
+#include "batch.h"
+#include "plugins.h"
 
 int main(int argc, char** argv)
 {
+  if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+    {
+      argv[1] = argv[0];
+      return batch_main(argc - 1, argv + 1);
+    }
+
   gtk_init(&argc, &argv);
 
   if (argc != 2)
     {
-      fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+      fprintf(stderr, "Usage: %s <filename>\n"
+	      "       %s --batch --help\n", argv[0], argv[0]);
       exit(1);
     }
 
@@ -33,7 +42,7 @@ int main(int argc, char** argv)
   gtk_window_set_default_size(window, 400, 300);
   g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
 
-  const gchar* mime = NULL;
+  gchar* mime = NULL;
   {
     magic_t magic;
 
@@ -43,7 +52,7 @@ int main(int argc, char** argv)
     int magic_load_result = magic_load(magic, NULL);
     g_assert(magic_load_result == 0);
 
-    mime = magic_file(magic, filename);
+    mime = g_strdup(magic_file(magic, filename));
     if (mime == NULL)
       {
 	fprintf(stderr, "Error: Can't detect mime type (%s).\n", magic_error(magic));
@@ -54,8 +63,11 @@ int main(int argc, char** argv)
     magic_close(magic);
   }
 
+  plugins_load();
+
   GError* error = NULL;
   GtkWidget* page = get_page(filename, mime, &error);
+  g_free(mime);
   if (error != NULL)
     {
       fprintf(stderr,
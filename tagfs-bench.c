@@ -0,0 +1,669 @@
+/*
+ * tagfs-bench: generates reproducible corpora and measures scan throughput
+ * and FUSE operation latency. Results are printed one per line as
+ *
+ *   <benchmark>\t<metric>\t<value>\t<unit>
+ *
+ * after a "# tagfs-bench <format version>" header; the format only grows.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <magic.h>
+
+#include "index.h"
+#include "excache.h"
+#include "plugins.h"
+#include "scan.h"
+#include "query.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#define BENCH_FORMAT 1
+#define FANOUT 4 /* subdirectories per level */
+
+static gdouble now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const gchar* benchmark, const gchar* metric, gdouble value, const gchar* unit)
+{
+  printf("%s\t%s\t%.3f\t%s\n", benchmark, metric, value, unit);
+}
+
+static gint compare_double(gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble*)a;
+  gdouble y = *(const gdouble*)b;
+  return x < y ? -1 : x > y;
+}
+
+/* sorts samples */
+static gdouble percentile(GArray* samples, gdouble p)
+{
+  if (samples->len == 0)
+    return 0;
+  g_array_sort(samples, compare_double);
+  guint index = (guint)(p * (samples->len - 1) + 0.5);
+  return g_array_index(samples, gdouble, index);
+}
+
+/* corpus */
+
+typedef struct tagCorpus
+{
+  gint files;
+  gint djvu_percent;
+  gint keys;        /* extra keys besides Title, Author and Keywords */
+  gint values;      /* distinct values of every shared key */
+  gint depth;
+  gint size;        /* approximate file size in bytes */
+  gint seed;
+} corpus_t;
+
+typedef struct tagEntry
+{
+  const gchar* key;
+  gchar* value;
+} entry_t;
+
+static GPtrArray* make_metainfo(const corpus_t* corpus, GRand* rand, gint n)
+{
+  GPtrArray* entries = g_ptr_array_new();
+
+  entry_t* e = g_new(entry_t, 1);
+  e->key = "Title";
+  e->value = g_strdup_printf("Document %06d", n);
+  g_ptr_array_add(entries, e);
+
+  e = g_new(entry_t, 1);
+  e->key = "Author";
+  e->value = g_strdup_printf("Author %d", g_rand_int_range(rand, 0, corpus->values));
+  g_ptr_array_add(entries, e);
+
+  GString* keywords = g_string_new(NULL);
+  gint count = g_rand_int_range(rand, 1, 4);
+  gint i;
+  for (i = 0; i < count; ++i)
+    g_string_append_printf(keywords, "%skeyword%d", i ? ", " : "", g_rand_int_range(rand, 0, corpus->values));
+  e = g_new(entry_t, 1);
+  e->key = "Keywords";
+  e->value = g_string_free(keywords, FALSE);
+  g_ptr_array_add(entries, e);
+
+  static const gchar* const extra[] = { "Subject", "Creator", "Producer", "Series", "Publisher", "Language", "Edition", "Year" };
+  for (i = 0; i < corpus->keys && i < (gint)G_N_ELEMENTS(extra); ++i)
+    {
+      e = g_new(entry_t, 1);
+      e->key = extra[i];
+      e->value = g_strdup_printf("%s %d", extra[i], g_rand_int_range(rand, 0, corpus->values));
+      g_ptr_array_add(entries, e);
+    }
+
+  return entries;
+}
+
+static void free_metainfo(GPtrArray* entries)
+{
+  guint i;
+  for (i = 0; i < entries->len; ++i)
+    {
+      entry_t* e = g_ptr_array_index(entries, i);
+      g_free(e->value);
+      g_free(e);
+    }
+  g_ptr_array_free(entries, TRUE);
+}
+
+/* one blank page, an Info dictionary and a padding stream */
+static GString* make_pdf(GPtrArray* entries, gint size)
+{
+  GString* pdf = g_string_new("%PDF-1.4\n");
+  gsize offsets[6];
+
+  offsets[1] = pdf->len;
+  g_string_append(pdf, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+  offsets[2] = pdf->len;
+  g_string_append(pdf, "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+  offsets[3] = pdf->len;
+  g_string_append(pdf, "3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] >>\nendobj\n");
+
+  offsets[4] = pdf->len;
+  g_string_append(pdf, "4 0 obj\n<<");
+  guint i;
+  for (i = 0; i < entries->len; ++i)
+    {
+      entry_t* e = g_ptr_array_index(entries, i);
+      g_string_append_printf(pdf, " /%s (%s)", e->key, e->value);
+    }
+  g_string_append(pdf, " >>\nendobj\n");
+
+  gint padding = MAX(size - (gint)pdf->len - 256, 0);
+  offsets[5] = pdf->len;
+  g_string_append_printf(pdf, "5 0 obj\n<< /Length %d >>\nstream\n", padding);
+  gint j;
+  for (j = 0; j < padding; ++j)
+    g_string_append_c(pdf, ' ' + j % 64);
+  g_string_append(pdf, "\nendstream\nendobj\n");
+
+  gsize xref = pdf->len;
+  g_string_append(pdf, "xref\n0 6\n0000000000 65535 f \n");
+  for (i = 1; i < 6; ++i)
+    g_string_append_printf(pdf, "%010lu 00000 n \n", (gulong)offsets[i]);
+  g_string_append_printf(pdf,
+			 "trailer\n<< /Size 6 /Root 1 0 R /Info 4 0 R >>\nstartxref\n%lu\n%%%%EOF\n",
+			 (gulong)xref);
+  return pdf;
+}
+
+static void append_be32(GString* s, guint32 v)
+{
+  g_string_append_c(s, (v >> 24) & 0xff);
+  g_string_append_c(s, (v >> 16) & 0xff);
+  g_string_append_c(s, (v >> 8) & 0xff);
+  g_string_append_c(s, v & 0xff);
+}
+
+static void append_chunk(GString* s, const gchar* id, const gchar* data, gsize len)
+{
+  g_string_append_len(s, id, 4);
+  append_be32(s, len);
+  g_string_append_len(s, data, len);
+  if (len & 1)
+    g_string_append_c(s, '\0');
+}
+
+/* single blank page with a metadata annotation, padded with blanks */
+static GString* make_djvu(GPtrArray* entries, gint size)
+{
+  static const gchar info[10] = {
+    0, 100, 0, 100, /* width, height */
+    24, 0,          /* version */
+    100, 0,         /* dpi, little endian */
+    22, 1           /* gamma, rotation */
+  };
+
+  GString* ant = g_string_new("(metadata");
+  guint i;
+  for (i = 0; i < entries->len; ++i)
+    {
+      entry_t* e = g_ptr_array_index(entries, i);
+      g_string_append_printf(ant, " (%s \"%s\")", e->key, e->value);
+    }
+  g_string_append(ant, ")\n");
+  while ((gint)ant->len < size - 48)
+    g_string_append_c(ant, ' ');
+
+  GString* form = g_string_new_len("DJVU", 4);
+  append_chunk(form, "INFO", info, sizeof(info));
+  append_chunk(form, "ANTa", ant->str, ant->len);
+  g_string_free(ant, TRUE);
+
+  GString* djvu = g_string_new_len("AT&TFORM", 8);
+  append_be32(djvu, form->len);
+  g_string_append_len(djvu, form->str, form->len);
+  g_string_free(form, TRUE);
+  return djvu;
+}
+
+static gchar* corpus_dir(const gchar* root, const corpus_t* corpus, gint n)
+{
+  GString* path = g_string_new(root);
+  gint level;
+  gint k = n;
+  for (level = 0; level < corpus->depth; ++level)
+    {
+      g_string_append_printf(path, "/d%d", k % FANOUT);
+      k /= FANOUT;
+    }
+  return g_string_free(path, FALSE);
+}
+
+static int make_corpus(const gchar* root, const corpus_t* corpus)
+{
+  GRand* rand = g_rand_new_with_seed(corpus->seed);
+  GError* error = NULL;
+  gint n;
+
+  gdouble start = now();
+  for (n = 0; n < corpus->files; ++n)
+    {
+      gchar* dir = corpus_dir(root, corpus, n);
+      if (g_mkdir_with_parents(dir, 0755) != 0)
+	{
+	  fprintf(stderr, "Error: can't create %s: %s\n", dir, g_strerror(errno));
+	  g_free(dir);
+	  g_rand_free(rand);
+	  return 1;
+	}
+
+      gboolean djvu = g_rand_int_range(rand, 0, 100) < corpus->djvu_percent;
+      GPtrArray* entries = make_metainfo(corpus, rand, n);
+      GString* data = djvu ? make_djvu(entries, corpus->size) : make_pdf(entries, corpus->size);
+
+      gchar* filename = g_strdup_printf("%s/file%06d.%s", dir, n, djvu ? "djvu" : "pdf");
+      if (!g_file_set_contents(filename, data->str, data->len, &error))
+	{
+	  fprintf(stderr, "Error: %s\n", error->message);
+	  g_error_free(error);
+	  n = corpus->files + 1;
+	}
+
+      g_free(filename);
+      g_string_free(data, TRUE);
+      free_metainfo(entries);
+      g_free(dir);
+    }
+  g_rand_free(rand);
+
+  if (n > corpus->files)
+    return 1;
+
+  report("corpus", "files", corpus->files, "count");
+  report("corpus", "seconds", now() - start, "s");
+  return 0;
+}
+
+/* scan */
+
+static int bench_scan(const gchar* root, gint repeat, gint threads)
+{
+  magic_t magic = magic_open(MAGIC_MIME_TYPE);
+  g_assert(magic != NULL);
+
+  int magic_load_result = magic_load(magic, NULL);
+  g_assert(magic_load_result == 0);
+
+  if (plugins_load() == 0)
+    fprintf(stderr, "Warning: no plugins found\n");
+
+  GArray* rates = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  guint files = 0;
+  gint i;
+  for (i = 0; i < repeat; ++i)
+    {
+      index_open(NULL, FALSE, NULL);
+      gdouble start = now();
+      files = scan_tree(magic, root, threads);
+      gdouble rate = files / MAX(now() - start, 1e-9);
+      index_close();
+      g_array_append_val(rates, rate);
+    }
+
+  report("scan", "files", files, "count");
+  report("scan", "repeat", repeat, "count");
+  report("scan", "threads", threads, "count");
+  report("scan", "rate_min", percentile(rates, 0), "files/s");
+  report("scan", "rate_median", percentile(rates, 0.5), "files/s");
+  report("scan", "rate_max", percentile(rates, 1), "files/s");
+
+  guint hits, misses;
+  excache_counts(&hits, &misses);
+  report("scan", "cache_hits", hits, "count");
+  report("scan", "cache_misses", misses, "count");
+
+  g_array_free(rates, TRUE);
+  /* span names point into the plugins */
+  trace_shutdown();
+  plugins_unload();
+  magic_close(magic);
+  return 0;
+}
+
+/* fuse */
+
+typedef struct tagLatencies
+{
+  GArray* getattr;
+  GArray* readdir;
+  GArray* readlink;
+} latencies_t;
+
+static void add_sample(GArray* samples, gdouble start)
+{
+  gdouble us = (now() - start) * 1e6;
+  g_array_append_val(samples, us);
+}
+
+static void walk_mount(const gchar* path, gint depth, latencies_t* lat)
+{
+  gdouble start = now();
+  DIR* d = opendir(path);
+  if (d == NULL)
+    return;
+
+  GPtrArray* names = g_ptr_array_new_with_free_func(g_free);
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL)
+    if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))
+      g_ptr_array_add(names, g_strdup(e->d_name));
+  closedir(d);
+  add_sample(lat->readdir, start);
+
+  guint i;
+  for (i = 0; i < names->len; ++i)
+    {
+      gchar* full_name = g_build_filename(path, g_ptr_array_index(names, i), NULL);
+
+      struct stat st;
+      start = now();
+      int res = lstat(full_name, &st);
+      add_sample(lat->getattr, start);
+
+      if (res == 0 && S_ISLNK(st.st_mode))
+	{
+	  gchar target[4096];
+	  start = now();
+	  if (readlink(full_name, target, sizeof(target)) >= 0)
+	    add_sample(lat->readlink, start);
+	}
+      else if (res == 0 && S_ISDIR(st.st_mode) && depth > 0)
+	walk_mount(full_name, depth - 1, lat);
+
+      g_free(full_name);
+    }
+  g_ptr_array_free(names, TRUE);
+}
+
+static void report_latency(const gchar* op, GArray* samples)
+{
+  gchar* benchmark = g_strdup_printf("fuse.%s", op);
+  report(benchmark, "count", samples->len, "count");
+  report(benchmark, "p50", percentile(samples, 0.5), "us");
+  report(benchmark, "p90", percentile(samples, 0.9), "us");
+  report(benchmark, "p99", percentile(samples, 0.99), "us");
+  report(benchmark, "max", percentile(samples, 1), "us");
+  g_free(benchmark);
+}
+
+static int bench_fuse(const gchar* mountpoint, gint repeat, gint depth)
+{
+  latencies_t lat;
+  lat.getattr = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  lat.readdir = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  lat.readlink = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
+  gint i;
+  for (i = 0; i < repeat; ++i)
+    walk_mount(mountpoint, depth, &lat);
+
+  if (lat.readdir->len == 0)
+    {
+      fprintf(stderr, "Error: can't read %s\n", mountpoint);
+      return 1;
+    }
+
+  report_latency("getattr", lat.getattr);
+  report_latency("readdir", lat.readdir);
+  report_latency("readlink", lat.readlink);
+
+  g_array_free(lat.getattr, TRUE);
+  g_array_free(lat.readdir, TRUE);
+  g_array_free(lat.readlink, TRUE);
+  return 0;
+}
+
+/* query: hot-path functions against an in-memory index */
+
+#define QUERY_KEYWORDS 8  /* per file, so paths can be up to 8 values deep */
+#define QUERY_PATHS 64
+#define QUERY_MIN_NS 20000000 /* per run */
+
+typedef enum
+{
+  QUERY_SPLIT_PATH,
+  QUERY_IDS_STRING,
+  QUERY_FIND_REALPATH
+} query_op_t;
+
+static void populate_index(gint files, gint values, GRand* rand, GPtrArray* keywords)
+{
+  gint n;
+  for (n = 0; n < files; ++n)
+    {
+      /* distinct keywords, in a random order */
+      GArray* picked = g_array_new(FALSE, FALSE, sizeof(gint));
+      while (picked->len < MIN(QUERY_KEYWORDS, values))
+	{
+	  gint k = g_rand_int_range(rand, 0, values);
+	  guint i;
+	  for (i = 0; i < picked->len && g_array_index(picked, gint, i) != k; ++i)
+	    ;
+	  if (i == picked->len)
+	    g_array_append_val(picked, k);
+	}
+
+      GString* value = g_string_new(NULL);
+      guint i;
+      for (i = 0; i < picked->len; ++i)
+	g_string_append_printf(value, "%skeyword%d", i ? ", " : "", g_array_index(picked, gint, i));
+      g_ptr_array_add(keywords, picked);
+
+      Metainfo* metainfo = metainfo_new();
+      metainfo_set(metainfo, "Keywords", value->str);
+      g_string_free(value, TRUE);
+
+      gchar* name = g_strdup_printf("file%06d.pdf", n);
+      gchar* path = g_strdup_printf("/corpus/%s", name);
+      index_add_file(name, path, metainfo, 0, 0);
+      g_free(path);
+      g_free(name);
+      metainfo_free(metainfo);
+    }
+}
+
+/* mount paths of random files through their first depth keywords */
+static gchar** make_paths(GPtrArray* keywords, gint depth, GRand* rand)
+{
+  gchar** paths = g_new0(gchar*, QUERY_PATHS + 1);
+  gint i;
+  for (i = 0; i < QUERY_PATHS; ++i)
+    {
+      gint n = g_rand_int_range(rand, 0, keywords->len);
+      GArray* picked = g_ptr_array_index(keywords, n);
+
+      GString* path = g_string_new("/Keywords");
+      gint d;
+      for (d = 0; d < depth && d < (gint)picked->len; ++d)
+	g_string_append_printf(path, "/keyword%d", g_array_index(picked, gint, d));
+      g_string_append_printf(path, "/file%06d.pdf", n);
+      paths[i] = g_string_free(path, FALSE);
+    }
+  return paths;
+}
+
+static void run_query_op(query_op_t op, gchar** paths, path_t* split, guint64 iterations)
+{
+  path_t sp;
+  gchar realpath[PATH_MAX];
+  guint64 i;
+  for (i = 0; i < iterations; ++i)
+    {
+      guint k = i % QUERY_PATHS;
+      switch (op)
+	{
+	case QUERY_SPLIT_PATH:
+	  split_path(paths[k], &sp);
+	  break;
+	case QUERY_IDS_STRING:
+	  g_free(get_ids_string(&split[k]));
+	  break;
+	case QUERY_FIND_REALPATH:
+	  find_realpath(paths[k], realpath, sizeof(realpath), NULL);
+	  break;
+	}
+    }
+}
+
+/* ns per call: median and minimum over runs of at least QUERY_MIN_NS */
+static void measure_query_op(const gchar* name, gint depth, query_op_t op,
+			     gchar** paths, path_t* split, gint repeat)
+{
+  /* calibrate, which also warms up caches */
+  guint64 iterations = QUERY_PATHS;
+  for (;;)
+    {
+      gdouble start = now();
+      run_query_op(op, paths, split, iterations);
+      if ((now() - start) * 1e9 >= QUERY_MIN_NS / 4)
+	break;
+      iterations *= 2;
+    }
+  iterations *= 4;
+
+  GArray* samples = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  gint r;
+  for (r = 0; r < repeat; ++r)
+    {
+      gdouble start = now();
+      run_query_op(op, paths, split, iterations);
+      gdouble ns = (now() - start) * 1e9 / iterations;
+      g_array_append_val(samples, ns);
+    }
+
+  gchar* benchmark = g_strdup_printf("query.%s.d%d", name, depth);
+  gdouble median = percentile(samples, 0.5);
+  report(benchmark, "median", median, "ns");
+  report(benchmark, "min", percentile(samples, 0), "ns");
+  report(benchmark, "spread", (percentile(samples, 1) - percentile(samples, 0)) / median * 100, "%");
+  g_free(benchmark);
+  g_array_free(samples, TRUE);
+}
+
+static int bench_query(const corpus_t* corpus, gint repeat)
+{
+  static const gint depths[] = { 0, 1, 2, 4, 8 };
+
+  GRand* rand = g_rand_new_with_seed(corpus->seed);
+  GPtrArray* keywords = g_ptr_array_new();
+
+  index_open(NULL, FALSE, NULL);
+  index_scan_start("/corpus");
+  populate_index(corpus->files, corpus->values, rand, keywords);
+  index_scan_finish();
+  index_analyze();
+
+  /* the same files again, served from a snapshot */
+  gchar* snapshot = NULL;
+  gint fd = g_file_open_tmp("tagfs-bench-XXXXXX.snapshot", &snapshot, NULL);
+  g_assert(fd != -1);
+  close(fd);
+  gboolean written = snapshot_write(snapshot, NULL);
+  g_assert(written);
+
+  report("query", "files", corpus->files, "count");
+  report("query", "values", corpus->values, "count");
+
+  guint i;
+  for (i = 0; i < G_N_ELEMENTS(depths); ++i)
+    {
+      gchar** paths = make_paths(keywords, depths[i], rand);
+      path_t split[QUERY_PATHS];
+      gint k;
+      query_begin();
+      for (k = 0; k < QUERY_PATHS; ++k)
+	split_path(paths[k], &split[k]);
+
+      measure_query_op("split_path", depths[i], QUERY_SPLIT_PATH, paths, split, repeat);
+      measure_query_op("get_ids_string", depths[i], QUERY_IDS_STRING, paths, split, repeat);
+      measure_query_op("find_realpath", depths[i], QUERY_FIND_REALPATH, paths, split, repeat);
+      query_end();
+
+      snapshot_open(snapshot, NULL);
+      query_begin();
+      measure_query_op("snapshot.split_path", depths[i], QUERY_SPLIT_PATH, paths, split, repeat);
+      measure_query_op("snapshot.find_realpath", depths[i], QUERY_FIND_REALPATH, paths, split, repeat);
+      query_end();
+      snapshot_close();
+
+      g_strfreev(paths);
+    }
+
+  index_close();
+  g_unlink(snapshot);
+  g_free(snapshot);
+
+  for (i = 0; i < keywords->len; ++i)
+    g_array_free(g_ptr_array_index(keywords, i), TRUE);
+  g_ptr_array_free(keywords, TRUE);
+  g_rand_free(rand);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  trace_init_from_env();
+
+  corpus_t corpus = { 1000, 50, 2, 50, 2, 4096, 1 };
+  gint repeat = 3;
+  gint depth = 2;
+  gint threads = 1;
+  gboolean cache = FALSE;
+
+  GOptionEntry entries[] = {
+    { "files", 'n', 0, G_OPTION_ARG_INT, &corpus.files, "corpus, query: number of files (1000)", "N" },
+    { "djvu", 0, 0, G_OPTION_ARG_INT, &corpus.djvu_percent, "corpus: percentage of DjVu files (50)", "P" },
+    { "keys", 'k', 0, G_OPTION_ARG_INT, &corpus.keys, "corpus: extra keys per file, up to 8 (2)", "K" },
+    { "values", 'v', 0, G_OPTION_ARG_INT, &corpus.values, "corpus, query: distinct values per key (50)", "V" },
+    { "dir-depth", 0, 0, G_OPTION_ARG_INT, &corpus.depth, "corpus: directory depth (2)", "D" },
+    { "size", 's', 0, G_OPTION_ARG_INT, &corpus.size, "corpus: approximate file size in bytes (4096)", "BYTES" },
+    { "seed", 0, 0, G_OPTION_ARG_INT, &corpus.seed, "corpus, query: random seed (1)", "SEED" },
+    { "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat, "scan, fuse, query: number of runs (3)", "N" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &threads, "scan: directory walking threads (1)", "N" },
+    { "cache", 0, 0, G_OPTION_ARG_NONE, &cache, "scan: use the extraction cache (off: every file is extracted)", NULL },
+    { "depth", 'd', 0, G_OPTION_ARG_INT, &depth, "fuse: levels of the mount to walk (2)", "D" },
+    { NULL }
+  };
+
+  GOptionContext* context = g_option_context_new("corpus DIR | scan DIR | fuse MOUNTPOINT | query");
+  g_option_context_add_main_entries(context, entries, NULL);
+
+  GError* error = NULL;
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+
+  gboolean query = argc == 2 && strcmp(argv[1], "query") == 0;
+  if ((argc != 3 && !query) || corpus.files < 1 || corpus.values < 1 || repeat < 1 || threads < 1)
+    {
+      gchar* help = g_option_context_get_help(context, TRUE, NULL);
+      fputs(help, stderr);
+      g_free(help);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  printf("# tagfs-bench %d\n", BENCH_FORMAT);
+
+  if (query)
+    return bench_query(&corpus, repeat);
+  if (strcmp(argv[1], "corpus") == 0)
+    return make_corpus(argv[2], &corpus);
+  if (strcmp(argv[1], "scan") == 0)
+    {
+      /* else a second run only measures cache hits */
+      if (!cache)
+	g_setenv("TAGFS_EXTRACT_CACHE", "", TRUE);
+      return bench_scan(argv[2], repeat, threads);
+    }
+  if (strcmp(argv[1], "fuse") == 0)
+    return bench_fuse(argv[2], repeat, depth);
+
+  fprintf(stderr, "Error: unknown benchmark %s\n", argv[1]);
+  return 1;
+}
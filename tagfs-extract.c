@@ -0,0 +1,82 @@
+/*
+ * tagfs-extract: the helper process plugins_start_helpers() keeps a pool
+ * of. Reads "<plugin>\t<path>" requests, the path escaped as by
+ * g_strescape, one per line on stdin, extracts with the named plugin and
+ * answers as coproc.h describes, with "<key>\t<value>" lines escaped the
+ * same way. Exits at the end of its input.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "coproc.h"
+#include "plugins.h"
+
+static void write_pair(const gchar* key, const gchar* value, gpointer user_data)
+{
+  gchar* k = g_strescape(key, NULL);
+  gchar* v = g_strescape(value, NULL);
+  printf("%s\t%s\n", k, v);
+  g_free(k);
+  g_free(v);
+}
+
+static void answer(const gchar* request)
+{
+  const gchar* tab = strchr(request, '\t');
+  gchar* name = tab != NULL ? g_strndup(request, tab - request) : NULL;
+  const PluginInterface* plugin = name != NULL ? plugins_find_name(name) : NULL;
+  if (plugin == NULL)
+    {
+      printf(COPROC_END_MARKER "%s: no such plugin\n", name != NULL ? name : request);
+      g_free(name);
+      return;
+    }
+
+  gchar* path = g_strcompress(tab + 1);
+  GError* error = NULL;
+  Metainfo* metainfo = plugins_get_metainfo(plugin, path, &error);
+  if (metainfo != NULL)
+    {
+      metainfo_foreach(metainfo, write_pair, NULL);
+      puts(COPROC_END_MARKER);
+      metainfo_free(metainfo);
+    }
+  else
+    {
+      /* the answer ends at the line break */
+      gchar* message = g_strdup(error != NULL ? error->message : "extraction failed");
+      g_strdelimit(message, "\r\n", ' ');
+      printf(COPROC_END_MARKER "%s\n", message);
+      g_free(message);
+    }
+
+  if (error != NULL)
+    g_error_free(error);
+  g_free(path);
+  g_free(name);
+}
+
+int main(int argc, char** argv)
+{
+  /* the host looks up and stores extraction results itself */
+  g_setenv("TAGFS_EXTRACT_CACHE", "", TRUE);
+  plugins_load();
+
+  gchar* line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &size, stdin)) > 0)
+    {
+      if (line[len - 1] == '\n')
+	line[len - 1] = '\0';
+      answer(line);
+      fflush(stdout);
+    }
+
+  free(line);
+  plugins_unload();
+  return 0;
+}
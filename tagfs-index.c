@@ -0,0 +1,107 @@
+/*
+ * tagfs-index: scans a directory tree into an index file once, so that
+ * it can be mounted with -o index=FILE,prebuilt without scanning, and
+ * optionally writes a snapshot of it for -o snapshot=FILE. An
+ * interrupted run continues where it stopped.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <glib.h>
+#include <magic.h>
+
+#include "index.h"
+#include "plugins.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "trace.h"
+
+static gdouble now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+  trace_init_from_env();
+
+  gint threads = g_get_num_processors();
+  gchar* snapshot = NULL;
+
+  GOptionEntry entries[] = {
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &threads, "directory walking threads (number of processors)", "N" },
+    { "snapshot", 's', 0, G_OPTION_ARG_FILENAME, &snapshot, "also write a snapshot", "FILE" },
+    { NULL }
+  };
+
+  GOptionContext* context = g_option_context_new("ROOT INDEX");
+  g_option_context_add_main_entries(context, entries, NULL);
+
+  GError* error = NULL;
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+
+  if (argc != 3 || threads < 1)
+    {
+      gchar* help = g_option_context_get_help(context, TRUE, NULL);
+      fputs(help, stderr);
+      g_free(help);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  /* the same canonical root mount.tagfs compares with */
+  gchar* canonical = realpath(argv[1], NULL);
+  if (canonical == NULL)
+    {
+      perror(argv[1]);
+      return 1;
+    }
+  gchar* root = g_strdup(canonical);
+  free(canonical);
+
+  magic_t magic = magic_open(MAGIC_MIME_TYPE);
+  if (magic == NULL || magic_load(magic, NULL) != 0)
+    {
+      fprintf(stderr, "Error: cannot load magic database\n");
+      return 1;
+    }
+
+  if (plugins_load() == 0)
+    fprintf(stderr, "Warning: no plugins found\n");
+
+  if (!index_open(argv[2], FALSE, &error))
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+
+  gdouble start = now();
+  guint files = scan_tree(magic, root, threads);
+  index_finalize();
+  gboolean written = snapshot == NULL || snapshot_write(snapshot, &error);
+  index_close();
+
+  printf("%u files from %s in %.1f s\n", files, root, now() - start);
+  if (!written)
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+    }
+
+  /* span names point into the plugins */
+  trace_shutdown();
+  plugins_unload();
+  magic_close(magic);
+  g_free(snapshot);
+  g_free(root);
+  return written ? 0 : 1;
+}
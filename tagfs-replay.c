@@ -0,0 +1,323 @@
+/*
+ * tagfs-replay: re-issues the operations recorded by mount.tagfs
+ * -o record=FILE against a mount, at the recorded pace or as fast as
+ * possible. Results are printed like tagfs-bench results:
+ *
+ *   <benchmark>\t<metric>\t<value>\t<unit>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "optrace.h"
+
+#define REPLAY_FORMAT 1
+/* per read or write, above what FUSE passes in one request; a corrupt
+   trace must not make the replay allocate its sizes */
+#define REPLAY_MAX_IO (1024 * 1024)
+
+typedef struct tagReplay
+{
+  const gchar* mountpoint;
+  GArray* records;
+  gdouble* latencies;   /* us, per record */
+  gint64* results;      /* per record */
+} replay_t;
+
+static gdouble now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const gchar* benchmark, const gchar* metric, gdouble value, const gchar* unit)
+{
+  printf("%s\t%s\t%.3f\t%s\n", benchmark, metric, value, unit);
+}
+
+static gint compare_double(gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble*)a;
+  gdouble y = *(const gdouble*)b;
+  return x < y ? -1 : x > y;
+}
+
+/* sorts samples */
+static gdouble percentile(GArray* samples, gdouble p)
+{
+  if (samples->len == 0)
+    return 0;
+  g_array_sort(samples, compare_double);
+  guint index = (guint)(p * (samples->len - 1) + 0.5);
+  return g_array_index(samples, gdouble, index);
+}
+
+static gint compare_start(gconstpointer a, gconstpointer b)
+{
+  const optrace_record_t* x = a;
+  const optrace_record_t* y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static gint64 read_range(const gchar* path, guint64 size, guint64 offset)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return -errno;
+  size = MIN(size, REPLAY_MAX_IO);
+  gchar* buf = g_malloc(MAX(size, 1));
+  ssize_t result = pread(fd, buf, size, offset);
+  gint64 r = result == -1 ? -errno : result;
+  g_free(buf);
+  close(fd);
+  return r;
+}
+
+static gint64 write_range(const gchar* path, guint64 size, guint64 offset)
+{
+  int fd = open(path, O_WRONLY | O_NOFOLLOW);
+  if (fd == -1)
+    return -errno;
+  size = MIN(size, REPLAY_MAX_IO);
+  gchar* buf = g_malloc0(MAX(size, 1));
+  ssize_t result = pwrite(fd, buf, size, offset);
+  gint64 r = result == -1 ? -errno : result;
+  g_free(buf);
+  close(fd);
+  return r;
+}
+
+/*
+ * The nearest system calls to the recorded operation. File handles are
+ * not recorded, so reads and writes open the file themselves. Nothing
+ * that writes follows a symlink, so a trace cannot reach the files a
+ * mount links to.
+ */
+static gint64 replay_op(const optrace_record_t* record, const gchar* path)
+{
+  struct stat st;
+  gchar link[4096];
+  int fd;
+  gint64 result;
+  DIR* dir;
+
+  switch (record->op)
+    {
+    case OPTRACE_GETATTR:
+      return lstat(path, &st) == -1 ? -errno : 0;
+    case OPTRACE_ACCESS:
+      return access(path, record->arg1) == -1 ? -errno : 0;
+    case OPTRACE_READLINK:
+      return readlink(path, link, sizeof(link)) == -1 ? -errno : 0;
+    case OPTRACE_READDIR:
+      dir = opendir(path);
+      if (dir == NULL)
+	return -errno;
+      while (readdir(dir) != NULL)
+	;
+      closedir(dir);
+      return 0;
+    case OPTRACE_OPEN:
+      fd = open(path, (record->arg1 & ~(O_CREAT | O_EXCL)) | O_NOFOLLOW);
+      if (fd == -1)
+	return -errno;
+      close(fd);
+      return 0;
+    case OPTRACE_READ:
+      return read_range(path, record->arg1, record->arg2);
+    case OPTRACE_WRITE:
+      return write_range(path, record->arg1, record->arg2);
+    case OPTRACE_TRUNCATE:
+      fd = open(path, O_WRONLY | O_NOFOLLOW);
+      if (fd == -1)
+	return -errno;
+      result = ftruncate(fd, record->arg1) == -1 ? -errno : 0;
+      close(fd);
+      return result;
+    default:
+      return -ENOSYS;
+    }
+}
+
+static void replay_job(gpointer data, gpointer user_data)
+{
+  guint index = GPOINTER_TO_UINT(data) - 1;
+  replay_t* replay = user_data;
+  const optrace_record_t* record = &g_array_index(replay->records, optrace_record_t, index);
+
+  gchar* path = g_strconcat(replay->mountpoint, record->path, NULL);
+  gdouble start = now();
+  replay->results[index] = replay_op(record, path);
+  replay->latencies[index] = (now() - start) * 1e6;
+  g_free(path);
+}
+
+static void wait_until(gdouble deadline)
+{
+  gdouble delay = deadline - now();
+  if (delay > 0)
+    g_usleep(delay * 1e6);
+}
+
+static int replay(const gchar* filename, const gchar* mountpoint, gdouble speed, gint jobs)
+{
+  GError* error = NULL;
+  GArray* records = optrace_load(filename, &error);
+  if (records == NULL)
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+  g_array_sort(records, compare_start);
+
+  replay_t replay = {
+    mountpoint,
+    records,
+    g_new0(gdouble, records->len),
+    g_new0(gint64, records->len)
+  };
+
+  GThreadPool* pool = g_thread_pool_new(replay_job, &replay, jobs, TRUE, NULL);
+  gdouble start = now();
+  guint i;
+  for (i = 0; i < records->len; ++i)
+    {
+      const optrace_record_t* record = &g_array_index(records, optrace_record_t, i);
+      if (speed > 0)
+	wait_until(start + record->start / 1e9 / speed);
+      g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+    }
+  g_thread_pool_free(pool, FALSE, TRUE);
+  gdouble elapsed = now() - start;
+
+  gdouble recorded = records->len > 0
+    ? g_array_index(records, optrace_record_t, records->len - 1).start / 1e9
+    : 0;
+  report("replay", "operations", records->len, "count");
+  report("replay", "recorded", recorded, "s");
+  report("replay", "elapsed", elapsed, "s");
+  report("replay", "throughput", elapsed > 0 ? records->len / elapsed : 0, "ops/s");
+
+  gint op;
+  for (op = 0; op < OPTRACE_COUNT; ++op)
+    {
+      GArray* samples = g_array_new(FALSE, FALSE, sizeof(gdouble));
+      GArray* recorded_samples = g_array_new(FALSE, FALSE, sizeof(gdouble));
+      guint diverged = 0;
+      for (i = 0; i < records->len; ++i)
+	{
+	  const optrace_record_t* record = &g_array_index(records, optrace_record_t, i);
+	  if (record->op != op)
+	    continue;
+	  gdouble recorded_us = record->duration / 1e3;
+	  g_array_append_val(samples, replay.latencies[i]);
+	  g_array_append_val(recorded_samples, recorded_us);
+	  /* success and failure should match; byte counts may not */
+	  if ((record->result < 0) != (replay.results[i] < 0))
+	    ++diverged;
+	}
+
+      if (samples->len > 0)
+	{
+	  gchar* benchmark = g_strdup_printf("replay.%s", optrace_op_name(op));
+	  report(benchmark, "count", samples->len, "count");
+	  report(benchmark, "p50", percentile(samples, 0.5), "us");
+	  report(benchmark, "p99", percentile(samples, 0.99), "us");
+	  report(benchmark, "max", percentile(samples, 1), "us");
+	  /* in the daemon, without the kernel round trip */
+	  report(benchmark, "recorded_p50", percentile(recorded_samples, 0.5), "us");
+	  report(benchmark, "recorded_p99", percentile(recorded_samples, 0.99), "us");
+	  report(benchmark, "diverged", diverged, "count");
+	  g_free(benchmark);
+	}
+      g_array_free(samples, TRUE);
+      g_array_free(recorded_samples, TRUE);
+    }
+
+  g_free(replay.latencies);
+  g_free(replay.results);
+  optrace_free(records);
+  return 0;
+}
+
+static int dump(const gchar* filename)
+{
+  GError* error = NULL;
+  GArray* records = optrace_load(filename, &error);
+  if (records == NULL)
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+
+  guint i;
+  for (i = 0; i < records->len; ++i)
+    {
+      const optrace_record_t* record = &g_array_index(records, optrace_record_t, i);
+      printf("%.6f\t%u\t%s\t%s\t%" G_GINT64_FORMAT "\t%.3f\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT "\n",
+	     record->start / 1e9, record->thread, optrace_op_name(record->op), record->path,
+	     record->result, record->duration / 1e3, record->arg1, record->arg2);
+    }
+  optrace_free(records);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  gdouble speed = 1;
+  gint jobs = 4;
+  gboolean dump_only = FALSE;
+
+  GOptionEntry entries[] = {
+    { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed, "multiple of the recorded pace, 0 for as fast as possible (1)", "F" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "operations in flight at most (4)", "N" },
+    { "dump", 0, 0, G_OPTION_ARG_NONE, &dump_only, "print the trace as text instead of replaying it", NULL },
+    { NULL }
+  };
+
+  GOptionContext* context = g_option_context_new("TRACE [MOUNTPOINT]");
+  g_option_context_add_main_entries(context, entries, NULL);
+
+  GError* error = NULL;
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+      return 1;
+    }
+
+  if (argc != (dump_only ? 2 : 3) || speed < 0 || jobs < 1)
+    {
+      gchar* help = g_option_context_get_help(context, TRUE, NULL);
+      fputs(help, stderr);
+      g_free(help);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if (dump_only)
+    return dump(argv[1]);
+
+  printf("# tagfs-replay %d\n", REPLAY_FORMAT);
+
+  /* recorded paths are absolute within the mount */
+  gchar* mountpoint = g_strdup(argv[2]);
+  gsize len = strlen(mountpoint);
+  while (len > 1 && mountpoint[len - 1] == '/')
+    mountpoint[--len] = '\0';
+
+  int result = replay(argv[1], mountpoint, speed, jobs);
+  g_free(mountpoint);
+  return result;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <glib.h>
+
+#include "trace.h"
+
+#define DEFAULT_RING 65536
+
+typedef struct tagSpan
+{
+  const gchar* name;
+  const gchar* category;
+  guint64 start;
+  guint64 end;
+  gint tid;
+} span_t;
+
+trace_sink_t trace_sink = NULL;
+
+/* ring mode: a fixed array written lock-free, oldest spans overwritten */
+static span_t* s_ring = NULL;
+static guint64 s_ring_size = 0;
+static guint64 s_ring_next = 0;
+
+/* full mode: every span, written at exit */
+static GArray* s_spans = NULL;
+static GMutex s_lock;
+
+static gchar* s_filename = NULL;
+
+guint64 trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (guint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static gint thread_id(void)
+{
+  static __thread gint tid = 0;
+  if (tid == 0)
+    tid = syscall(SYS_gettid);
+  return tid;
+}
+
+static void record_ring(const gchar* name, const gchar* category, guint64 start, guint64 end)
+{
+  guint64 index = __atomic_fetch_add(&s_ring_next, 1, __ATOMIC_RELAXED) % s_ring_size;
+  span_t* span = &s_ring[index];
+  span->name = name;
+  span->category = category;
+  span->start = start;
+  span->end = end;
+  span->tid = thread_id();
+}
+
+static void record_all(const gchar* name, const gchar* category, guint64 start, guint64 end)
+{
+  span_t span = { name, category, start, end, thread_id() };
+  g_mutex_lock(&s_lock);
+  g_array_append_val(s_spans, span);
+  g_mutex_unlock(&s_lock);
+}
+
+void trace_init_from_env(void)
+{
+  const gchar* filename = g_getenv("TAGFS_TRACE");
+  const gchar* ring = g_getenv("TAGFS_TRACE_RING");
+
+  if (filename != NULL && *filename != '\0')
+    s_filename = g_strdup(filename);
+
+  if (ring != NULL && *ring != '\0')
+    {
+      s_ring_size = g_ascii_strtoull(ring, NULL, 10);
+      if (s_ring_size == 0)
+	s_ring_size = DEFAULT_RING;
+      s_ring = g_new0(span_t, s_ring_size);
+      trace_sink = record_ring;
+    }
+  else if (s_filename != NULL)
+    {
+      s_spans = g_array_new(FALSE, FALSE, sizeof(span_t));
+      trace_sink = record_all;
+    }
+}
+
+static void append_span(GString* out, const span_t* span, gint pid)
+{
+  if (span->name == NULL)
+    return;
+  if (out->str[out->len - 1] != '[')
+    g_string_append(out, ",\n");
+  g_string_append_printf(out,
+			 "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" G_GUINT64_FORMAT
+			 ",\"dur\":%" G_GUINT64_FORMAT ",\"pid\":%d,\"tid\":%d}",
+			 span->name, span->category, span->start, span->end - span->start, pid, span->tid);
+}
+
+gchar* trace_format(void)
+{
+  GString* out = g_string_new("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  gint pid = getpid();
+
+  if (s_ring != NULL)
+    {
+      /* spans being written while we copy may come out torn */
+      guint64 next = __atomic_load_n(&s_ring_next, __ATOMIC_RELAXED);
+      guint64 first = next > s_ring_size ? next - s_ring_size : 0;
+      guint64 i;
+      for (i = first; i < next; ++i)
+	{
+	  span_t span = s_ring[i % s_ring_size];
+	  append_span(out, &span, pid);
+	}
+    }
+  else if (s_spans != NULL)
+    {
+      g_mutex_lock(&s_lock);
+      guint i;
+      for (i = 0; i < s_spans->len; ++i)
+	append_span(out, &g_array_index(s_spans, span_t, i), pid);
+      g_mutex_unlock(&s_lock);
+    }
+
+  g_string_append(out, "]}\n");
+  return g_string_free(out, FALSE);
+}
+
+void trace_reset(void)
+{
+  if (s_ring != NULL)
+    {
+      __atomic_store_n(&s_ring_next, 0, __ATOMIC_RELAXED);
+      memset(s_ring, 0, s_ring_size * sizeof(span_t));
+    }
+  else if (s_spans != NULL)
+    {
+      g_mutex_lock(&s_lock);
+      g_array_set_size(s_spans, 0);
+      g_mutex_unlock(&s_lock);
+    }
+}
+
+void trace_shutdown(void)
+{
+  if (s_filename != NULL)
+    {
+      gchar* json = trace_format();
+      GError* error = NULL;
+      if (!g_file_set_contents(s_filename, json, -1, &error))
+	{
+	  g_warning("Can't write trace: %s", error->message);
+	  g_error_free(error);
+	}
+      g_free(json);
+    }
+
+  trace_sink = NULL;
+  g_free(s_ring);
+  s_ring = NULL;
+  if (s_spans != NULL)
+    g_array_free(s_spans, TRUE);
+  s_spans = NULL;
+  g_free(s_filename);
+  s_filename = NULL;
+}
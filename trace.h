@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+/*
+ * Span tracing in Chrome trace-event format. Tracing is off unless the
+ * host calls trace_init_from_env() with TAGFS_TRACE (file written at
+ * exit) or TAGFS_TRACE_RING (keep the last N spans) set:
+ *
+ *   guint64 start = trace_begin();
+ *   ...
+ *   trace_end("magic", "scan", start);
+ *
+ * Names and categories are kept by pointer: pass literals or interned
+ * strings. Plugins carry their own copy of this file and get the host's
+ * recorder through TAGFS_PLUGIN_TRACE_ENTRY.
+ */
+
+typedef void (*trace_sink_t)(const gchar* name, const gchar* category, guint64 start_us, guint64 end_us);
+
+#define TAGFS_PLUGIN_TRACE_ENTRY "tagfs_plugin_set_trace_sink"
+typedef void (*PluginTraceEntry)(trace_sink_t sink);
+
+guint64 trace_now(void);
+
+extern trace_sink_t trace_sink;
+
+static inline guint64 trace_begin(void)
+{
+  return trace_sink != NULL ? trace_now() : 0;
+}
+
+static inline void trace_end(const gchar* name, const gchar* category, guint64 start)
+{
+  if (trace_sink != NULL && start != 0)
+    trace_sink(name, category, start, trace_now());
+}
+
+/* host side */
+void trace_init_from_env(void);
+gchar* trace_format(void);
+void trace_reset(void);
+/* writes TAGFS_TRACE */
+void trace_shutdown(void);
+
+#endif
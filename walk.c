@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "walk.h"
+#include "trace.h"
+
+typedef struct tagWalkDir walk_dir_t;
+
+struct tagWalkDir
+{
+  walk_dir_t* parent; /* referenced until this directory is opened */
+  DIR* dir;
+  gint refs;          /* the listing and every child not yet opened */
+  gchar* path;
+  gsize name_offset;
+};
+
+typedef struct tagWalk
+{
+  const walk_callbacks_t* callbacks;
+  gpointer user_data;
+
+  GMutex lock;
+  GCond cond;
+  GPtrArray* stack;   /* of walk_dir_t, not yet opened */
+  guint active;       /* workers listing a directory */
+
+  guint files;
+  guint errors;
+} walk_t;
+
+typedef struct tagWorker
+{
+  walk_t* walk;
+  guint index;
+} worker_t;
+
+static walk_dir_t* dir_new(walk_dir_t* parent, const gchar* path, gsize name_offset)
+{
+  walk_dir_t* dir = g_slice_new0(walk_dir_t);
+  dir->parent = parent;
+  dir->refs = 1;
+  dir->path = g_strdup(path);
+  dir->name_offset = name_offset;
+  if (parent != NULL)
+    g_atomic_int_inc(&parent->refs);
+  return dir;
+}
+
+static void dir_unref(walk_dir_t* dir)
+{
+  if (!g_atomic_int_dec_and_test(&dir->refs))
+    return;
+  if (dir->parent != NULL)
+    dir_unref(dir->parent);
+  if (dir->dir != NULL)
+    closedir(dir->dir);
+  g_free(dir->path);
+  g_slice_free(walk_dir_t, dir);
+}
+
+static void push(walk_t* walk, walk_dir_t* dir)
+{
+  g_mutex_lock(&walk->lock);
+  g_ptr_array_add(walk->stack, dir);
+  g_cond_signal(&walk->cond);
+  g_mutex_unlock(&walk->lock);
+}
+
+static gboolean open_dir(walk_dir_t* dir)
+{
+  int fd = -1;
+  if (dir->parent != NULL)
+    fd = openat(dirfd(dir->parent->dir), dir->path + dir->name_offset,
+		O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  /* the root, or out of descriptors while many parents are held */
+  if (fd == -1 && (dir->parent == NULL || errno == EMFILE))
+    fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  /* the parent is only needed for openat */
+  if (dir->parent != NULL)
+    {
+      dir_unref(dir->parent);
+      dir->parent = NULL;
+    }
+
+  if (fd == -1)
+    return FALSE;
+  dir->dir = fdopendir(fd);
+  if (dir->dir == NULL)
+    {
+      close(fd);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* DT_REG, DT_DIR or DT_UNKNOWN for anything else or an error */
+static guchar entry_type(walk_t* walk, DIR* dir, const struct dirent* e)
+{
+  if (e->d_type == DT_REG || e->d_type == DT_DIR)
+    return e->d_type;
+  if (e->d_type != DT_UNKNOWN && e->d_type != DT_LNK)
+    return DT_UNKNOWN;
+
+  struct stat st;
+  gboolean link = e->d_type == DT_LNK;
+  if (!link)
+    {
+      if (fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+	goto error;
+      if (S_ISDIR(st.st_mode))
+	return DT_DIR;
+      link = S_ISLNK(st.st_mode);
+    }
+  /* symlinks to directories could form cycles: only files are followed */
+  if (link && fstatat(dirfd(dir), e->d_name, &st, 0) == -1)
+    goto error;
+  return S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+error:
+  __atomic_add_fetch(&walk->errors, 1, __ATOMIC_RELAXED);
+  return DT_UNKNOWN;
+}
+
+static void list_dir(walk_t* walk, guint worker, walk_dir_t* dir)
+{
+  guint64 span = trace_begin();
+  gboolean want_files = walk->callbacks->enter == NULL
+    || walk->callbacks->enter(dir->path, worker, walk->user_data);
+
+  GString* path = g_string_new(dir->path);
+  if (path->len == 0 || path->str[path->len - 1] != '/')
+    g_string_append_c(path, '/');
+  gsize prefix = path->len;
+
+  guint files = 0;
+  struct dirent* e;
+  while ((e = readdir(dir->dir)) != NULL)
+    {
+      if (e->d_name[0] == '.' &&
+	  (e->d_name[1] == '\0' || (e->d_name[1] == '.' && e->d_name[2] == '\0')))
+	continue;
+      /* d_type alone tells regular files, no need to look closer */
+      if (!want_files && e->d_type == DT_REG)
+	continue;
+
+      guchar type = entry_type(walk, dir->dir, e);
+      if (type == DT_UNKNOWN)
+	continue;
+
+      g_string_truncate(path, prefix);
+      g_string_append(path, e->d_name);
+      if (type == DT_REG)
+	{
+	  if (want_files)
+	    {
+	      walk->callbacks->file(path->str, path->str + prefix, worker, walk->user_data);
+	      ++files;
+	    }
+	}
+      else
+	{
+	  push(walk, dir_new(dir, path->str, prefix));
+	}
+    }
+
+  __atomic_add_fetch(&walk->files, files, __ATOMIC_RELAXED);
+  g_string_free(path, TRUE);
+  if (walk->callbacks->leave != NULL)
+    walk->callbacks->leave(dir->path, worker, walk->user_data);
+  trace_end("dir", "scan", span);
+}
+
+static gpointer worker_run(gpointer data)
+{
+  worker_t* worker = data;
+  walk_t* walk = worker->walk;
+
+  g_mutex_lock(&walk->lock);
+  for (;;)
+    {
+      while (walk->stack->len == 0 && walk->active > 0)
+	g_cond_wait(&walk->cond, &walk->lock);
+      if (walk->stack->len == 0)
+	break;
+
+      walk_dir_t* dir = g_ptr_array_remove_index(walk->stack, walk->stack->len - 1);
+      ++walk->active;
+      g_mutex_unlock(&walk->lock);
+
+      if (open_dir(dir))
+	list_dir(walk, worker->index, dir);
+      else
+	__atomic_add_fetch(&walk->errors, 1, __ATOMIC_RELAXED);
+      dir_unref(dir);
+
+      g_mutex_lock(&walk->lock);
+      --walk->active;
+    }
+  /* wake the others to see the walk is over */
+  g_cond_broadcast(&walk->cond);
+  g_mutex_unlock(&walk->lock);
+  return NULL;
+}
+
+guint walk_tree(const gchar* root, guint threads, const walk_callbacks_t* callbacks, gpointer user_data, guint* errors)
+{
+  walk_t walk;
+  memset(&walk, 0, sizeof(walk));
+  walk.callbacks = callbacks;
+  walk.user_data = user_data;
+  g_mutex_init(&walk.lock);
+  g_cond_init(&walk.cond);
+  walk.stack = g_ptr_array_new();
+  g_ptr_array_add(walk.stack, dir_new(NULL, root, 0));
+
+  threads = MAX(threads, 1);
+  worker_t* workers = g_new(worker_t, threads);
+  GThread** others = g_new0(GThread*, threads);
+  guint i;
+  for (i = 0; i < threads; ++i)
+    {
+      workers[i].walk = &walk;
+      workers[i].index = i;
+    }
+  for (i = 1; i < threads; ++i)
+    others[i] = g_thread_new("walk", worker_run, &workers[i]);
+  worker_run(&workers[0]);
+  for (i = 1; i < threads; ++i)
+    g_thread_join(others[i]);
+
+  g_free(others);
+  g_free(workers);
+  g_ptr_array_free(walk.stack, TRUE);
+  g_cond_clear(&walk.cond);
+  g_mutex_clear(&walk.lock);
+
+  if (errors != NULL)
+    *errors = walk.errors;
+  return walk.files;
+}
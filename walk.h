@@ -0,0 +1,37 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <glib.h>
+
+/*
+ * Directory traversal relative to open directory descriptors: entries are
+ * classified by d_type, fstatat is only called when the file system
+ * leaves it unknown or for symlinks. Symlinks to regular files are
+ * reported, symlinks to directories are not followed.
+ */
+
+/*
+ * Paths are only valid during a call. worker is below the threads passed
+ * to walk_tree; the caller's thread is worker 0. A directory is entered,
+ * its files are reported by the same worker, then it is left. Returning
+ * FALSE from enter skips its files but not its subdirectories.
+ */
+typedef void (*walk_file_func_t)(const gchar* path, const gchar* name, guint worker, gpointer user_data);
+typedef gboolean (*walk_enter_func_t)(const gchar* path, guint worker, gpointer user_data);
+typedef void (*walk_leave_func_t)(const gchar* path, guint worker, gpointer user_data);
+
+typedef struct tagWalkCallbacks
+{
+  walk_file_func_t file;
+  walk_enter_func_t enter; /* optional */
+  walk_leave_func_t leave; /* optional */
+} walk_callbacks_t;
+
+/*
+ * Walks root with up to threads workers taking subdirectories from a
+ * shared stack. Returns the number of files reported; entries that could
+ * not be opened or stat'ed are skipped and counted in errors.
+ */
+guint walk_tree(const gchar* root, guint threads, const walk_callbacks_t* callbacks, gpointer user_data, guint* errors);
+
+#endif